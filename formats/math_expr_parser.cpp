@@ -1,6 +1,7 @@
 //https://code.google.com/p/nya-engine/
 
 #include "math_expr_parser.h"
+#include "string_convert.h"
 #include <sstream>
 #include <stack>
 #include <math.h>
@@ -169,8 +170,7 @@ float math_expr_parser::get_value(const std::string &str) const
     if(!isalpha(str[0]))
     {
         float out=0.0f;
-        std::istringstream iss(str);
-        if(iss>>out)
+        if(float_from_string(str.c_str(),str.size(),out))
             return out;
 
         return 0.0f;
@@ -6,7 +6,26 @@
 #include <stdio.h>
 #include <stdint.h>
 
-namespace { const char nms_sign[]={'n','y','a',' ','m','e','s','h'}; }
+namespace
+{
+
+const char nms_sign[]={'n','y','a',' ','m','e','s','h'};
+
+size_t get_chunk_header_size(unsigned int version) { return sizeof(uint32_t)*(version>2?3:2); }
+
+size_t get_align_padding(size_t offset,unsigned int align) { return align>1?(align-offset%align)%align:0; }
+
+void hash_fnv1a(uint64_t &hash,const void *data,size_t size)
+{
+    const unsigned char *d=(const unsigned char *)data;
+    for(size_t i=0;i<size;++i)
+    {
+        hash^=d[i];
+        hash*=1099511628211ULL;
+    }
+}
+
+}
 
 namespace nya_formats
 {
@@ -29,7 +48,14 @@ bool nms::read_chunks_info(const void *data,size_t size)
     chunks.resize(h.chunks_count);
     for(size_t i=0;i<chunks.size();++i)
     {
-        cdata+=read_chunk_info(chunks[i],cdata,data_end-cdata);
+        const size_t info_size=read_chunk_info(chunks[i],cdata,data_end-cdata,version);
+        if(!info_size)
+        {
+            *this=nms();
+            return false;
+        }
+
+        cdata+=info_size;
         cdata+=chunks[i].size;
         if(cdata>data_end)
         {
@@ -60,15 +86,24 @@ size_t nms::read_header(header &out_header,const void *data,size_t size)
     return reader.get_offset();
 }
 
-size_t nms::read_chunk_info(chunk_info &out_chunk_info,const void *data,size_t size)
+size_t nms::read_chunk_info(chunk_info &out_chunk_info,const void *data,size_t size,unsigned int version)
 {
-    if(size<sizeof(uint32_t)*2)
+    out_chunk_info=chunk_info();
+    if(size<get_chunk_header_size(version))
         return 0;
 
-    out_chunk_info.type=out_chunk_info.size=0;
     nya_memory::memory_reader reader(data,size);
     out_chunk_info.type=reader.read<uint32_t>();
     out_chunk_info.size=reader.read<uint32_t>();
+    if(version>2)
+    {
+        const uint32_t padding=reader.read<uint32_t>();
+        if(!reader.check_remained(padding))
+            return 0;
+
+        reader.skip(padding);
+    }
+
     out_chunk_info.data=reader.get_data();
 
     return reader.get_offset();
@@ -78,7 +113,7 @@ size_t nms::get_nms_size()
 {
     size_t size=nms_header_size;
     for(size_t i=0;i<chunks.size();++i)
-        size+=get_chunk_write_size(chunks[i].size);
+        size+=get_chunk_write_size(chunks[i].size,version,chunks[i].align,size);
 
     return size;
 }
@@ -99,7 +134,13 @@ size_t nms::write_to_buf(void *data,size_t size)
         return 0;
 
     for(size_t i=0;i<chunks.size();++i)
-        cdata+=write_chunk_to_buf(chunks[i],cdata,data_end-cdata);
+    {
+        const size_t chunk_size=write_chunk_to_buf(chunks[i],cdata,data_end-cdata,version,cdata-(char *)data);
+        if(!chunk_size)
+            return 0;
+
+        cdata+=chunk_size;
+    }
 
     return cdata-(char *)data;
 }
@@ -117,16 +158,32 @@ size_t nms::write_header_to_buf(const header &h,void *to_data,size_t to_size)
     return writer.get_offset();
 }
 
-size_t nms::get_chunk_write_size(size_t chunk_data_size) { return chunk_data_size+sizeof(uint32_t)*2; }
+size_t nms::get_chunk_write_size(size_t chunk_data_size,unsigned int version,unsigned int align,size_t file_offset)
+{
+    const size_t header_size=get_chunk_header_size(version);
+    if(version<3)
+        return chunk_data_size+header_size;
+
+    return chunk_data_size+header_size+get_align_padding(file_offset+header_size,align?align:default_chunk_align);
+}
 
-size_t nms::write_chunk_to_buf(const chunk_info &chunk,void *to_data,size_t to_size)
+size_t nms::write_chunk_to_buf(const chunk_info &chunk,void *to_data,size_t to_size,unsigned int version,size_t file_offset)
 {
-    if(!to_data || to_size<get_chunk_write_size(chunk.size))
+    if(!to_data || to_size<get_chunk_write_size(chunk.size,version,chunk.align,file_offset))
         return 0;
 
     nya_memory::memory_writer writer(to_data,to_size);
     writer.write_uint(chunk.type);
     writer.write_uint(chunk.size);
+    if(version>2)
+    {
+        const size_t padding=get_align_padding(file_offset+get_chunk_header_size(version),
+                                               chunk.align?chunk.align:default_chunk_align);
+        writer.write_uint((unsigned int)padding);
+        for(size_t i=0;i<padding;++i)
+            writer.write_ubyte(0);
+    }
+
     if(!chunk.size)
         return writer.get_offset();
 
@@ -137,7 +194,68 @@ size_t nms::write_chunk_to_buf(const chunk_info &chunk,void *to_data,size_t to_s
     return writer.get_offset();
 }
 
-size_t nms_mesh_chunk::read_header(const void *data, size_t size, int version)
+namespace
+{
+
+void read_lods(nya_memory::memory_reader &reader,std::vector<nms_mesh_chunk::lod> &lods,int version)
+{
+    lods.resize(reader.read<uint16_t>());
+    for(size_t i=0;i<lods.size();++i)
+    {
+        nms_mesh_chunk::lod &l=lods[i];
+        l.groups.resize(reader.read<uint16_t>());
+        for(size_t j=0;j<l.groups.size();++j)
+        {
+            nms_mesh_chunk::group &g=l.groups[j];
+            g.name=reader.read_string();
+
+            g.aabb_min=reader.read<nya_math::vec3>();
+            g.aabb_max=reader.read<nya_math::vec3>();
+
+            g.material_idx=reader.read<uint16_t>();
+            g.offset=reader.read<uint32_t>();
+            g.count=reader.read<uint32_t>();
+            g.element_type=version>1?nms_mesh_chunk::draw_element_type(reader.read<uint8_t>()):nms_mesh_chunk::triangles;
+        }
+    }
+}
+
+void write_lods(nya_memory::memory_writer &writer,const std::vector<nms_mesh_chunk::lod> &lods,int version)
+{
+    writer.write_ushort((unsigned short)lods.size());
+    for(size_t i=0;i<lods.size();++i)
+    {
+        const nms_mesh_chunk::lod &l=lods[i];
+        writer.write_ushort((unsigned short)l.groups.size());
+        for(size_t j=0;j<l.groups.size();++j)
+        {
+            const nms_mesh_chunk::group &g=l.groups[j];
+            writer.write_string(g.name);
+
+            writer.write(g.aabb_min);
+            writer.write(g.aabb_max);
+
+            writer.write_ushort(g.material_idx);
+            writer.write_uint(g.offset);
+            writer.write_uint(g.count);
+            if(version>1)
+                writer.write_ubyte(g.element_type);
+        }
+    }
+}
+
+void write_padding(nya_memory::memory_writer &writer,size_t to_offset)
+{
+    while(writer.get_offset()<to_offset)
+    {
+        if(!writer.write_ubyte(0))
+            break;
+    }
+}
+
+}
+
+size_t nms_mesh_chunk::read_header(const void *data,size_t size,int version)
 {
     *this=nms_mesh_chunk();
 
@@ -145,7 +263,6 @@ size_t nms_mesh_chunk::read_header(const void *data, size_t size, int version)
         return 0;
 
     typedef uint32_t uint;
-    typedef uint16_t ushort;
     typedef uint8_t uchar;
 
     nya_memory::memory_reader reader(data,size);
@@ -166,6 +283,17 @@ size_t nms_mesh_chunk::read_header(const void *data, size_t size, int version)
         {
             case float16: vertex_stride+=e.dimension*2; break;
             case float32: vertex_stride+=e.dimension*4; break;
+            case uint8:
+            case uint16:
+                if(version<3)
+                {
+                    *this=nms_mesh_chunk();
+                    return 0;
+                }
+
+                vertex_stride+=e.dimension*(e.data_type==uint16?2:1);
+            break;
+
             default:
                 *this=nms_mesh_chunk();
                 return 0;
@@ -180,6 +308,51 @@ size_t nms_mesh_chunk::read_header(const void *data, size_t size, int version)
     }
 
     verts_count=reader.read<uint>();
+
+    if(version>2)
+    {
+        const uint index_size=reader.read<uchar>();
+        if(index_size!=no_indices && index_size!=index2b && index_size!=index4b)
+        {
+            *this=nms_mesh_chunk();
+            return 0;
+        }
+
+        this->index_size=(ind_size)index_size;
+        if(index_size)
+            indices_count=reader.read<uint>();
+
+        read_lods(reader,lods,version);
+        if(!reader.check_remained(sizeof(uint64_t)+sizeof(uint)*3))
+        {
+            *this=nms_mesh_chunk();
+            return 0;
+        }
+
+        content_hash=reader.read<uint64_t>();
+        data_align=reader.read<uint>();
+        const uint vertices_offset=reader.read<uint>();
+        const uint indices_offset=reader.read<uint>();
+
+        const size_t vertices_size=size_t(verts_count)*vertex_stride;
+        const size_t indices_size=size_t(indices_count)*index_size;
+        if(!data_align || vertices_offset<reader.get_offset() || vertices_offset>size || size-vertices_offset<vertices_size
+           || (index_size && (indices_offset<vertices_offset+vertices_size || indices_offset>size || size-indices_offset<indices_size)))
+        {
+            *this=nms_mesh_chunk();
+            return 0;
+        }
+
+        vertices_data=(const char *)data+vertices_offset;
+        if(index_size)
+        {
+            indices_data=(const char *)data+indices_offset;
+            return indices_offset+indices_size;
+        }
+
+        return vertices_offset+vertices_size;
+    }
+
     if(!reader.check_remained(verts_count*vertex_stride))
     {
         *this=nms_mesh_chunk();
@@ -220,30 +393,12 @@ size_t nms_mesh_chunk::read_header(const void *data, size_t size, int version)
 
     this->index_size=(ind_size)index_size;
 
-    lods.resize(reader.read<ushort>());
-    for(size_t i=0;i<lods.size();++i)
-    {
-        lod &l=lods[i];
-        l.groups.resize(reader.read<ushort>());
-        for(size_t j=0;j<l.groups.size();++j)
-        {
-            group &g=l.groups[j];
-            g.name=reader.read_string();
-
-            g.aabb_min=reader.read<nya_math::vec3>();
-            g.aabb_max=reader.read<nya_math::vec3>();
-
-            g.material_idx=reader.read<ushort>();
-            g.offset=reader.read<uint>();
-            g.count=reader.read<uint>();
-            g.element_type=version>1?draw_element_type(reader.read<uchar>()):triangles;
-        }
-    }
+    read_lods(reader,lods,version);
 
     return reader.get_offset();
 }
 
-size_t nms_mesh_chunk::write_to_buf(void *to_data,size_t to_size)
+size_t nms_mesh_chunk::write_to_buf(void *to_data,size_t to_size,int version)
 {
     nya_memory::memory_writer writer(to_data,to_size);
 
@@ -256,11 +411,48 @@ size_t nms_mesh_chunk::write_to_buf(void *to_data,size_t to_size)
         element &e=elements[i];
         writer.write_ubyte(e.type);
         writer.write_ubyte(e.dimension);
-        writer.write_ubyte(e.data_type);
+        if(version>1)
+            writer.write_ubyte(e.data_type);
         writer.write_string(e.semantics);
     }
 
     writer.write_uint(verts_count);
+
+    if(version>2)
+    {
+        writer.write_ubyte(index_size);
+        if(index_size)
+            writer.write_uint(indices_count);
+
+        write_lods(writer,lods,version);
+
+        if(!data_align)
+            data_align=default_data_align;
+
+        content_hash=calculate_content_hash();
+
+        const size_t vertices_size=size_t(verts_count)*vertex_stride;
+        const size_t vertices_offset=writer.get_offset()+sizeof(uint64_t)+sizeof(uint32_t)*3;
+        const size_t vertices_aligned_offset=vertices_offset+get_align_padding(vertices_offset,data_align);
+        const size_t indices_offset=vertices_aligned_offset+vertices_size;
+        const size_t indices_aligned_offset=indices_offset+get_align_padding(indices_offset,data_align);
+
+        writer.write(content_hash);
+        writer.write_uint(data_align);
+        writer.write_uint((unsigned int)vertices_aligned_offset);
+        writer.write_uint(index_size?(unsigned int)indices_aligned_offset:0);
+
+        write_padding(writer,vertices_aligned_offset);
+        writer.write(vertices_data,vertices_size);
+        if(index_size)
+        {
+            write_padding(writer,indices_aligned_offset);
+            writer.write(indices_data,indices_count*index_size);
+        }
+
+        return writer.get_offset();
+    }
+
     writer.write(vertices_data,verts_count*vertex_stride);
     writer.write_ubyte(index_size);
     if(index_size)
@@ -269,27 +461,20 @@ size_t nms_mesh_chunk::write_to_buf(void *to_data,size_t to_size)
         writer.write(indices_data,indices_count*index_size);
     }
 
-    writer.write_ushort((unsigned short)lods.size());
-    for(size_t i=0;i<lods.size();++i)
-    {
-        lod &l=lods[i];
-        writer.write_ushort((unsigned short)l.groups.size());
-        for(size_t j=0;j<l.groups.size();++j)
-        {
-            group &g=l.groups[j];
-            writer.write_string(g.name);
+    write_lods(writer,lods,version);
 
-            writer.write(g.aabb_min);
-            writer.write(g.aabb_max);
+    return writer.get_offset();
+}
 
-            writer.write_ushort(g.material_idx);
-            writer.write_uint(g.offset);
-            writer.write_uint(g.count);
-            writer.write_ubyte(g.element_type);
-        }
-    }
+uint64_t nms_mesh_chunk::calculate_content_hash() const
+{
+    uint64_t hash=14695981039346656037ULL;
+    if(vertices_data)
+        hash_fnv1a(hash,vertices_data,size_t(verts_count)*vertex_stride);
+    if(indices_data)
+        hash_fnv1a(hash,indices_data,size_t(indices_count)*index_size);
 
-    return writer.get_offset();
+    return hash;
 }
 
 bool nms_material_chunk::read(const void *data,size_t size,int version)
@@ -421,31 +606,65 @@ void nms_material_chunk::material_info::add_int_param(const char *name,int value
     if(name) add_param(name,ints,unique).value=value;
 }
 
-void nms_skeleton_chunk::sort()
+std::vector<int> nms_skeleton_chunk::sort()
 {
-    for(int i=0;i<int(bones.size());++i)
+    const int count=int(bones.size());
+    std::vector<int> remap(count,-1);
+    std::vector<int> order;
+    order.reserve(count);
+
+    const int in_chain= -2;
+    std::vector<int> chain;
+    for(int i=0;i<count;++i)
     {
-        bool had_sorted=false;
-        for(int j=0;j<int(bones.size());++j)
+        if(remap[i]>=0)
+            continue;
+
+        //collect not yet placed ancestors, then place them top-down
+        chain.clear();
+        int b=i;
+        for(;b>=0 && b<count && remap[b]== -1;b=bones[b].parent)
         {
-            const int p=bones[j].parent;
-            if(p<=j)
-                continue;
+            remap[b]=in_chain;
+            chain.push_back(b);
+        }
 
-            had_sorted=true;
-            std::swap(bones[j],bones[p]);
-            for(int k=0;k<(int)bones.size();++k)
-            {
-                if(bones[k].parent==j)
-                    bones[k].parent=p;
-                else if(bones[k].parent==p)
-                    bones[k].parent=j;
-            }
+        if(b>=0 && b<count && remap[b]==in_chain) //cycle
+            bones[chain.back()].parent= -1;
+
+        for(int j=int(chain.size())-1;j>=0;--j)
+        {
+            remap[chain[j]]=int(order.size());
+            order.push_back(chain[j]);
         }
+    }
 
-        if(!had_sorted)
+    bool sorted=true;
+    for(int i=0;i<count;++i)
+    {
+        if(remap[i]!=i)
+        {
+            sorted=false;
             break;
+        }
     }
+
+    if(!sorted)
+    {
+        std::vector<bone> sorted_bones(count);
+        for(int i=0;i<count;++i)
+        {
+            bone &b=sorted_bones[i];
+            b=bones[order[i]];
+            if(b.parent>=0 && b.parent<count)
+                b.parent=remap[b.parent];
+        }
+
+        bones.swap(sorted_bones);
+    }
+
+    build_index();
+    return remap;
 }
 
 int nms_skeleton_chunk::get_bone_idx(const char *name) const
@@ -453,6 +672,9 @@ int nms_skeleton_chunk::get_bone_idx(const char *name) const
     if(!name)
         return -1;
 
+    if(m_indexed_count==bones.size())
+        return m_index.find(name);
+
     for(int i=0;i<(int)bones.size();++i)
     {
         if(bones[i].name==name)
@@ -462,6 +684,16 @@ int nms_skeleton_chunk::get_bone_idx(const char *name) const
     return -1;
 }
 
+void nms_skeleton_chunk::build_index()
+{
+    m_index.clear();
+    m_index.reserve(int(bones.size()));
+    for(int i=0;i<(int)bones.size();++i)
+        m_index.insert(bones[i].name.c_str(),i);
+
+    m_indexed_count=bones.size();
+}
+
 bool nms_skeleton_chunk::read(const void *data,size_t size,int version)
 {
     *this=nms_skeleton_chunk();
@@ -481,6 +713,7 @@ bool nms_skeleton_chunk::read(const void *data,size_t size,int version)
         b.parent=reader.read<int32_t>();
     }
 
+    build_index();
     return true;
 }
 
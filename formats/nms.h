@@ -8,8 +8,10 @@
 #include <vector>
 #include <string>
 #include <stddef.h>
+#include <stdint.h>
 #include "math/vector.h"
 #include "math/quaternion.h"
+#include "memory/hash_index.h"
 
 namespace nya_formats
 {
@@ -23,6 +25,9 @@ struct nms
         unsigned int type;
         unsigned int size;
         const void *data;
+        unsigned int align; //version 3+, chunk data file offset alignment, 0 for default_chunk_align
+
+        chunk_info(): type(0),size(0),data(0),align(0) {}
     };
 
     enum section_type
@@ -47,7 +52,7 @@ public:
     };
 
     static size_t read_header(header &out_header,const void *data,size_t size=nms_header_size);
-    static size_t read_chunk_info(chunk_info &out_chunk_info,const void *data,size_t size);
+    static size_t read_chunk_info(chunk_info &out_chunk_info,const void *data,size_t size,unsigned int version=latest_version);
 
 public:
     size_t get_nms_size();
@@ -62,12 +67,16 @@ public:
 
     static size_t write_header_to_buf(const header &h,void *to_data,size_t to_size=nms_header_size);
 
-    static size_t get_chunk_write_size(size_t chunk_data_size);
-    static size_t write_chunk_to_buf(const chunk_info &chunk,void *to_data,size_t to_size); //to_size=get_chunk_size()
+    //file_offset is the chunk position in the nms file, used to align chunk data since version 3
+    static size_t get_chunk_write_size(size_t chunk_data_size,unsigned int version=latest_version,
+                                       unsigned int align=0,size_t file_offset=0);
+    static size_t write_chunk_to_buf(const chunk_info &chunk,void *to_data,size_t to_size,
+                                     unsigned int version=latest_version,size_t file_offset=0); //to_size=get_chunk_write_size()
 
 public:
     const static size_t nms_header_size=16;
-    const static unsigned int latest_version=2;
+    const static unsigned int latest_version=3;
+    const static unsigned int default_chunk_align=16;
 };
 
 struct nms_mesh_chunk
@@ -84,7 +93,8 @@ struct nms_mesh_chunk
     {
         float16,
         float32,
-        uint8
+        uint8,
+        uint16 //normalized, version 3+
     };
 
     enum ind_size
@@ -144,15 +154,28 @@ struct nms_mesh_chunk
 
     std::vector<lod> lods;
 
+    //version 3+: vertices_data and indices_data are aligned to data_align relative to the chunk start,
+    //so they are directly uploadable when the chunk itself is placed at data_align in a mapped file
+    unsigned int data_align;
+    uint64_t content_hash;
+
 public:
     nms_mesh_chunk(): verts_count(0),vertex_stride(0),vertices_data(0),
-                      index_size(no_indices),indices_count(0),indices_data(0) {}
+                      index_size(no_indices),indices_count(0),indices_data(0),
+                      data_align(default_data_align),content_hash(0) {}
 public:
     size_t read_header(const void *data,size_t size,int version); //0 if invalid
 
 public:
     //size_t get_chunk_size();
-    size_t write_to_buf(void *to_data,size_t to_size);
+    size_t write_to_buf(void *to_data,size_t to_size,int version=nms::latest_version); //updates content_hash
+
+public:
+    uint64_t calculate_content_hash() const; //fnv-1a of vertex and index data
+
+public:
+    const static unsigned int default_data_align=16;
+    const static unsigned int page_data_align=4096;
 };
 
 struct nms_material_chunk
@@ -223,15 +246,27 @@ struct nms_skeleton_chunk
     std::vector<bone> bones;
 
 public:
-    void sort();
+    //reorders bones parent before child in linear time, already sorted bones keep their order
+    //returns remap table: new bone index by old bone index
+    std::vector<int> sort();
+
+    //hashed if the index is up to date, call build_index after modifying bones
     int get_bone_idx(const char *name) const;
+    void build_index();
 
 public:
-    bool read(const void *data,size_t size,int version);
+    bool read(const void *data,size_t size,int version); //builds index
+
+public:
+    nms_skeleton_chunk(): m_indexed_count(0) {}
 
 public:
     //size_t get_chunk_size();
     size_t write_to_buf(void *to_data,size_t to_size);
+
+private:
+    nya_memory::hash_index m_index;
+    size_t m_indexed_count;
 };
 
 }
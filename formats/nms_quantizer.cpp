@@ -0,0 +1,377 @@
+//https://code.google.com/p/nya-engine/
+
+#include "nms_quantizer.h"
+#include "math/scalar.h"
+#include <string.h>
+#include <stdint.h>
+
+namespace nya_formats
+{
+
+const char *nms_quantizer::dequant_pos_scale_param="nya dequant pos scale";
+const char *nms_quantizer::dequant_pos_offset_param="nya dequant pos offset";
+
+namespace
+{
+
+unsigned int get_atrib_size(nms_mesh_chunk::vertex_atrib_type type)
+{
+    switch(type)
+    {
+        case nms_mesh_chunk::float16: return 2;
+        case nms_mesh_chunk::float32: return 4;
+        case nms_mesh_chunk::uint8: return 1;
+        case nms_mesh_chunk::uint16: return 2;
+    }
+
+    return 0;
+}
+
+bool is_float(nms_mesh_chunk::vertex_atrib_type type) { return type==nms_mesh_chunk::float16 || type==nms_mesh_chunk::float32; }
+
+float read_value(const char *data,nms_mesh_chunk::vertex_atrib_type type,unsigned int idx)
+{
+    switch(type)
+    {
+        case nms_mesh_chunk::float16:
+        {
+            uint16_t h;
+            memcpy(&h,data+idx*2,2);
+            return nms_quantizer::half_to_float(h);
+        }
+
+        case nms_mesh_chunk::float32:
+        {
+            float f;
+            memcpy(&f,data+idx*4,4);
+            return f;
+        }
+
+        case nms_mesh_chunk::uint8: return ((const uint8_t *)data)[idx]/255.0f;
+
+        case nms_mesh_chunk::uint16:
+        {
+            uint16_t u;
+            memcpy(&u,data+idx*2,2);
+            return u/65535.0f;
+        }
+    }
+
+    return 0.0f;
+}
+
+uint16_t to_unorm16(float f) { return (uint16_t)(nya_math::clamp(f,0.0f,1.0f)*65535.0f+0.5f); }
+float from_unorm16(uint16_t u) { return u/65535.0f; }
+
+float sign_not_zero(float f) { return f<0.0f?-1.0f:1.0f; }
+
+nya_math::vec2 oct_encode(const nya_math::vec3 &n)
+{
+    const float l1=fabsf(n.x)+fabsf(n.y)+fabsf(n.z);
+    if(l1<0.00001f)
+        return nya_math::vec2(0.0f,0.0f);
+
+    nya_math::vec2 p(n.x/l1,n.y/l1);
+    if(n.z<0.0f)
+        p=nya_math::vec2((1.0f-fabsf(p.y))*sign_not_zero(p.x),(1.0f-fabsf(p.x))*sign_not_zero(p.y));
+
+    return p;
+}
+
+nya_math::vec3 oct_decode(const nya_math::vec2 &e)
+{
+    nya_math::vec3 n(e.x,e.y,1.0f-fabsf(e.x)-fabsf(e.y));
+    if(n.z<0.0f)
+    {
+        const float x=n.x;
+        n.x=(1.0f-fabsf(n.y))*sign_not_zero(x);
+        n.y=(1.0f-fabsf(x))*sign_not_zero(n.y);
+    }
+
+    return nya_math::vec3::normalize(n);
+}
+
+enum quantize_mode
+{
+    mode_copy,
+    mode_pos,
+    mode_normal,
+    mode_tc,
+    mode_weights
+};
+
+}
+
+bool nms_quantizer::quantize(const nms_mesh_chunk &from,nms_mesh_chunk &to,const options &opt)
+{
+    report.clear();
+    pos_scale=nya_math::vec3(1.0f,1.0f,1.0f);
+    pos_offset=nya_math::vec3();
+
+    if(!from.vertices_data || !from.verts_count || !from.vertex_stride)
+        return false;
+
+    to=from;
+    to.vertex_stride=0;
+
+    const char *const src=(const char *)from.vertices_data;
+
+    std::vector<quantize_mode> modes(from.elements.size(),mode_copy);
+    for(size_t i=0;i<from.elements.size();++i)
+    {
+        const nms_mesh_chunk::element &e=from.elements[i];
+        nms_mesh_chunk::element &te=to.elements[i];
+        const bool f=is_float(e.data_type);
+
+        if(e.type==nms_mesh_chunk::pos)
+        {
+            if(opt.positions && f && e.dimension>=1 && e.dimension<=3)
+                modes[i]=mode_pos,te.data_type=nms_mesh_chunk::uint16,te.dimension=4;
+        }
+        else if(e.type==nms_mesh_chunk::normal)
+        {
+            if(opt.normals && f && e.dimension==3)
+                modes[i]=mode_normal,te.data_type=nms_mesh_chunk::uint16,te.dimension=2;
+        }
+        else if(e.type>=nms_mesh_chunk::tc0)
+        {
+            const int tc_idx=int(e.type-nms_mesh_chunk::tc0);
+            const bool weights=opt.weights_tc>=0?tc_idx==opt.weights_tc:e.semantics.find("weight")!=std::string::npos;
+            if(weights)
+            {
+                if(f && e.dimension<=4)
+                    modes[i]=mode_weights,te.data_type=nms_mesh_chunk::uint8,te.dimension=4;
+            }
+            else if(opt.tcs && e.data_type==nms_mesh_chunk::float32)
+                modes[i]=mode_tc,te.data_type=nms_mesh_chunk::float16,te.dimension=(e.dimension+1)&~1u;
+        }
+
+        te.offset=to.vertex_stride;
+        to.vertex_stride+=te.dimension*get_atrib_size(te.data_type);
+
+        report.resize(report.size()+1);
+        attribute_report &r=report.back();
+        r.type=e.type;
+        r.semantics=e.semantics;
+        r.from_type=e.data_type;
+        r.to_type=te.data_type;
+        r.from_size=e.dimension*get_atrib_size(e.data_type);
+        r.to_size=te.dimension*get_atrib_size(te.data_type);
+    }
+
+    for(size_t i=0;i<from.elements.size();++i)
+    {
+        if(modes[i]!=mode_pos)
+            continue;
+
+        const nms_mesh_chunk::element &e=from.elements[i];
+        nya_math::vec3 pmin,pmax;
+        for(unsigned int v=0;v<from.verts_count;++v)
+        {
+            const char *vdata=src+v*from.vertex_stride+e.offset;
+            nya_math::vec3 p;
+            for(unsigned int j=0;j<e.dimension;++j)
+                (&p.x)[j]=read_value(vdata,e.data_type,j);
+
+            pmin=v?nya_math::vec3::min(pmin,p):p;
+            pmax=v?nya_math::vec3::max(pmax,p):p;
+        }
+
+        pos_offset=pmin;
+        pos_scale=pmax-pmin;
+
+        //loaders decode cpu side positions with the chunk bounds, so they have to match dequant params
+        to.aabb_min=pmin;
+        to.aabb_max=pmax;
+
+        break;
+    }
+
+    m_vertices.resize(size_t(to.vertex_stride)*to.verts_count);
+    char *const dst=m_vertices.empty()?0:&m_vertices[0];
+
+    for(size_t i=0;i<from.elements.size();++i)
+    {
+        const nms_mesh_chunk::element &e=from.elements[i];
+        const nms_mesh_chunk::element &te=to.elements[i];
+        attribute_report &r=report[i];
+        double error_sum=0.0;
+
+        for(unsigned int v=0;v<from.verts_count;++v)
+        {
+            const char *vsrc=src+v*from.vertex_stride+e.offset;
+            char *vdst=dst+v*to.vertex_stride+te.offset;
+
+            float error=0.0f;
+            switch(modes[i])
+            {
+                case mode_copy: memcpy(vdst,vsrc,r.from_size); break;
+
+                case mode_pos:
+                {
+                    uint16_t q[4]={0,0,0,65535};
+                    nya_math::vec3 p,dp;
+                    for(unsigned int j=0;j<e.dimension;++j)
+                    {
+                        (&p.x)[j]=read_value(vsrc,e.data_type,j);
+                        const float s=(&pos_scale.x)[j];
+                        const float o=(&pos_offset.x)[j];
+                        q[j]=s>0.0f?to_unorm16(((&p.x)[j]-o)/s):0;
+                        (&dp.x)[j]=from_unorm16(q[j])*s+o;
+                    }
+
+                    memcpy(vdst,q,sizeof(q));
+                    error=(p-dp).length();
+                }
+                break;
+
+                case mode_normal:
+                {
+                    nya_math::vec3 n(read_value(vsrc,e.data_type,0),read_value(vsrc,e.data_type,1),read_value(vsrc,e.data_type,2));
+                    n.normalize();
+
+                    const nya_math::vec2 oct=oct_encode(n);
+                    const uint16_t q[2]={to_unorm16(oct.x*0.5f+0.5f),to_unorm16(oct.y*0.5f+0.5f)};
+                    memcpy(vdst,q,sizeof(q));
+
+                    const nya_math::vec3 dn=oct_decode(nya_math::vec2(from_unorm16(q[0])*2.0f-1.0f,from_unorm16(q[1])*2.0f-1.0f));
+                    error=acosf(nya_math::clamp(n.dot(dn),-1.0f,1.0f));
+                }
+                break;
+
+                case mode_tc:
+                {
+                    uint16_t q[4]={0,0,0,0};
+                    for(unsigned int j=0;j<e.dimension;++j)
+                    {
+                        const float t=read_value(vsrc,e.data_type,j);
+                        q[j]=float_to_half(t);
+                        error=nya_math::max(error,fabsf(half_to_float(q[j])-t));
+                    }
+
+                    memcpy(vdst,q,te.dimension*2);
+                }
+                break;
+
+                case mode_weights:
+                {
+                    float w[4]={0.0f,0.0f,0.0f,0.0f};
+                    float sum=0.0f;
+                    for(unsigned int j=0;j<e.dimension;++j)
+                        sum+=(w[j]=nya_math::max(read_value(vsrc,e.data_type,j),0.0f));
+
+                    uint8_t q[4]={0,0,0,0};
+                    if(sum>0.0f)
+                    {
+                        int qsum=0,max_idx=0;
+                        for(int j=0;j<4;++j)
+                        {
+                            q[j]=(uint8_t)(w[j]/sum*255.0f+0.5f);
+                            qsum+=q[j];
+                            if(w[j]>w[max_idx])
+                                max_idx=j;
+                        }
+
+                        q[max_idx]=(uint8_t)(q[max_idx]+255-qsum);
+                    }
+
+                    for(int j=0;j<4;++j)
+                        error=nya_math::max(error,fabsf(q[j]/255.0f-w[j]));
+
+                    memcpy(vdst,q,sizeof(q));
+                }
+                break;
+            }
+
+            r.max_error=nya_math::max(r.max_error,error);
+            error_sum+=error;
+        }
+
+        r.avg_error=float(error_sum/from.verts_count);
+    }
+
+    to.vertices_data=dst;
+    to.content_hash=to.calculate_content_hash();
+    return true;
+}
+
+void nms_quantizer::add_dequant_params(nms_material_chunk &materials,const nya_math::vec3 &pos_scale,const nya_math::vec3 &pos_offset)
+{
+    for(size_t i=0;i<materials.materials.size();++i)
+    {
+        nms_material_chunk::material_info &m=materials.materials[i];
+        m.add_vector_param(dequant_pos_scale_param,nya_math::vec4(pos_scale.x,pos_scale.y,pos_scale.z,1.0f));
+        m.add_vector_param(dequant_pos_offset_param,nya_math::vec4(pos_offset.x,pos_offset.y,pos_offset.z,0.0f));
+    }
+}
+
+unsigned short nms_quantizer::float_to_half(float f)
+{
+    uint32_t u;
+    memcpy(&u,&f,4);
+
+    const uint32_t sign=(u>>16)&0x8000;
+    const int exp=int((u>>23)&0xff)-127+15;
+    uint32_t mant=u&0x7fffff;
+
+    if(((u>>23)&0xff)==0xff)
+        return (unsigned short)(sign|0x7c00|(mant?0x200:0));
+
+    if(exp>=31)
+        return (unsigned short)(sign|0x7c00);
+
+    if(exp<=0)
+    {
+        if(exp<-10)
+            return (unsigned short)sign;
+
+        mant|=0x800000;
+        const int shift=14-exp;
+        uint32_t h=mant>>shift;
+        const uint32_t rem=mant&((1u<<shift)-1);
+        const uint32_t half_way=1u<<(shift-1);
+        if(rem>half_way || (rem==half_way && (h&1)))
+            ++h;
+
+        return (unsigned short)(sign|h);
+    }
+
+    uint32_t h=(uint32_t(exp)<<10)|(mant>>13);
+    const uint32_t rem=mant&0x1fff;
+    if(rem>0x1000 || (rem==0x1000 && (h&1)))
+        ++h; //may carry into exponent, that is the correct rounding
+
+    return (unsigned short)(sign|h);
+}
+
+float nms_quantizer::half_to_float(unsigned short h)
+{
+    const uint32_t sign=uint32_t(h&0x8000)<<16;
+    uint32_t exp=(h>>10)&0x1f;
+    uint32_t mant=h&0x3ff;
+
+    uint32_t u;
+    if(exp==0)
+    {
+        if(!mant)
+            u=sign;
+        else
+        {
+            exp=127-15+1;
+            while(!(mant&0x400))
+                mant<<=1,--exp;
+
+            u=sign|(exp<<23)|((mant&0x3ff)<<13);
+        }
+    }
+    else if(exp==31)
+        u=sign|0x7f800000|(mant<<13);
+    else
+        u=sign|((exp+127-15)<<23)|(mant<<13);
+
+    float f;
+    memcpy(&f,&u,4);
+    return f;
+}
+
+}
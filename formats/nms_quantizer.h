@@ -0,0 +1,73 @@
+//https://code.google.com/p/nya-engine/
+
+#pragma once
+
+//quantizes nms mesh vertex attributes to compact types, requires nms version 3 or later
+//positions: uint16 relative to mesh bounds, w=1.0, decode: pos*pos_scale+pos_offset
+//           chunk bounds are replaced with the positions bounds, pos_offset=aabb_min, pos_scale=aabb_max-aabb_min
+//normals: octahedral uint16x2, decode: e=n.xy*2.0-1.0; n=vec3(e,1.0-abs(e.x)-abs(e.y)); if(n.z<0.0) n.xy=(1.0-abs(n.yx))*sign(n.xy);
+//texture coordinates: float16
+//bone weights: uint8x4, renormalized to keep the sum exactly 1.0
+//
+//pos_scale and pos_offset are exposed to shaders as material vector params,
+//shaders declare them as uniforms with the dequant_pos_scale_param and dequant_pos_offset_param semantics
+
+#include "nms.h"
+#include <vector>
+#include <string>
+
+namespace nya_formats
+{
+
+struct nms_quantizer
+{
+    struct options
+    {
+        bool positions;
+        bool normals;
+        bool tcs;
+        int weights_tc; //-1 to find by semantics containing "weight"
+
+        options(): positions(true),normals(true),tcs(true),weights_tc(-1) {}
+    };
+
+    struct attribute_report
+    {
+        unsigned int type;
+        std::string semantics;
+        nms_mesh_chunk::vertex_atrib_type from_type;
+        nms_mesh_chunk::vertex_atrib_type to_type;
+        unsigned int from_size;
+        unsigned int to_size;
+        float max_error; //distance for positions, radians for normals, absolute for tc and weights
+        float avg_error;
+
+        attribute_report(): type(0),from_type(nms_mesh_chunk::float32),to_type(nms_mesh_chunk::float32),
+                            from_size(0),to_size(0),max_error(0.0f),avg_error(0.0f) {}
+    };
+
+    std::vector<attribute_report> report;
+
+    nya_math::vec3 pos_scale;
+    nya_math::vec3 pos_offset;
+
+public:
+    //to.vertices_data points to the quantizer's own buffer, valid until next quantize call
+    bool quantize(const nms_mesh_chunk &from,nms_mesh_chunk &to,const options &opt=options());
+
+public:
+    static void add_dequant_params(nms_material_chunk &materials,const nya_math::vec3 &pos_scale,const nya_math::vec3 &pos_offset);
+
+public:
+    static const char *dequant_pos_scale_param;
+    static const char *dequant_pos_offset_param;
+
+public:
+    static unsigned short float_to_half(float f);
+    static float half_to_float(unsigned short h);
+
+private:
+    std::vector<char> m_vertices;
+};
+
+}
@@ -3,6 +3,11 @@
 #include "string_convert.h"
 #include <algorithm>
 #include <sstream>
+#include <string.h>
+#include <stdlib.h>
+#include <locale.h>
+#include <math.h>
+#include <stdint.h>
 
 namespace nya_formats
 {
@@ -27,19 +32,189 @@ bool bool_from_string(const std::string &s)
 
 std::string string_from_bool(bool value) { return value? "true" : "false"; }
 
-nya_math::vec4 vec4_from_string(const std::string &s)
+namespace
+{
+
+inline bool is_digit(char c) { return c>='0' && c<='9'; }
+
+const float float_pow10[]={1e0f,1e1f,1e2f,1e3f,1e4f,1e5f,1e6f,1e7f,1e8f,1e9f,1e10f};
+const double double_pow10[]={1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9,1e10,1e11,
+                             1e12,1e13,1e14,1e15,1e16,1e17,1e18,1e19,1e20,1e21,1e22};
+
+//correctly rounded double may still round to the wrong float only if it lands exactly between two floats
+inline bool is_float_midpoint(double d)
+{
+    uint64_t bits;
+    memcpy(&bits,&d,sizeof(bits));
+    return (bits&0x1fffffff)==0x10000000;
+}
+
+//value is 0.digits*10^point_exp, rebuilt with the current locale decimal point for strtof
+float slow_float_from_string(const char *s,size_t size,int point_exp)
+{
+    if(point_exp>39)
+        return HUGE_VALF;
+
+    if(point_exp< -45)
+        return 0.0f;
+
+    char buf[160];
+    size_t count=0;
+    buf[count++]='0';
+    buf[count++]=*localeconv()->decimal_point;
+
+    bool leading=true;
+    for(size_t i=0;i<size && count<128;++i)
+    {
+        const char c=s[i];
+        if(c=='e' || c=='E')
+            break;
+
+        if(!is_digit(c) || (leading && c=='0'))
+            continue;
+
+        leading=false;
+        buf[count++]=c;
+    }
+
+    buf[count++]='e';
+    if(point_exp<0)
+    {
+        buf[count++]='-';
+        point_exp= -point_exp;
+    }
+
+    if(point_exp>=10)
+        buf[count++]='0'+point_exp/10;
+    buf[count++]='0'+point_exp%10;
+    buf[count]=0;
+
+    return strtof(buf,0);
+}
+
+}
+
+size_t float_from_string(const char *s,size_t size,float &out)
+{
+    if(!s)
+        return 0;
+
+    size_t i=0;
+    bool negative=false;
+    if(i<size && (s[i]=='-' || s[i]=='+'))
+        negative=s[i++]=='-';
+
+    const size_t digits_from=i;
+    const int max_digits=19;
+    uint64_t mantissa=0;
+    int digits=0,exp=0;
+    bool has_digits=false,truncated=false;
+
+    for(;i<size && is_digit(s[i]);++i)
+    {
+        has_digits=true;
+        if(digits<max_digits)
+        {
+            if(mantissa || s[i]!='0')
+                mantissa=mantissa*10+(s[i]-'0'),++digits;
+        }
+        else
+        {
+            ++exp;
+            truncated|=s[i]!='0';
+        }
+    }
+
+    if(i<size && s[i]=='.')
+    {
+        for(++i;i<size && is_digit(s[i]);++i)
+        {
+            has_digits=true;
+            if(digits<max_digits)
+            {
+                if(mantissa || s[i]!='0')
+                    mantissa=mantissa*10+(s[i]-'0'),++digits;
+                --exp;
+            }
+            else
+                truncated|=s[i]!='0';
+        }
+    }
+
+    if(!has_digits)
+        return 0;
+
+    const size_t digits_to=i;
+
+    if(i<size && (s[i]=='e' || s[i]=='E'))
+    {
+        size_t j=i+1;
+        bool exp_negative=false;
+        if(j<size && (s[j]=='-' || s[j]=='+'))
+            exp_negative=s[j++]=='-';
+
+        if(j<size && is_digit(s[j]))
+        {
+            int e=0;
+            for(;j<size && is_digit(s[j]);++j)
+            {
+                if(e<100000)
+                    e=e*10+(s[j]-'0');
+            }
+
+            exp+=exp_negative?-e:e;
+            i=j;
+        }
+    }
+
+    float value=0.0f;
+    if(!mantissa)
+        value=0.0f;
+    else if(!truncated && mantissa<=(1<<24) && exp>= -10 && exp<=10)
+        value=exp<0?float(mantissa)/float_pow10[-exp]:float(mantissa)*float_pow10[exp]; //both operands are exact
+    else
+    {
+        bool done=false;
+        if(!truncated && mantissa<(uint64_t(1)<<53) && exp>= -22 && exp<=22)
+        {
+            const double d=exp<0?double(mantissa)/double_pow10[-exp]:double(mantissa)*double_pow10[exp];
+            if(!is_float_midpoint(d))
+                value=float(d),done=true;
+        }
+
+        if(!done)
+            value=slow_float_from_string(s+digits_from,digits_to-digits_from,exp+digits);
+    }
+
+    out=negative?-value:value;
+    return i;
+}
+
+nya_math::vec4 vec4_from_string(const char *s,size_t size)
 {
     nya_math::vec4 v;
-    std::string ss=s;
-    std::replace(ss.begin(),ss.end(),',',' ');
-    std::istringstream iss(ss);
-    if(iss>>v.x)
-        if(iss>>v.y)
-            if(iss>>v.z)
-                iss>>v.w;
+    if(!s)
+        return v;
+
+    float *values[]={&v.x,&v.y,&v.z,&v.w};
+    size_t i=0;
+    for(int j=0;j<4;++j)
+    {
+        while(i<size && (s[i]==',' || s[i]==' ' || s[i]=='\t' || s[i]=='\r' || s[i]=='\n'))
+            ++i;
+
+        const size_t count=float_from_string(s+i,size-i,*values[j]);
+        if(!count)
+            break;
+
+        i+=count;
+    }
+
     return v;
 }
 
+nya_math::vec4 vec4_from_string(const std::string &s) { return vec4_from_string(s.c_str(),s.size()); }
+
 std::string string_from_vec4(const nya_math::vec4 &v,int precision)
 {
     std::ostringstream oss;
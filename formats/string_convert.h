@@ -12,6 +12,11 @@ namespace nya_formats
 bool bool_from_string(const std::string &s);
 std::string string_from_bool(bool value);
 nya_math::vec4 vec4_from_string(const std::string &s);
+nya_math::vec4 vec4_from_string(const char *s,size_t size);
+
+//locale independent, correctly rounded, does not allocate
+//returns count of parsed chars, 0 if there's no number at the start of s
+size_t float_from_string(const char *s,size_t size,float &out);
 bool cull_face_from_string(const std::string &s,nya_render::cull_face::order &order_out);
 nya_render::blend::mode blend_mode_from_string(const std::string &s);
 bool blend_mode_from_string(const std::string &s,nya_render::blend::mode &src_out,nya_render::blend::mode &dst_out);
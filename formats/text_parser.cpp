@@ -1,6 +1,7 @@
 //https://code.google.com/p/nya-engine/
 
 #include "text_parser.h"
+#include "string_convert.h"
 #include "log/log.h"
 #include "memory/invalid_object.h"
 
@@ -67,15 +68,8 @@ nya_math::vec4 text_parser::get_section_value_vector(int idx) const
     if(idx<0 || idx>=(int)m_sections.size())
         return nya_memory::get_invalid_object<nya_math::vec4>();
 
-    nya_math::vec4 v;
-    std::string s=m_sections[idx].value;
-    std::replace(s.begin(),s.end(),',',' ');
-    std::istringstream iss(s);
-    if(iss>>v.x)
-        if(iss>>v.y)
-            if(iss>>v.z)
-                iss>>v.w;
-    return v;
+    const std::string &s=m_sections[idx].value;
+    return vec4_from_string(s.c_str(),s.size());
 }
 
 int text_parser::get_subsections_count(int section_idx) const
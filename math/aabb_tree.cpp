@@ -0,0 +1,523 @@
+//https://code.google.com/p/nya-engine/
+
+#include "aabb_tree.h"
+#include "scalar.h"
+
+namespace nya_math
+{
+
+namespace
+{
+
+const int max_stack_size=128;
+
+inline void merge(const vec3 &a_min,const vec3 &a_max,const vec3 &b_min,const vec3 &b_max,vec3 &min,vec3 &max)
+{
+    min=vec3(nya_math::min(a_min.x,b_min.x),nya_math::min(a_min.y,b_min.y),nya_math::min(a_min.z,b_min.z));
+    max=vec3(nya_math::max(a_max.x,b_max.x),nya_math::max(a_max.y,b_max.y),nya_math::max(a_max.z,b_max.z));
+}
+
+inline float area(const vec3 &min,const vec3 &max)
+{
+    const vec3 d=max-min;
+    return 2.0f*(d.x*d.y+d.y*d.z+d.z*d.x);
+}
+
+inline float merged_area(const vec3 &a_min,const vec3 &a_max,const vec3 &b_min,const vec3 &b_max)
+{
+    vec3 min,max;
+    merge(a_min,a_max,b_min,b_max,min,max);
+    return area(min,max);
+}
+
+inline bool contains(const vec3 &min,const vec3 &max,const vec3 &box_min,const vec3 &box_max)
+{
+    return box_min.x>=min.x && box_min.y>=min.y && box_min.z>=min.z &&
+           box_max.x<=max.x && box_max.y<=max.y && box_max.z<=max.z;
+}
+
+inline float dist_sq(const vec3 &p,const vec3 &min,const vec3 &max)
+{
+    const vec3 d(nya_math::max(nya_math::max(min.x-p.x,p.x-max.x),0.0f),
+                 nya_math::max(nya_math::max(min.y-p.y,p.y-max.y),0.0f),
+                 nya_math::max(nya_math::max(min.z-p.z,p.z-max.z),0.0f));
+    return d.length_sq();
+}
+
+inline bool ray_test(const vec3 &min,const vec3 &max,const vec3 &origin,const vec3 &inv_dir,float max_dist,float &dist)
+{
+    float t1=(min.x-origin.x)*inv_dir.x,t2=(max.x-origin.x)*inv_dir.x;
+    float tmin=nya_math::min(t1,t2),tmax=nya_math::max(t1,t2);
+
+    t1=(min.y-origin.y)*inv_dir.y,t2=(max.y-origin.y)*inv_dir.y;
+    tmin=nya_math::max(tmin,nya_math::min(t1,t2)),tmax=nya_math::min(tmax,nya_math::max(t1,t2));
+
+    t1=(min.z-origin.z)*inv_dir.z,t2=(max.z-origin.z)*inv_dir.z;
+    tmin=nya_math::max(tmin,nya_math::min(t1,t2)),tmax=nya_math::min(tmax,nya_math::max(t1,t2));
+
+    tmin=nya_math::max(tmin,0.0f);
+    if(tmax<tmin || tmin>max_dist)
+        return false;
+
+    dist=tmin;
+    return true;
+}
+
+struct box_test
+{
+    vec3 min,max;
+
+    bool test_bounds(const vec3 &bmin,const vec3 &bmax) const
+    {
+        return min.x<=bmax.x && min.y<=bmax.y && min.z<=bmax.z && max.x>=bmin.x && max.y>=bmin.y && max.z>=bmin.z;
+    }
+
+    bool test_box(const aabb &b) const { return test_bounds(b.origin-b.delta,b.origin+b.delta); }
+
+    box_test(const aabb &b): min(b.origin-b.delta),max(b.origin+b.delta) {}
+};
+
+struct frustum_test
+{
+    const frustum &f;
+
+    bool test_bounds(const vec3 &min,const vec3 &max) const { return f.test_intersect(aabb(min,max)); }
+    bool test_box(const aabb &b) const { return f.test_intersect(b); }
+
+    frustum_test(const frustum &f): f(f) {}
+};
+
+template<typename t,typename tree> bool query_vector(const tree &bvh,const t &test,std::vector<int> &result)
+{
+    result.resize(result.capacity()>16?result.capacity():16);
+    int count=bvh.get_objects(test,&result[0],int(result.size()));
+    if(count>int(result.size()))
+    {
+        result.resize(count);
+        count=bvh.get_objects(test,&result[0],count);
+    }
+
+    result.resize(count);
+    return count>0;
+}
+
+}
+
+int aabb_tree::alloc_node()
+{
+    if(m_free_node>=0)
+    {
+        const int idx=m_free_node;
+        m_free_node=m_nodes[idx].parent;
+        m_nodes[idx]=node();
+        return idx;
+    }
+
+    m_nodes.resize(m_nodes.size()+1);
+    return int(m_nodes.size())-1;
+}
+
+void aabb_tree::free_node(int idx)
+{
+    m_nodes[idx].parent=m_free_node;
+    m_nodes[idx].height= -1;
+    m_free_node=idx;
+}
+
+void aabb_tree::set_leaf_box(int leaf,const aabb &box)
+{
+    const vec3 margin(m_margin,m_margin,m_margin);
+    m_nodes[leaf].min=box.origin-box.delta-margin;
+    m_nodes[leaf].max=box.origin+box.delta+margin;
+}
+
+void aabb_tree::insert_leaf(int leaf)
+{
+    if(m_root<0)
+    {
+        m_root=leaf;
+        m_nodes[leaf].parent= -1;
+        return;
+    }
+
+    const vec3 leaf_min=m_nodes[leaf].min,leaf_max=m_nodes[leaf].max;
+
+    //descend to the sibling with the least surface area increase
+    int idx=m_root;
+    while(!m_nodes[idx].is_leaf())
+    {
+        const node &n=m_nodes[idx];
+        const float node_area=area(n.min,n.max);
+        const float combined_area=merged_area(n.min,n.max,leaf_min,leaf_max);
+        const float cost=2.0f*combined_area;
+        const float inheritance_cost=2.0f*(combined_area-node_area);
+
+        float child_cost[2];
+        for(int i=0;i<2;++i)
+        {
+            const node &c=m_nodes[n.child[i]];
+            child_cost[i]=merged_area(c.min,c.max,leaf_min,leaf_max)+inheritance_cost;
+            if(!c.is_leaf())
+                child_cost[i]-=area(c.min,c.max);
+        }
+
+        if(cost<child_cost[0] && cost<child_cost[1])
+            break;
+
+        idx=child_cost[0]<child_cost[1]?n.child[0]:n.child[1];
+    }
+
+    const int sibling=idx;
+    const int old_parent=m_nodes[sibling].parent;
+    const int new_parent=alloc_node();
+
+    node &p=m_nodes[new_parent];
+    p.parent=old_parent;
+    merge(leaf_min,leaf_max,m_nodes[sibling].min,m_nodes[sibling].max,p.min,p.max);
+    p.height=m_nodes[sibling].height+1;
+    p.child[0]=sibling;
+    p.child[1]=leaf;
+    m_nodes[sibling].parent=new_parent;
+    m_nodes[leaf].parent=new_parent;
+
+    if(old_parent>=0)
+    {
+        node &op=m_nodes[old_parent];
+        op.child[op.child[0]==sibling?0:1]=new_parent;
+    }
+    else
+        m_root=new_parent;
+
+    update_parents(old_parent);
+}
+
+void aabb_tree::remove_leaf(int leaf)
+{
+    if(leaf==m_root)
+    {
+        m_root= -1;
+        return;
+    }
+
+    const int parent=m_nodes[leaf].parent;
+    const int grand_parent=m_nodes[parent].parent;
+    const int sibling=m_nodes[parent].child[m_nodes[parent].child[0]==leaf?1:0];
+
+    m_nodes[sibling].parent=grand_parent;
+    free_node(parent);
+
+    if(grand_parent>=0)
+    {
+        node &gp=m_nodes[grand_parent];
+        gp.child[gp.child[0]==parent?0:1]=sibling;
+        update_parents(grand_parent);
+    }
+    else
+        m_root=sibling;
+
+    m_nodes[leaf].parent= -1;
+}
+
+void aabb_tree::update_parents(int idx)
+{
+    while(idx>=0)
+    {
+        idx=balance(idx);
+
+        node &n=m_nodes[idx];
+        const node &c0=m_nodes[n.child[0]];
+        const node &c1=m_nodes[n.child[1]];
+        n.height=1+(c0.height>c1.height?c0.height:c1.height);
+        merge(c0.min,c0.max,c1.min,c1.max,n.min,n.max);
+
+        idx=n.parent;
+    }
+}
+
+//rotates the higher child up if the subtree is unbalanced, returns new subtree root
+int aabb_tree::balance(int ia)
+{
+    node &a=m_nodes[ia];
+    if(a.is_leaf() || a.height<2)
+        return ia;
+
+    const int ib=a.child[0],ic=a.child[1];
+    node &b=m_nodes[ib];
+    node &c=m_nodes[ic];
+    const int diff=c.height-b.height;
+    if(diff>=-1 && diff<=1)
+        return ia;
+
+    //up is the higher child, stays is the other one
+    const bool rotate_c=diff>1;
+    const int iup=rotate_c?ic:ib;
+    const int istay=rotate_c?ib:ic;
+    const int up_side=rotate_c?1:0;
+    node &up=m_nodes[iup];
+    const node &stay=m_nodes[istay];
+
+    const int if_=up.child[0],ig=up.child[1];
+    const node &f=m_nodes[if_];
+    const node &g=m_nodes[ig];
+
+    up.child[0]=ia;
+    up.parent=a.parent;
+    a.parent=iup;
+
+    if(up.parent>=0)
+    {
+        node &p=m_nodes[up.parent];
+        p.child[p.child[0]==ia?0:1]=iup;
+    }
+    else
+        m_root=iup;
+
+    //the higher grandchild stays with up, the other one moves to a
+    const int ikeep=f.height>g.height?if_:ig;
+    const int imove=f.height>g.height?ig:if_;
+    up.child[1]=ikeep;
+    a.child[up_side]=imove;
+    m_nodes[imove].parent=ia;
+
+    const node &keep=m_nodes[ikeep];
+    const node &move=m_nodes[imove];
+    merge(stay.min,stay.max,move.min,move.max,a.min,a.max);
+    a.height=1+(stay.height>move.height?stay.height:move.height);
+    merge(a.min,a.max,keep.min,keep.max,up.min,up.max);
+    up.height=1+(a.height>keep.height?a.height:keep.height);
+
+    return iup;
+}
+
+void aabb_tree::add_object(const aabb &box,int idx)
+{
+    if(idx<0)
+        return;
+
+    if(idx>=(int)m_objects.size())
+        m_objects.resize(idx+1);
+
+    object &o=m_objects[idx];
+    if(o.leaf>=0)
+    {
+        move_object(box,idx);
+        return;
+    }
+
+    o.box=box;
+    o.leaf=alloc_node();
+    m_nodes[o.leaf].obj=idx;
+    set_leaf_box(o.leaf,box);
+    insert_leaf(o.leaf);
+    ++m_objects_count;
+}
+
+void aabb_tree::move_object(const aabb &box,int idx)
+{
+    if(idx<0 || idx>=(int)m_objects.size() || m_objects[idx].leaf<0)
+    {
+        add_object(box,idx);
+        return;
+    }
+
+    object &o=m_objects[idx];
+    o.box=box;
+
+    const node &leaf=m_nodes[o.leaf];
+    if(contains(leaf.min,leaf.max,box.origin-box.delta,box.origin+box.delta))
+        return;
+
+    remove_leaf(o.leaf);
+    set_leaf_box(o.leaf,box);
+    insert_leaf(o.leaf);
+}
+
+void aabb_tree::remove_object(int idx)
+{
+    if(idx<0 || idx>=(int)m_objects.size() || m_objects[idx].leaf<0)
+        return;
+
+    object &o=m_objects[idx];
+    remove_leaf(o.leaf);
+    free_node(o.leaf);
+    o.leaf= -1;
+    --m_objects_count;
+}
+
+void aabb_tree::set_object_aabb(const aabb &box,int idx)
+{
+    if(idx<0 || idx>=(int)m_objects.size() || m_objects[idx].leaf<0)
+    {
+        add_object(box,idx);
+        return;
+    }
+
+    m_objects[idx].box=box;
+    set_leaf_box(m_objects[idx].leaf,box);
+}
+
+void aabb_tree::refit(int idx)
+{
+    node &n=m_nodes[idx];
+    if(n.is_leaf())
+        return;
+
+    refit(n.child[0]);
+    refit(n.child[1]);
+
+    const node &c0=m_nodes[n.child[0]];
+    const node &c1=m_nodes[n.child[1]];
+    merge(c0.min,c0.max,c1.min,c1.max,n.min,n.max);
+}
+
+void aabb_tree::refit()
+{
+    if(m_root>=0)
+        refit(m_root);
+}
+
+template<typename t> int aabb_tree::query(const t &test,int *result,int max_count) const
+{
+    if(m_root<0)
+        return 0;
+
+    int count=0;
+    int stack[max_stack_size];
+    int stack_size=0;
+    stack[stack_size++]=m_root;
+
+    while(stack_size>0)
+    {
+        const node &n=m_nodes[stack[--stack_size]];
+        if(!test.test_bounds(n.min,n.max))
+            continue;
+
+        if(n.is_leaf())
+        {
+            if(!test.test_box(m_objects[n.obj].box))
+                continue;
+
+            if(count<max_count)
+                result[count]=n.obj;
+            ++count;
+            continue;
+        }
+
+        if(stack_size+2>max_stack_size)
+            continue;
+
+        stack[stack_size++]=n.child[0];
+        stack[stack_size++]=n.child[1];
+    }
+
+    return count;
+}
+
+int aabb_tree::get_objects(const aabb &box,int *result,int max_count) const { return query(box_test(box),result,result?max_count:0); }
+int aabb_tree::get_objects(const frustum &f,int *result,int max_count) const { return query(frustum_test(f),result,result?max_count:0); }
+bool aabb_tree::get_objects(const aabb &box,std::vector<int> &result) const { return query_vector(*this,box,result); }
+bool aabb_tree::get_objects(const frustum &f,std::vector<int> &result) const { return query_vector(*this,f,result); }
+
+int aabb_tree::raycast(const vec3 &origin,const vec3 &dir,float max_dist,float *hit_dist) const
+{
+    if(m_root<0)
+        return -1;
+
+    const vec3 inv_dir(1.0f/dir.x,1.0f/dir.y,1.0f/dir.z);
+    int hit= -1;
+    float best=max_dist;
+
+    int stack[max_stack_size];
+    int stack_size=0;
+    stack[stack_size++]=m_root;
+
+    while(stack_size>0)
+    {
+        const node &n=m_nodes[stack[--stack_size]];
+        float dist;
+        if(!ray_test(n.min,n.max,origin,inv_dir,best,dist))
+            continue;
+
+        if(n.is_leaf())
+        {
+            const aabb &b=m_objects[n.obj].box;
+            if(!ray_test(b.origin-b.delta,b.origin+b.delta,origin,inv_dir,best,dist))
+                continue;
+
+            best=dist;
+            hit=n.obj;
+            continue;
+        }
+
+        if(stack_size+2>max_stack_size)
+            continue;
+
+        stack[stack_size++]=n.child[0];
+        stack[stack_size++]=n.child[1];
+    }
+
+    if(hit>=0 && hit_dist)
+        *hit_dist=best;
+
+    return hit;
+}
+
+int aabb_tree::get_nearest(const vec3 &p,float max_dist,float *dist) const
+{
+    if(m_root<0)
+        return -1;
+
+    int nearest= -1;
+    float best_sq=max_dist*max_dist;
+
+    int stack[max_stack_size];
+    int stack_size=0;
+    stack[stack_size++]=m_root;
+
+    while(stack_size>0)
+    {
+        const node &n=m_nodes[stack[--stack_size]];
+        if(dist_sq(p,n.min,n.max)>best_sq)
+            continue;
+
+        if(n.is_leaf())
+        {
+            const aabb &b=m_objects[n.obj].box;
+            const float d=dist_sq(p,b.origin-b.delta,b.origin+b.delta);
+            if(d>best_sq || (d==best_sq && nearest>=0))
+                continue;
+
+            best_sq=d;
+            nearest=n.obj;
+            continue;
+        }
+
+        if(stack_size+2>max_stack_size)
+            continue;
+
+        //closer child is visited first
+        const node &c0=m_nodes[n.child[0]];
+        const node &c1=m_nodes[n.child[1]];
+        const bool first=dist_sq(p,c0.min,c0.max)<=dist_sq(p,c1.min,c1.max);
+        stack[stack_size++]=n.child[first?1:0];
+        stack[stack_size++]=n.child[first?0:1];
+    }
+
+    if(nearest>=0 && dist)
+        *dist=sqrtf(best_sq);
+
+    return nearest;
+}
+
+const aabb &aabb_tree::get_object_aabb(int idx) const
+{
+    if(idx<0 || idx>=(int)m_objects.size() || m_objects[idx].leaf<0)
+    {
+        const static aabb invalid;
+        return invalid;
+    }
+
+    return m_objects[idx].box;
+}
+
+}
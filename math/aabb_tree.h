@@ -0,0 +1,88 @@
+//https://code.google.com/p/nya-engine/
+
+#pragma once
+
+//dynamic bounding volume hierarchy for moving objects
+//leaves store boxes enlarged by margin, so small moves don't change the tree
+//objects are referenced by non-negative indices, preferably dense ones: they are used as array indices
+
+#include "frustum.h"
+#include <vector>
+
+namespace nya_math
+{
+
+class aabb_tree
+{
+public:
+    void add_object(const aabb &box,int idx);
+    void move_object(const aabb &box,int idx); //reinserts only if box leaves the enlarged leaf box
+    void remove_object(int idx);
+
+    //for many moving objects: set boxes without restructuring, then refit the tree once before queries
+    void set_object_aabb(const aabb &box,int idx);
+    void refit();
+
+public:
+    //allocation-free versions return count of found objects, only first max_count of them are written to result
+    int get_objects(const aabb &box,int *result,int max_count) const;
+    int get_objects(const frustum &f,int *result,int max_count) const;
+    bool get_objects(const aabb &box,std::vector<int> &result) const;
+    bool get_objects(const frustum &f,std::vector<int> &result) const;
+
+    //closest object which box is hit by ray, -1 if none
+    int raycast(const vec3 &origin,const vec3 &dir,float max_dist,float *hit_dist=0) const;
+    //object with the closest box to point, -1 if none within max_dist
+    int get_nearest(const vec3 &p,float max_dist,float *dist=0) const;
+
+public:
+    const aabb &get_object_aabb(int idx) const;
+    int get_objects_count() const { return m_objects_count; }
+    int get_height() const { return m_root<0?0:m_nodes[m_root].height; }
+
+public:
+    aabb_tree(float margin=0.1f): m_margin(margin),m_root(-1),m_free_node(-1),m_objects_count(0) {}
+
+private:
+    struct node
+    {
+        vec3 min,max;
+        int parent;
+        int child[2];
+        int obj; //-1 for internal nodes
+        int height;
+
+        bool is_leaf() const { return child[0]<0; }
+
+        node(): parent(-1),obj(-1),height(0) { child[0]=child[1]= -1; }
+    };
+
+    struct object
+    {
+        aabb box;
+        int leaf;
+
+        object(): leaf(-1) {}
+    };
+
+private:
+    int alloc_node();
+    void free_node(int idx);
+    void insert_leaf(int leaf);
+    void remove_leaf(int leaf);
+    int balance(int idx);
+    void update_parents(int idx);
+    void refit(int idx);
+    void set_leaf_box(int leaf,const aabb &box);
+    template<typename t> int query(const t &test,int *result,int max_count) const;
+
+private:
+    float m_margin;
+    std::vector<node> m_nodes;
+    std::vector<object> m_objects;
+    int m_root;
+    int m_free_node;
+    int m_objects_count;
+};
+
+}
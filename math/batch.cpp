@@ -0,0 +1,699 @@
+//https://code.google.com/p/nya-engine/
+
+#include "batch.h"
+#include "matrix.h"
+#include "quaternion.h"
+#include "vector.h"
+
+#if defined __SSE__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP>=1)
+    #define NYA_MATH_SSE
+    #include <xmmintrin.h>
+#endif
+
+#if defined NYA_MATH_SSE && defined __AVX__
+    #define NYA_MATH_AVX
+    #include <immintrin.h>
+#endif
+
+namespace nya_math
+{
+
+namespace
+{
+
+inline vec3 transform_normal(const mat4 &m,const vec3 &v)
+{
+    return vec3(m[0][0]*v.x+m[1][0]*v.y+m[2][0]*v.z,
+                m[0][1]*v.x+m[1][1]*v.y+m[2][1]*v.z,
+                m[0][2]*v.x+m[1][2]*v.y+m[2][2]*v.z);
+}
+
+//unused bones get idx 0 and zero weight, bones_count should be positive
+inline void skin_weights(const vec4 &bone_idx,const vec4 &bone_weight,int bones_count,int *b,float *w)
+{
+    const float *idx=&bone_idx.x,*weight=&bone_weight.x;
+    for(int j=0;j<4;++j)
+    {
+        b[j]=int(idx[j]+0.5f);
+        w[j]=weight[j];
+        if(!(w[j]>0.0f) || b[j]<0 || b[j]>=bones_count)
+            b[j]=0,w[j]=0.0f;
+    }
+}
+
+inline vec3 skin_scalar(const float *matrices,const vec3 &v,const int *b,const float *w)
+{
+    float r[12];
+    for(int k=0;k<12;++k)
+        r[k]=matrices[b[0]*12+k]*w[0];
+    for(int j=1;j<4;++j)
+    {
+        for(int k=0;k<12;++k)
+            r[k]+=matrices[b[j]*12+k]*w[j];
+    }
+
+    return vec3(r[0]*v.x+r[1]*v.y+r[2]*v.z+r[3],
+                r[4]*v.x+r[5]*v.y+r[6]*v.z+r[7],
+                r[8]*v.x+r[9]*v.y+r[10]*v.z+r[11]);
+}
+
+//flips weights of bones in the other hemisphere than the first used one
+inline void skin_dq_signs(const float *dual_quats,const int *b,float *w)
+{
+    int first=0;
+    while(first<3 && w[first]==0.0f)
+        ++first;
+
+    const float *q0=dual_quats+b[first]*8;
+    for(int j=0;j<4;++j)
+    {
+        const float *q=dual_quats+b[j]*8;
+        if((q0[0]*q[0]+q0[2]*q[2])+(q0[1]*q[1]+q0[3]*q[3])<0.0f)
+            w[j]= -w[j];
+    }
+}
+
+inline vec3 skin_dq_scalar(const float *dual_quats,const vec3 &v,const int *b,const float *w)
+{
+    float r[8];
+    for(int k=0;k<8;++k)
+        r[k]=dual_quats[b[0]*8+k]*w[0];
+    for(int j=1;j<4;++j)
+    {
+        for(int k=0;k<8;++k)
+            r[k]+=dual_quats[b[j]*8+k]*w[j];
+    }
+
+    const float len_sq=r[0]*r[0]+r[1]*r[1]+r[2]*r[2]+r[3]*r[3];
+    if(!(len_sq>0.00001f*0.00001f))
+        return vec3();
+
+    const float len_inv=1.0f/sqrtf(len_sq),len_sq_inv=1.0f/len_sq;
+    const vec3 rv(r[0],r[1],r[2]),dv(r[4],r[5],r[6]);
+    const vec3 t=(dv*r[3]-rv*r[7]+rv.cross(dv))*(2.0f*len_sq_inv);
+    return quat(r[0]*len_inv,r[1]*len_inv,r[2]*len_inv,r[3]*len_inv).rotate(v)+t;
+}
+
+void transform_soa_scalar(const mat4 &m,bool translate,const float *x,const float *y,const float *z,
+                          float *to_x,float *to_y,float *to_z,int from,int count)
+{
+    for(int i=from;i<count;++i)
+    {
+        vec3 r=transform_normal(m,vec3(x[i],y[i],z[i]));
+        if(translate)
+            r+=vec3(m[3][0],m[3][1],m[3][2]);
+        to_x[i]=r.x,to_y[i]=r.y,to_z[i]=r.z;
+    }
+}
+
+#ifdef NYA_MATH_SSE
+
+struct vec3_x4 { __m128 x,y,z; };
+struct quat_x4 { __m128 x,y,z,w; };
+
+inline vec3_x4 load(const vec3 *v)
+{
+    const float *f=&v->x;
+    const __m128 a=_mm_loadu_ps(f),b=_mm_loadu_ps(f+4),c=_mm_loadu_ps(f+8);
+    const __m128 t0=_mm_shuffle_ps(b,c,_MM_SHUFFLE(1,1,2,2));
+    const __m128 t1=_mm_shuffle_ps(a,b,_MM_SHUFFLE(0,0,1,1));
+    const __m128 t2=_mm_shuffle_ps(b,c,_MM_SHUFFLE(2,2,3,3));
+    const __m128 t3=_mm_shuffle_ps(a,b,_MM_SHUFFLE(1,1,2,2));
+    const __m128 t4=_mm_shuffle_ps(c,c,_MM_SHUFFLE(3,3,0,0));
+
+    vec3_x4 r;
+    r.x=_mm_shuffle_ps(a,t0,_MM_SHUFFLE(2,0,3,0));
+    r.y=_mm_shuffle_ps(t1,t2,_MM_SHUFFLE(2,0,2,0));
+    r.z=_mm_shuffle_ps(t3,t4,_MM_SHUFFLE(2,0,2,0));
+    return r;
+}
+
+inline void store(vec3 *v,const vec3_x4 &r)
+{
+    const __m128 xy_lo=_mm_unpacklo_ps(r.x,r.y);
+    const __m128 xy_hi=_mm_unpackhi_ps(r.x,r.y);
+    const __m128 t0=_mm_shuffle_ps(r.z,r.x,_MM_SHUFFLE(1,1,0,0));
+    const __m128 t1=_mm_shuffle_ps(r.y,r.z,_MM_SHUFFLE(1,1,1,1));
+    const __m128 t2=_mm_shuffle_ps(r.z,xy_hi,_MM_SHUFFLE(3,2,2,2));
+    const __m128 t3=_mm_shuffle_ps(xy_hi,r.z,_MM_SHUFFLE(3,3,3,3));
+
+    float *f=&v->x;
+    _mm_storeu_ps(f,_mm_shuffle_ps(xy_lo,t0,_MM_SHUFFLE(2,0,1,0)));
+    _mm_storeu_ps(f+4,_mm_shuffle_ps(t1,xy_hi,_MM_SHUFFLE(1,0,2,0)));
+    _mm_storeu_ps(f+8,_mm_shuffle_ps(t2,t3,_MM_SHUFFLE(2,0,2,0)));
+}
+
+inline quat_x4 load(const quat *q)
+{
+    const float *f=&q->v.x;
+    quat_x4 r;
+    r.x=_mm_loadu_ps(f),r.y=_mm_loadu_ps(f+4),r.z=_mm_loadu_ps(f+8),r.w=_mm_loadu_ps(f+12);
+    _MM_TRANSPOSE4_PS(r.x,r.y,r.z,r.w);
+    return r;
+}
+
+inline void store(quat *q,quat_x4 r)
+{
+    _MM_TRANSPOSE4_PS(r.x,r.y,r.z,r.w);
+    float *f=&q->v.x;
+    _mm_storeu_ps(f,r.x),_mm_storeu_ps(f+4,r.y),_mm_storeu_ps(f+8,r.z),_mm_storeu_ps(f+12,r.w);
+}
+
+inline quat_x4 set1(const quat &q)
+{
+    quat_x4 r;
+    r.x=_mm_set1_ps(q.v.x),r.y=_mm_set1_ps(q.v.y),r.z=_mm_set1_ps(q.v.z),r.w=_mm_set1_ps(q.w);
+    return r;
+}
+
+inline vec3_x4 cross(__m128 ax,__m128 ay,__m128 az,const vec3_x4 &b)
+{
+    vec3_x4 r;
+    r.x=_mm_sub_ps(_mm_mul_ps(ay,b.z),_mm_mul_ps(az,b.y));
+    r.y=_mm_sub_ps(_mm_mul_ps(az,b.x),_mm_mul_ps(ax,b.z));
+    r.z=_mm_sub_ps(_mm_mul_ps(ax,b.y),_mm_mul_ps(ay,b.x));
+    return r;
+}
+
+//same as quat::rotate
+inline vec3_x4 rotate(const quat_x4 &q,const vec3_x4 &v)
+{
+    vec3_x4 t=cross(q.x,q.y,q.z,v);
+    t.x=_mm_add_ps(t.x,_mm_mul_ps(v.x,q.w));
+    t.y=_mm_add_ps(t.y,_mm_mul_ps(v.y,q.w));
+    t.z=_mm_add_ps(t.z,_mm_mul_ps(v.z,q.w));
+
+    const vec3_x4 c=cross(q.x,q.y,q.z,t);
+    const __m128 two=_mm_set1_ps(2.0f);
+    vec3_x4 r;
+    r.x=_mm_add_ps(v.x,_mm_mul_ps(c.x,two));
+    r.y=_mm_add_ps(v.y,_mm_mul_ps(c.y,two));
+    r.z=_mm_add_ps(v.z,_mm_mul_ps(c.z,two));
+    return r;
+}
+
+//same as quat::operator *
+inline quat_x4 mul(const quat_x4 &a,const quat_x4 &b)
+{
+    quat_x4 r;
+    r.x=_mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(a.w,b.x),_mm_mul_ps(a.x,b.w)),_mm_mul_ps(a.y,b.z)),_mm_mul_ps(a.z,b.y));
+    r.y=_mm_add_ps(_mm_add_ps(_mm_sub_ps(_mm_mul_ps(a.w,b.y),_mm_mul_ps(a.x,b.z)),_mm_mul_ps(a.y,b.w)),_mm_mul_ps(a.z,b.x));
+    r.z=_mm_add_ps(_mm_sub_ps(_mm_add_ps(_mm_mul_ps(a.w,b.z),_mm_mul_ps(a.x,b.y)),_mm_mul_ps(a.y,b.x)),_mm_mul_ps(a.z,b.w));
+    r.w=_mm_sub_ps(_mm_sub_ps(_mm_sub_ps(_mm_mul_ps(a.w,b.w),_mm_mul_ps(a.x,b.x)),_mm_mul_ps(a.y,b.y)),_mm_mul_ps(a.z,b.z));
+    return r;
+}
+
+//same as quat::normalize
+inline void normalize(quat_x4 &r)
+{
+    const __m128 len_sq=_mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(r.x,r.x),_mm_mul_ps(r.y,r.y)),
+                                              _mm_mul_ps(r.z,r.z)),_mm_mul_ps(r.w,r.w));
+    const __m128 len=_mm_sqrt_ps(len_sq);
+    const __m128 mask=_mm_cmpgt_ps(len,_mm_set1_ps(0.00001f));
+    const __m128 one=_mm_set1_ps(1.0f);
+    const __m128 len_inv=_mm_or_ps(_mm_and_ps(mask,_mm_div_ps(one,len)),_mm_andnot_ps(mask,one));
+    r.x=_mm_mul_ps(r.x,len_inv),r.y=_mm_mul_ps(r.y,len_inv);
+    r.z=_mm_mul_ps(r.z,len_inv),r.w=_mm_mul_ps(r.w,len_inv);
+}
+
+inline vec3_x4 gather(const vec3 *v,const int *idx)
+{
+    const vec3 &v0=v[idx[0]],&v1=v[idx[1]],&v2=v[idx[2]],&v3=v[idx[3]];
+    vec3_x4 r;
+    r.x=_mm_setr_ps(v0.x,v1.x,v2.x,v3.x);
+    r.y=_mm_setr_ps(v0.y,v1.y,v2.y,v3.y);
+    r.z=_mm_setr_ps(v0.z,v1.z,v2.z,v3.z);
+    return r;
+}
+
+inline void scatter(vec3 *v,const int *idx,const vec3_x4 &r)
+{
+    vec3 tmp[4];
+    store(tmp,r);
+    for(int i=0;i<4;++i)
+        v[idx[i]]=tmp[i];
+}
+
+inline quat_x4 gather(const quat *q,const int *idx)
+{
+    quat_x4 r;
+    r.x=_mm_loadu_ps(&q[idx[0]].v.x),r.y=_mm_loadu_ps(&q[idx[1]].v.x);
+    r.z=_mm_loadu_ps(&q[idx[2]].v.x),r.w=_mm_loadu_ps(&q[idx[3]].v.x);
+    _MM_TRANSPOSE4_PS(r.x,r.y,r.z,r.w);
+    return r;
+}
+
+inline void scatter(quat *q,const int *idx,quat_x4 r)
+{
+    _MM_TRANSPOSE4_PS(r.x,r.y,r.z,r.w);
+    _mm_storeu_ps(&q[idx[0]].v.x,r.x),_mm_storeu_ps(&q[idx[1]].v.x,r.y);
+    _mm_storeu_ps(&q[idx[2]].v.x,r.z),_mm_storeu_ps(&q[idx[3]].v.x,r.w);
+}
+
+inline __m128 transform_row(const mat4 &m,bool translate,__m128 x,__m128 y,__m128 z,int j)
+{
+    const __m128 r=_mm_add_ps(_mm_add_ps(_mm_mul_ps(x,_mm_set1_ps(m[0][j])),
+                                         _mm_mul_ps(y,_mm_set1_ps(m[1][j]))),
+                                         _mm_mul_ps(z,_mm_set1_ps(m[2][j])));
+    return translate?_mm_add_ps(r,_mm_set1_ps(m[3][j])):r;
+}
+
+inline vec3_x4 transform(const mat4 &m,bool translate,const vec3_x4 &v)
+{
+    vec3_x4 r;
+    r.x=transform_row(m,translate,v.x,v.y,v.z,0);
+    r.y=transform_row(m,translate,v.x,v.y,v.z,1);
+    r.z=transform_row(m,translate,v.x,v.y,v.z,2);
+    return r;
+}
+
+inline void multiply(const mat4 &a,const mat4 &b,mat4 &to)
+{
+    const __m128 b0=_mm_loadu_ps(b[0]),b1=_mm_loadu_ps(b[1]),b2=_mm_loadu_ps(b[2]),b3=_mm_loadu_ps(b[3]);
+    __m128 r[4];
+    for(int i=0;i<4;++i)
+    {
+        r[i]=_mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[i][0]),b0),
+                                              _mm_mul_ps(_mm_set1_ps(a[i][1]),b1)),
+                                              _mm_mul_ps(_mm_set1_ps(a[i][2]),b2)),
+                                              _mm_mul_ps(_mm_set1_ps(a[i][3]),b3));
+    }
+
+    for(int i=0;i<4;++i)
+        _mm_storeu_ps(to[i],r[i]);
+}
+
+#endif
+
+void transform_aos(const mat4 &m,bool translate,const vec3 *from,vec3 *to,int count)
+{
+    int i=0;
+#ifdef NYA_MATH_SSE
+    for(;i+4<=count;i+=4)
+        store(to+i,transform(m,translate,load(from+i)));
+#endif
+    for(;i<count;++i)
+        to[i]=translate?m*from[i]:transform_normal(m,from[i]);
+}
+
+void transform_soa(const mat4 &m,bool translate,const float *x,const float *y,const float *z,
+                   float *to_x,float *to_y,float *to_z,int count)
+{
+    int i=0;
+#ifdef NYA_MATH_AVX
+    for(;i+8<=count;i+=8)
+    {
+        const __m256 vx=_mm256_loadu_ps(x+i),vy=_mm256_loadu_ps(y+i),vz=_mm256_loadu_ps(z+i);
+        __m256 r[3];
+        for(int j=0;j<3;++j)
+        {
+            r[j]=_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx,_mm256_set1_ps(m[0][j])),
+                                             _mm256_mul_ps(vy,_mm256_set1_ps(m[1][j]))),
+                                             _mm256_mul_ps(vz,_mm256_set1_ps(m[2][j])));
+            if(translate)
+                r[j]=_mm256_add_ps(r[j],_mm256_set1_ps(m[3][j]));
+        }
+
+        _mm256_storeu_ps(to_x+i,r[0]),_mm256_storeu_ps(to_y+i,r[1]),_mm256_storeu_ps(to_z+i,r[2]);
+    }
+#endif
+#ifdef NYA_MATH_SSE
+    for(;i+4<=count;i+=4)
+    {
+        vec3_x4 v;
+        v.x=_mm_loadu_ps(x+i),v.y=_mm_loadu_ps(y+i),v.z=_mm_loadu_ps(z+i);
+        const vec3_x4 r=transform(m,translate,v);
+        _mm_storeu_ps(to_x+i,r.x),_mm_storeu_ps(to_y+i,r.y),_mm_storeu_ps(to_z+i,r.z);
+    }
+#endif
+    transform_soa_scalar(m,translate,x,y,z,to_x,to_y,to_z,i,count);
+}
+
+}
+
+void transform_points(const mat4 &m,const vec3 *from,vec3 *to,int count)
+{
+    if(from && to)
+        transform_aos(m,true,from,to,count);
+}
+
+void transform_points(const mat4 &m,const float *x,const float *y,const float *z,
+                      float *to_x,float *to_y,float *to_z,int count)
+{
+    if(x && y && z && to_x && to_y && to_z)
+        transform_soa(m,true,x,y,z,to_x,to_y,to_z,count);
+}
+
+void transform_normals(const mat4 &m,const vec3 *from,vec3 *to,int count)
+{
+    if(from && to)
+        transform_aos(m,false,from,to,count);
+}
+
+void transform_normals(const mat4 &m,const float *x,const float *y,const float *z,
+                       float *to_x,float *to_y,float *to_z,int count)
+{
+    if(x && y && z && to_x && to_y && to_z)
+        transform_soa(m,false,x,y,z,to_x,to_y,to_z,count);
+}
+
+void multiply(const mat4 *a,const mat4 *b,mat4 *to,int count)
+{
+    if(!a || !b || !to)
+        return;
+
+    for(int i=0;i<count;++i)
+    {
+#ifdef NYA_MATH_SSE
+        multiply(a[i],b[i],to[i]);
+#else
+        to[i]=a[i]*b[i];
+#endif
+    }
+}
+
+void multiply(const mat4 &a,const mat4 *b,mat4 *to,int count)
+{
+    if(!b || !to)
+        return;
+
+    const mat4 m=a; //a may be one of to
+    for(int i=0;i<count;++i)
+    {
+#ifdef NYA_MATH_SSE
+        multiply(m,b[i],to[i]);
+#else
+        to[i]=m*b[i];
+#endif
+    }
+}
+
+void rotate(const quat *q,const vec3 *v,vec3 *to,int count)
+{
+    if(!q || !v || !to)
+        return;
+
+    int i=0;
+#ifdef NYA_MATH_SSE
+    for(;i+4<=count;i+=4)
+        store(to+i,rotate(load(q+i),load(v+i)));
+#endif
+    for(;i<count;++i)
+        to[i]=q[i].rotate(v[i]);
+}
+
+void rotate(const quat &q,const vec3 *v,vec3 *to,int count)
+{
+    if(!v || !to)
+        return;
+
+    const quat r=q;
+    int i=0;
+#ifdef NYA_MATH_SSE
+    const quat_x4 q4=set1(r);
+    for(;i+4<=count;i+=4)
+        store(to+i,rotate(q4,load(v+i)));
+#endif
+    for(;i<count;++i)
+        to[i]=r.rotate(v[i]);
+}
+
+void normalize(quat *q,int count)
+{
+    if(!q)
+        return;
+
+    int i=0;
+#ifdef NYA_MATH_SSE
+    for(;i+4<=count;i+=4)
+    {
+        quat_x4 r=load(q+i);
+        normalize(r);
+        store(q+i,r);
+    }
+#endif
+    for(;i<count;++i)
+        q[i].normalize();
+}
+
+void compose(const vec3 *parent_pos,const quat *parent_rot,const vec3 *pos,const quat *rot,
+             vec3 *to_pos,quat *to_rot,int count)
+{
+    if(!parent_pos || !parent_rot || !pos || !rot || !to_pos || !to_rot)
+        return;
+
+    int i=0;
+#ifdef NYA_MATH_SSE
+    for(;i+4<=count;i+=4)
+    {
+        const quat_x4 pr=load(parent_rot+i);
+        const vec3_x4 pp=load(parent_pos+i);
+        vec3_x4 p=rotate(pr,load(pos+i));
+        p.x=_mm_add_ps(pp.x,p.x),p.y=_mm_add_ps(pp.y,p.y),p.z=_mm_add_ps(pp.z,p.z);
+        const quat_x4 r=mul(pr,load(rot+i));
+        store(to_pos+i,p);
+        store(to_rot+i,r);
+    }
+#endif
+    for(;i<count;++i)
+    {
+        const quat pr=parent_rot[i];
+        to_pos[i]=parent_pos[i]+pr.rotate(pos[i]);
+        to_rot[i]=pr*rot[i];
+    }
+}
+
+void slerp_n(const quat *a,const quat *b,const float *t,quat *result,int count,bool fast)
+{
+    if(!a || !b || !t || !result)
+        return;
+
+    if(!fast)
+    {
+        for(int i=0;i<count;++i)
+            result[i]=quat::slerp(a[i],b[i],t[i]);
+        return;
+    }
+
+    int i=0;
+#ifdef NYA_MATH_SSE
+    const __m128 half=_mm_set1_ps(0.5f),one=_mm_set1_ps(1.0f),zero=_mm_setzero_ps();
+    for(;i+4<=count;i+=4)
+    {
+        //same operations as quat::slerp_fast
+        const quat_x4 qa=load(a+i),qb=load(b+i);
+        const __m128 cosom=_mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(qa.x,qb.x),_mm_mul_ps(qa.y,qb.y)),
+                                                 _mm_mul_ps(qa.z,qb.z)),_mm_mul_ps(qa.w,qb.w));
+        const __m128 d=_mm_max_ps(cosom,_mm_sub_ps(zero,cosom));
+
+        __m128 ka=_mm_sub_ps(_mm_set1_ps(3.55645f),_mm_mul_ps(d,_mm_set1_ps(1.43519f)));
+        ka=_mm_add_ps(_mm_set1_ps(-3.2452f),_mm_mul_ps(d,ka));
+        ka=_mm_add_ps(_mm_set1_ps(1.0904f),_mm_mul_ps(d,ka));
+        __m128 kb=_mm_add_ps(_mm_set1_ps(-1.06021f),_mm_mul_ps(d,_mm_set1_ps(0.215638f)));
+        kb=_mm_add_ps(_mm_set1_ps(0.848013f),_mm_mul_ps(d,kb));
+
+        const __m128 vt=_mm_loadu_ps(t+i);
+        const __m128 th=_mm_sub_ps(vt,half);
+        const __m128 k=_mm_add_ps(_mm_mul_ps(_mm_mul_ps(ka,th),th),kb);
+        const __m128 t1=_mm_add_ps(vt,_mm_mul_ps(_mm_mul_ps(_mm_mul_ps(vt,th),_mm_sub_ps(vt,one)),k));
+        const __m128 t0=_mm_sub_ps(one,t1);
+        const __m128 neg=_mm_cmplt_ps(cosom,zero);
+        const __m128 s1=_mm_xor_ps(t1,_mm_and_ps(neg,_mm_set1_ps(-0.0f)));
+
+        quat_x4 r;
+        r.x=_mm_add_ps(_mm_mul_ps(t0,qa.x),_mm_mul_ps(s1,qb.x));
+        r.y=_mm_add_ps(_mm_mul_ps(t0,qa.y),_mm_mul_ps(s1,qb.y));
+        r.z=_mm_add_ps(_mm_mul_ps(t0,qa.z),_mm_mul_ps(s1,qb.z));
+        r.w=_mm_add_ps(_mm_mul_ps(t0,qa.w),_mm_mul_ps(s1,qb.w));
+        normalize(r);
+        store(result+i,r);
+    }
+#endif
+    for(;i<count;++i)
+        result[i]=quat::slerp_fast(a[i],b[i],t[i]);
+}
+
+void compose(const int *idx,int count,const int *parent,const vec3 *offset,const quat *rot_offset,
+             const vec3 *pos,const quat *rot,vec3 *to_pos,quat *to_rot)
+{
+    if(!idx || !parent || !offset || !pos || !rot || !to_pos || !to_rot)
+        return;
+
+    int i=0;
+#ifdef NYA_MATH_SSE
+    for(;i+4<=count;i+=4)
+    {
+        const int *b=idx+i;
+        const int p[4]={parent[b[0]],parent[b[1]],parent[b[2]],parent[b[3]]};
+
+        quat_x4 r=gather(rot,b);
+        if(rot_offset)
+            r=mul(gather(rot_offset,b),r);
+
+        vec3_x4 v=gather(pos,b);
+        const vec3_x4 o=gather(offset,b);
+        v.x=_mm_add_ps(v.x,o.x),v.y=_mm_add_ps(v.y,o.y),v.z=_mm_add_ps(v.z,o.z);
+
+        const quat_x4 pr=gather(to_rot,p);
+        const vec3_x4 pp=gather(to_pos,p);
+        v=rotate(pr,v);
+        v.x=_mm_add_ps(pp.x,v.x),v.y=_mm_add_ps(pp.y,v.y),v.z=_mm_add_ps(pp.z,v.z);
+        scatter(to_pos,b,v);
+        scatter(to_rot,b,mul(pr,r));
+    }
+#endif
+    for(;i<count;++i)
+    {
+        const int b=idx[i],p=parent[b];
+        const quat r=rot_offset?rot_offset[b]*rot[b]:rot[b];
+        to_pos[b]=to_pos[p]+to_rot[p].rotate(pos[b]+offset[b]);
+        to_rot[b]=to_rot[p]*r;
+    }
+}
+
+void skin(const float *matrices,int bones_count,const vec3 *v,const vec4 *bone_idx,const vec4 *bone_weight,vec3 *to,int count)
+{
+    if(!v || !bone_idx || !bone_weight || !to)
+        return;
+
+    if(!matrices || bones_count<=0)
+    {
+        for(int i=0;i<count;++i)
+            to[i]=vec3();
+        return;
+    }
+
+    int i=0;
+#ifdef NYA_MATH_SSE
+    for(;i+4<=count;i+=4)
+    {
+        __m128 rows[3][4];
+        for(int k=0;k<4;++k)
+        {
+            int b[4];
+            float w[4];
+            skin_weights(bone_idx[i+k],bone_weight[i+k],bones_count,b,w);
+
+            for(int r=0;r<3;++r)
+            {
+                __m128 row=_mm_mul_ps(_mm_loadu_ps(matrices+b[0]*12+r*4),_mm_set1_ps(w[0]));
+                for(int j=1;j<4;++j)
+                    row=_mm_add_ps(row,_mm_mul_ps(_mm_loadu_ps(matrices+b[j]*12+r*4),_mm_set1_ps(w[j])));
+                rows[r][k]=row;
+            }
+        }
+
+        const vec3_x4 p=load(v+i);
+        __m128 res[3];
+        for(int r=0;r<3;++r)
+        {
+            __m128 *c=rows[r];
+            _MM_TRANSPOSE4_PS(c[0],c[1],c[2],c[3]);
+            res[r]=_mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c[0],p.x),_mm_mul_ps(c[1],p.y)),_mm_mul_ps(c[2],p.z)),c[3]);
+        }
+
+        vec3_x4 out;
+        out.x=res[0],out.y=res[1],out.z=res[2];
+        store(to+i,out);
+    }
+#endif
+    for(;i<count;++i)
+    {
+        int b[4];
+        float w[4];
+        skin_weights(bone_idx[i],bone_weight[i],bones_count,b,w);
+        to[i]=skin_scalar(matrices,v[i],b,w);
+    }
+}
+
+void skin_dq(const float *dual_quats,int bones_count,const vec3 *v,const vec4 *bone_idx,const vec4 *bone_weight,vec3 *to,int count)
+{
+    if(!v || !bone_idx || !bone_weight || !to)
+        return;
+
+    if(!dual_quats || bones_count<=0)
+    {
+        for(int i=0;i<count;++i)
+            to[i]=vec3();
+        return;
+    }
+
+    int i=0;
+#ifdef NYA_MATH_SSE
+    for(;i+4<=count;i+=4)
+    {
+        quat_x4 r,d;
+        __m128 *rc=&r.x,*dc=&d.x;
+        for(int k=0;k<4;++k)
+        {
+            int b[4];
+            float w[4];
+            skin_weights(bone_idx[i+k],bone_weight[i+k],bones_count,b,w);
+
+            //same as skin_dq_signs, without branches on mixed hemispheres
+            int first=0;
+            while(first<3 && w[first]==0.0f)
+                ++first;
+
+            const __m128 q0=_mm_loadu_ps(dual_quats+b[first]*8);
+            __m128 w4[4];
+            for(int j=0;j<4;++j)
+            {
+                const __m128 p=_mm_mul_ps(q0,_mm_loadu_ps(dual_quats+b[j]*8));
+                const __m128 h=_mm_add_ps(p,_mm_movehl_ps(p,p));
+                const __m128 d=_mm_add_ss(h,_mm_shuffle_ps(h,h,_MM_SHUFFLE(1,1,1,1)));
+                const __m128 flip=_mm_and_ps(_mm_cmplt_ss(d,_mm_setzero_ps()),_mm_set_ss(-0.0f));
+                w4[j]=_mm_xor_ps(_mm_set1_ps(w[j]),_mm_shuffle_ps(flip,flip,_MM_SHUFFLE(0,0,0,0)));
+            }
+
+            const float *q=dual_quats+b[0]*8;
+            __m128 real=_mm_mul_ps(_mm_loadu_ps(q),w4[0]),dual=_mm_mul_ps(_mm_loadu_ps(q+4),w4[0]);
+            for(int j=1;j<4;++j)
+            {
+                q=dual_quats+b[j]*8;
+                real=_mm_add_ps(real,_mm_mul_ps(_mm_loadu_ps(q),w4[j]));
+                dual=_mm_add_ps(dual,_mm_mul_ps(_mm_loadu_ps(q+4),w4[j]));
+            }
+
+            rc[k]=real,dc[k]=dual;
+        }
+
+        _MM_TRANSPOSE4_PS(r.x,r.y,r.z,r.w);
+        _MM_TRANSPOSE4_PS(d.x,d.y,d.z,d.w);
+
+        //same operations as skin_dq_scalar
+        const __m128 len_sq=_mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(r.x,r.x),_mm_mul_ps(r.y,r.y)),
+                                                  _mm_mul_ps(r.z,r.z)),_mm_mul_ps(r.w,r.w));
+        const __m128 mask=_mm_cmpgt_ps(len_sq,_mm_set1_ps(0.00001f*0.00001f));
+        const __m128 one=_mm_set1_ps(1.0f);
+        const __m128 len_inv=_mm_div_ps(one,_mm_sqrt_ps(len_sq));
+        const __m128 tk=_mm_mul_ps(_mm_set1_ps(2.0f),_mm_div_ps(one,len_sq));
+
+        vec3_x4 dv;
+        dv.x=d.x,dv.y=d.y,dv.z=d.z;
+        const vec3_x4 c=cross(r.x,r.y,r.z,dv);
+        vec3_x4 t;
+        t.x=_mm_mul_ps(_mm_add_ps(_mm_sub_ps(_mm_mul_ps(d.x,r.w),_mm_mul_ps(r.x,d.w)),c.x),tk);
+        t.y=_mm_mul_ps(_mm_add_ps(_mm_sub_ps(_mm_mul_ps(d.y,r.w),_mm_mul_ps(r.y,d.w)),c.y),tk);
+        t.z=_mm_mul_ps(_mm_add_ps(_mm_sub_ps(_mm_mul_ps(d.z,r.w),_mm_mul_ps(r.z,d.w)),c.z),tk);
+
+        r.x=_mm_mul_ps(r.x,len_inv),r.y=_mm_mul_ps(r.y,len_inv);
+        r.z=_mm_mul_ps(r.z,len_inv),r.w=_mm_mul_ps(r.w,len_inv);
+        vec3_x4 p=rotate(r,load(v+i));
+        p.x=_mm_and_ps(_mm_add_ps(p.x,t.x),mask);
+        p.y=_mm_and_ps(_mm_add_ps(p.y,t.y),mask);
+        p.z=_mm_and_ps(_mm_add_ps(p.z,t.z),mask);
+        store(to+i,p);
+    }
+#endif
+    for(;i<count;++i)
+    {
+        int b[4];
+        float w[4];
+        skin_weights(bone_idx[i],bone_weight[i],bones_count,b,w);
+        skin_dq_signs(dual_quats,b,w);
+        to[i]=skin_dq_scalar(dual_quats,v[i],b,w);
+    }
+}
+
+}
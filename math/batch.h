@@ -0,0 +1,62 @@
+//https://code.google.com/p/nya-engine/
+
+#pragma once
+
+//batch versions of mat4 and quat operations
+//SSE (and AVX for soa arrays) when available, scalar otherwise
+//results match the scalar operators of the math types, operations are done in the same order
+//output arrays may be the same as input arrays, but shouldn't partially overlap them
+
+namespace nya_math
+{
+
+struct vec3;
+struct vec4;
+struct mat4;
+struct quat;
+
+//to[i]=m*from[i]
+void transform_points(const mat4 &m,const vec3 *from,vec3 *to,int count);
+void transform_points(const mat4 &m,const float *x,const float *y,const float *z,
+                      float *to_x,float *to_y,float *to_z,int count);
+
+//same, without translation
+void transform_normals(const mat4 &m,const vec3 *from,vec3 *to,int count);
+void transform_normals(const mat4 &m,const float *x,const float *y,const float *z,
+                       float *to_x,float *to_y,float *to_z,int count);
+
+//to[i]=a[i]*b[i]
+void multiply(const mat4 *a,const mat4 *b,mat4 *to,int count);
+//to[i]=a*b[i]
+void multiply(const mat4 &a,const mat4 *b,mat4 *to,int count);
+
+//to[i]=q[i].rotate(v[i])
+void rotate(const quat *q,const vec3 *v,vec3 *to,int count);
+//to[i]=q.rotate(v[i])
+void rotate(const quat &q,const vec3 *v,vec3 *to,int count);
+
+void normalize(quat *q,int count);
+
+//result[i]=quat::slerp_fast(a[i],b[i],t[i]), or quat::slerp if not fast
+void slerp_n(const quat *a,const quat *b,const float *t,quat *result,int count,bool fast=true);
+
+//to_pos[i]=parent_pos[i]+parent_rot[i].rotate(pos[i]), to_rot[i]=parent_rot[i]*rot[i]
+void compose(const vec3 *parent_pos,const quat *parent_rot,const vec3 *pos,const quat *rot,
+             vec3 *to_pos,quat *to_rot,int count);
+
+//same for bones of a hierarchy, all arrays are by bone idx and bones are idx[0..count)
+//p=parent[b], to_pos[b]=to_pos[p]+to_rot[p].rotate(pos[b]+offset[b]), to_rot[b]=to_rot[p]*(rot_offset[b]*rot[b])
+//parents should be valid and not in idx, rot_offset may be 0
+void compose(const int *idx,int count,const int *parent,const vec3 *offset,const quat *rot_offset,
+             const vec3 *pos,const quat *rot,vec3 *to_pos,quat *to_rot);
+
+//linear blend skinning, up to 4 bones per vertex, bone indices are stored as floats
+//matrices are 3x4 row-major per bone, to[i]=sum of bone_weight[i][j]*(matrices[bone_idx[i][j]]*v[i])
+//weights<=0 and indices out of [0,bones_count) are skipped, weights aren't normalized
+void skin(const float *matrices,int bones_count,const vec3 *v,const vec4 *bone_idx,const vec4 *bone_weight,vec3 *to,int count);
+
+//dual quaternion skinning, 8 floats per bone: rotation and dual part
+//dual quats are blended in the hemisphere of the first used bone and normalized, vertices without used bones are zero
+void skin_dq(const float *dual_quats,int bones_count,const vec3 *v,const vec4 *bone_idx,const vec4 *bone_weight,vec3 *to,int count);
+
+}
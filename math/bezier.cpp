@@ -2,34 +2,156 @@
 
 #include "bezier.h"
 #include <math.h>
+#include <string.h>
+
+#if defined __SSE__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP>=1)
+    #define NYA_MATH_SSE
+    #include <xmmintrin.h>
+#endif
 
 namespace nya_math
 {
 
+namespace
+{
+
+const float max_error=0.00005f;
+const double max_slope=64.0;
+const int solve_max_iterations=32;
+
+inline double eval(const double c[3],double t) { return ((c[2]*t+c[1])*t+c[0])*t; }
+inline double eval_d(const double c[3],double t) { return (c[2]*3.0*t+c[1]*2.0)*t+c[0]; }
+inline double eval_d2(const double c[3],double t) { return c[2]*6.0*t+c[1]*2.0; }
+
+//newton iterations, bisection when newton leaves the bracket
+template<typename t_float> t_float solve_t(const t_float c[3],t_float x,t_float lo,t_float hi,t_float eps)
+{
+    t_float t=lo+(hi-lo)*t_float(0.5);
+    for(int i=0;i<solve_max_iterations && hi-lo>eps;++i)
+    {
+        const t_float err=((c[2]*t+c[1])*t+c[0])*t-x;
+        if(err==0)
+            break;
+
+        if(err<0)
+            lo=t;
+        else
+            hi=t;
+
+        const t_float d=(c[2]*3*t+c[1]*2)*t+c[0];
+        t_float next=d>0?t-err/d:lo;
+        if(!(next>lo && next<hi))
+            next=(lo+hi)*t_float(0.5);
+
+        t=next;
+    }
+
+    return t;
+}
+
+inline float hermite(float y0,float y1,float m0,float m1,float s)
+{
+    const float c=(y1-y0)*3.0f-m0*2.0f-m1;
+    const float d=(y0-y1)*2.0f+m0+m1;
+    return ((d*s+c)*s+m0)*s+y0;
+}
+
+}
+
 bezier::bezier(float x1,float y1,float x2,float y2)
 {
     const float eps=0.001f;
     if(fabs(x1-y1)<eps && fabs(x2-y2)<eps)
     {
+        m_div=0;
+        m_solve_mask=0;
         m_linear=true;
         return;
     }
 
-    x1*=3.0f;
-    y1*=3.0f;
+    m_linear=false;
 
-    x2*=3.0f;
-    y2*=3.0f;
+    const double cx[3]={3.0*x1,3.0*x2-6.0*x1,1.0+3.0*x1-3.0*x2};
+    const double cy[3]={3.0*y1,3.0*y2-6.0*y1,1.0+3.0*y1-3.0*y2};
+    for(int i=0;i<3;++i)
+        m_cx[i]=float(cx[i]),m_cy[i]=float(cy[i]);
 
-    m_y[0]=0.0f;
-    m_y[div_count]=1.0f;
+    //exact values at the finest steps
+    const int n=max_div_count;
+    const double h=1.0/n;
+    double t[n+1];
+    float y[n+1],m[n+1];
+    bool steep[n+1];
+    for(int i=0;i<=n;++i)
+    {
+        t[i]=i==0?0.0:(i==n?1.0:solve_t(cx,h*i,t[i-1],1.0,1.0e-12));
+        y[i]=float(eval(cy,t[i]));
 
-    float dx=1.0f/(float)div_count;
+        double dx=eval_d(cx,t[i]),dy=eval_d(cy,t[i]);
+        if(dx==0.0 && dy==0.0) //control point on the end point, slope is the limit along the curve
+            dx=eval_d2(cx,t[i]),dy=eval_d2(cy,t[i]);
 
-    for(int i=1;i<div_count;++i)
-        m_y[i]=get_y(dx*i,x1,y1,x2,y2);
+        steep[i]=dx==0.0 || fabs(dy)>fabs(dx)*max_slope;
+        m[i]=steep[i]?0.0f:float(dy/dx);
+    }
 
-    m_linear=false;
+    unsigned int fine_mask=0;
+    for(int i=0;i<n;++i)
+    {
+        if(steep[i] || steep[i+1])
+        {
+            fine_mask|=1<<i;
+            continue;
+        }
+
+        for(int j=1;j<4;++j)
+        {
+            const float s=j*0.25f;
+            const float exact=float(eval(cy,solve_t(cx,h*(i+s),t[i],t[i+1],1.0e-12)));
+            if(fabsf(hermite(y[i],y[i+1],float(m[i]*h),float(m[i+1]*h),s)-exact)>max_error)
+            {
+                fine_mask|=1<<i;
+                break;
+            }
+        }
+    }
+
+    //fewest steps which reproduce the finest ones
+    m_div=n;
+    m_solve_mask=fine_mask;
+    for(int div=2;div<n && !fine_mask;div*=2)
+    {
+        const int step=n/div;
+        bool ok=true;
+        for(int j=0;j<div && ok;++j)
+        {
+            const int from=j*step,to=from+step;
+            for(int k=from+1;k<to && ok;++k)
+            {
+                const float r=hermite(y[from],y[to],m[from]/div,m[to]/div,float(k-from)/step);
+                ok=fabsf(r-y[k])<=max_error;
+            }
+        }
+
+        if(ok)
+        {
+            m_div=div;
+            break;
+        }
+    }
+
+    const int step=n/m_div;
+    for(int i=0;i<=m_div;++i)
+    {
+        m_ym[i*2]=y[i*step];
+        m_ym[i*2+1]=m[i*step]/m_div;
+    }
+}
+
+float bezier::solve(float x) const
+{
+    const float t=solve_t(m_cx,x,0.0f,1.0f,0.000001f);
+    return ((m_cy[2]*t+m_cy[1])*t+m_cy[0])*t;
 }
 
 float bezier::get(float x) const
@@ -37,40 +159,111 @@ float bezier::get(float x) const
     if(m_linear)
         return x;
 
-    x*=(float)div_count;
+    if(x<=0.0f)
+        return 0.0f;
 
-    const int idx=(int)x;
+    if(x>=1.0f)
+        return 1.0f;
 
-    if(idx>=div_count)
-        return m_y[div_count];
+    const float fx=x*m_div;
+    int idx=int(fx);
+    if(idx>=m_div)
+        idx=m_div-1;
 
-    if(idx<0)
-        return m_y[0];
+    if(m_solve_mask & (1<<idx))
+        return solve(x);
 
-    x-=idx;
+    const float *ym=m_ym+idx*2;
+    return hermite(ym[0],ym[2],ym[1],ym[3],fx-idx);
+}
+
+void bezier::get(const float *x,float *result,int count) const
+{
+    if(!x || !result)
+        return;
 
-    return m_y[idx]*(1.0f-x)+m_y[idx + 1]*x;
+    bezier const *curves[4]={this,this,this,this};
+    for(int i=0;i<count;i+=4)
+        get(curves,x+i,result+i,count-i<4?count-i:4);
 }
 
-float bezier::get_y(float x,float x1,float y1,float x2,float y2)
+void bezier::get(const bezier *const *curves,const float *x,float *result,int count)
 {
-    float t=x;
-    float inv_t=1.0f-t;
+    if(!curves || !x || !result)
+        return;
 
-    const float eps=0.001f;
+    int i=0;
+#ifdef NYA_MATH_SSE
+    for(;i+4<=count;i+=4)
+    {
+        float y0[4],y1[4],m0[4],m1[4],s[4];
+        int fallback=0;
+        for(int j=0;j<4;++j)
+        {
+            const bezier &b=*curves[i+j];
+            const float v=x[i+j];
+            const float fx=v*b.m_div;
+            const int idx=int(fx)<b.m_div?int(fx):b.m_div-1;
+            if(b.m_linear || !(v>0.0f && v<1.0f) || (b.m_solve_mask & (1<<idx)))
+            {
+                fallback|=1<<j;
+                y0[j]=y1[j]=m0[j]=m1[j]=s[j]=0.0f;
+                continue;
+            }
 
-    for(int i=0;i<32;++i)
+            const float *ym=b.m_ym+idx*2;
+            y0[j]=ym[0],m0[j]=ym[1];
+            y1[j]=ym[2],m1[j]=ym[3];
+            s[j]=fx-idx;
+        }
+
+        //same operations as hermite()
+        const __m128 vy0=_mm_loadu_ps(y0),vy1=_mm_loadu_ps(y1),vm0=_mm_loadu_ps(m0),vm1=_mm_loadu_ps(m1),vs=_mm_loadu_ps(s);
+        const __m128 c=_mm_sub_ps(_mm_sub_ps(_mm_mul_ps(_mm_sub_ps(vy1,vy0),_mm_set1_ps(3.0f)),_mm_mul_ps(vm0,_mm_set1_ps(2.0f))),vm1);
+        const __m128 d=_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(vy0,vy1),_mm_set1_ps(2.0f)),vm0),vm1);
+        const __m128 r=_mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(d,vs),c),vs),vm0),vs),vy0);
+        _mm_storeu_ps(result+i,r);
+
+        for(int j=0;fallback;++j,fallback>>=1)
+        {
+            if(fallback&1)
+                result[i+j]=curves[i+j]->get(x[i+j]);
+        }
+    }
+#endif
+    for(;i<count;++i)
+        result[i]=curves[i]->get(x[i]);
+}
+
+bool bezier::operator == (const bezier &b) const
+{
+    if(m_linear || b.m_linear)
+        return m_linear==b.m_linear;
+
+    //table is derived from coefficients
+    for(int i=0;i<3;++i)
     {
-        float tx = inv_t*inv_t*t*x1 + inv_t*t*t*x2 + t*t*t - x;
+        if(m_cx[i]!=b.m_cx[i] || m_cy[i]!=b.m_cy[i])
+            return false;
+    }
 
-        if(fabsf(tx)<eps)
-            break;
+    return true;
+}
 
-        t-=0.5f*tx;
-        inv_t=1.0f-t;
+unsigned int bezier::get_hash() const
+{
+    if(m_linear)
+        return 0;
+
+    unsigned int h=2166136261u;
+    for(int i=0;i<6;++i)
+    {
+        unsigned int u;
+        memcpy(&u,i<3?&m_cx[i]:&m_cy[i-3],sizeof(u));
+        h=(h^u)*16777619u;
     }
 
-    return inv_t*inv_t*t*y1 + inv_t*t*t*y2 + t*t*t;
+    return h;
 }
 
 }
@@ -5,23 +5,43 @@
 namespace nya_math
 {
 
+//cubic bezier easing curve from (0,0) to (1,1) with control points (x1,y1),(x2,y2) in 0-1 range
+//y(x) is stored as hermite spline with exact values and slopes at uniform x steps,
+//steps count is chosen by curve complexity,
+//steps with nearly vertical slope are solved exactly with bounded newton-bisection
+
 class bezier
 {
 public:
     float get(float x) const;
 
+    //result[i]=get(x[i])
+    void get(const float *x,float *result,int count) const;
+    //result[i]=curves[i]->get(x[i]), curves may be different
+    static void get(const bezier *const *curves,const float *x,float *result,int count);
+
+public:
+    bool is_linear() const { return m_linear; }
+    //for lookups of equal curves
+    bool operator == (const bezier &b) const;
+    unsigned int get_hash() const;
+
 public:
-    bezier(): m_linear(true) {}
+    bezier(): m_div(0),m_solve_mask(0),m_linear(true) {}
     bezier(float x1,float y1,float x2,float y2);
 
 private:
-    float get_y(float x,float x1,float y1,float x2,float y2);
+    float solve(float x) const;
 
 private:
-    static const int div_count=16;
-    float m_y[div_count+1];
-
+    static const int max_div_count=16;
+    int m_div;
+    unsigned int m_solve_mask; //steps which are solved exactly
     bool m_linear;
+
+    float m_ym[(max_div_count+1)*2]; //y and dy/dx multiplied by step, interleaved
+    float m_cx[3]; //x(t)=((cx[2]*t+cx[1])*t+cx[0])*t
+    float m_cy[3];
 };
 
 }
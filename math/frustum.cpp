@@ -3,6 +3,11 @@
 #include "frustum.h"
 #include "quaternion.h"
 
+#if defined __SSE__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP>=1)
+    #define NYA_MATH_SSE
+    #include <xmmintrin.h>
+#endif
+
 namespace nya_math
 {
 
@@ -67,6 +72,88 @@ bool frustum::test_intersect(const vec3 &v) const
     return true;
 }
 
+void frustum::test_intersect(const float *ox,const float *oy,const float *oz,
+                             const float *dx,const float *dy,const float *dz,
+                             int count,unsigned int *visibility,unsigned char *plane_hints) const
+{
+    if(!ox || !oy || !oz || !dx || !dy || !dz || !visibility || count<=0)
+        return;
+
+    for(int i=0;i<get_visibility_size(count);++i)
+        visibility[i]=0;
+
+#ifdef NYA_MATH_SSE
+    __m128 n[6][3],abs_n[6][3],d[6];
+    for(int i=0;i<6;++i)
+    {
+        const plane &p=m_planes[i];
+        n[i][0]=_mm_set1_ps(p.n.x),n[i][1]=_mm_set1_ps(p.n.y),n[i][2]=_mm_set1_ps(p.n.z);
+        abs_n[i][0]=_mm_set1_ps(p.abs_n.x),abs_n[i][1]=_mm_set1_ps(p.abs_n.y),abs_n[i][2]=_mm_set1_ps(p.abs_n.z);
+        d[i]=_mm_set1_ps(p.d);
+    }
+
+    const __m128 zero=_mm_setzero_ps();
+#endif
+
+    for(int i=0;i<count;i+=4)
+    {
+        const int first_plane=plane_hints?plane_hints[i/4]%6:0;
+        int mask=0;
+
+#ifdef NYA_MATH_SSE
+        if(i+4<=count)
+        {
+            const __m128 x=_mm_loadu_ps(ox+i),y=_mm_loadu_ps(oy+i),z=_mm_loadu_ps(oz+i);
+            const __m128 ex=_mm_loadu_ps(dx+i),ey=_mm_loadu_ps(dy+i),ez=_mm_loadu_ps(dz+i);
+            __m128 inside=_mm_cmpeq_ps(zero,zero);
+            for(int j=0,k=first_plane;j<6;++j,k=k<5?k+1:0)
+            {
+                //same as box.origin.dot(p.n)+(box.delta.dot(p.abs_n)+p.d)
+                const __m128 dist=_mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x,n[k][0]),_mm_mul_ps(y,n[k][1])),_mm_mul_ps(z,n[k][2])),
+                                  _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ex,abs_n[k][0]),_mm_mul_ps(ey,abs_n[k][1])),_mm_mul_ps(ez,abs_n[k][2])),d[k]));
+                inside=_mm_andnot_ps(_mm_cmplt_ps(dist,zero),inside);
+                if(!_mm_movemask_ps(inside))
+                {
+                    if(plane_hints)
+                        plane_hints[i/4]=(unsigned char)k;
+                    break;
+                }
+            }
+
+            mask=_mm_movemask_ps(inside);
+        }
+        else
+#endif
+        {
+            const int to=i+4<count?i+4:count;
+            int rejected_plane=first_plane;
+            for(int l=i;l<to;++l)
+            {
+                const vec3 origin(ox[l],oy[l],oz[l]),delta(dx[l],dy[l],dz[l]);
+                bool inside=true;
+                for(int j=0,k=first_plane;j<6;++j,k=k<5?k+1:0)
+                {
+                    const plane &p=m_planes[k];
+                    if(origin.dot(p.n)+(delta.dot(p.abs_n)+p.d)<0.0f)
+                    {
+                        inside=false;
+                        rejected_plane=k;
+                        break;
+                    }
+                }
+
+                if(inside)
+                    mask|=1<<(l-i);
+            }
+
+            if(!mask && plane_hints)
+                plane_hints[i/4]=(unsigned char)rejected_plane;
+        }
+
+        visibility[i/32]|=(unsigned int)mask<<(i%32);
+    }
+}
+
 frustum::frustum(const mat4 &m)
 {
     for(int i=0;i<3;++i)
@@ -26,6 +26,15 @@ public:
     bool test_intersect(const aabb &box) const;
     bool test_intersect(const vec3 &v) const;
 
+    //batch test of boxes in soa layout, sets bit i%32 of visibility[i/32] if box i intersects
+    //plane_hints are optional, one per 4 boxes: the plane which rejected them last time is tested first
+    void test_intersect(const float *origin_x,const float *origin_y,const float *origin_z,
+                        const float *delta_x,const float *delta_y,const float *delta_z,
+                        int count,unsigned int *visibility,unsigned char *plane_hints=0) const;
+
+    static int get_visibility_size(int count) { return (count+31)/32; }
+    static int get_plane_hints_size(int count) { return (count+3)/4; }
+
 public:
     frustum() {}
     frustum(const mat4 &m);
@@ -9,263 +9,389 @@ namespace nya_math
 namespace
 {
 
-struct quad
+const int max_stack_levels=30;
+
+inline void expand(vec3 &min,vec3 &max,const vec3 &box_min,const vec3 &box_max)
+{
+    if(box_min.x<min.x) min.x=box_min.x;
+    if(box_min.y<min.y) min.y=box_min.y;
+    if(box_min.z<min.z) min.z=box_min.z;
+    if(box_max.x>max.x) max.x=box_max.x;
+    if(box_max.y>max.y) max.y=box_max.y;
+    if(box_max.z>max.z) max.z=box_max.z;
+}
+
+inline bool contains(const vec3 &min,const vec3 &max,const vec3 &box_min,const vec3 &box_max)
+{
+    return box_min.x>=min.x && box_min.y>=min.y && box_min.z>=min.z &&
+           box_max.x<=max.x && box_max.y<=max.y && box_max.z<=max.z;
+}
+
+struct point_test
 {
-    int x,z,size_x,size_z;
+    vec3 p;
 
-    quad() {}
-    quad(const aabb &box)
+    bool test_bounds(const vec3 &min,const vec3 &max) const
     {
-        x=int(floorf(box.origin.x-box.delta.x));
-        z=int(floorf(box.origin.z-box.delta.z));
-        size_x=int(ceil(box.delta.x+box.delta.x));
-        size_z=int(ceil(box.delta.z+box.delta.z));
+        return p.x>=min.x && p.y>=min.y && p.z>=min.z && p.x<=max.x && p.y<=max.y && p.z<=max.z;
     }
-};
 
-}
+    bool test_box(const aabb &b) const
+    {
+        const vec3 d=vec3::abs(b.origin-p);
+        return d.x<=b.delta.x && d.y<=b.delta.y && d.z<=b.delta.z;
+    }
 
-template<typename t> int add_object(const quad &obj,int obj_idx,float min_y,float max_y,const quad &leaf,int leaf_idx,std::vector<t> &leaves,int level)
+    point_test(const vec3 &p): p(p) {}
+};
+
+struct box_test
 {
-    if(leaf_idx<0)
+    aabb box;
+    vec3 min,max;
+
+    bool test_bounds(const vec3 &bmin,const vec3 &bmax) const
     {
-        leaf_idx=int(leaves.size());
-        leaves.resize(leaf_idx+1);
+        return min.x<=bmax.x && min.y<=bmax.y && min.z<=bmax.z && max.x>=bmin.x && max.y>=bmin.y && max.z>=bmin.z;
     }
 
-    if(leaves[leaf_idx].min_y>min_y)
-        leaves[leaf_idx].min_y=min_y;
+    bool test_box(const aabb &b) const
+    {
+        const vec3 d=vec3::abs(b.origin-box.origin);
+        return d.x<=b.delta.x+box.delta.x && d.y<=b.delta.y+box.delta.y && d.z<=b.delta.z+box.delta.z;
+    }
+
+    box_test(const aabb &b): box(b),min(b.origin-b.delta),max(b.origin+b.delta) {}
+};
+
+struct frustum_test
+{
+    const frustum &f;
+
+    bool test_bounds(const vec3 &min,const vec3 &max) const { return f.test_intersect(aabb(min,max)); }
+    bool test_box(const aabb &b) const { return f.test_intersect(b); }
 
-    if(leaves[leaf_idx].max_y<max_y)
-        leaves[leaf_idx].max_y=max_y;
+    frustum_test(const frustum &f): f(f) {}
+};
+
+}
+
+quadtree::quad::quad(const aabb &box)
+{
+    x=int(floorf(box.origin.x-box.delta.x));
+    z=int(floorf(box.origin.z-box.delta.z));
+    size_x=int(ceil(box.delta.x+box.delta.x));
+    size_z=int(ceil(box.delta.z+box.delta.z));
+}
+
+void quadtree::insert(int obj,const quad &q,const vec3 &min,const vec3 &max,int leaf_idx,int level)
+{
+    expand(m_leaves[leaf_idx].min,m_leaves[leaf_idx].max,min,max);
 
     if(level<=0)
     {
-        leaves[leaf_idx].objects.push_back(obj_idx);
-        return leaf_idx;
+        const int r=alloc_ref();
+        ref &rf=m_refs[r];
+        leaf &l=m_leaves[leaf_idx];
+        object &o=m_objects[obj];
+
+        rf.obj=obj;
+        rf.leaf=leaf_idx;
+        rf.prev_in_leaf= -1;
+        rf.next_in_leaf=l.first_ref;
+        if(l.first_ref>=0)
+            m_refs[l.first_ref].prev_in_leaf=r;
+        l.first_ref=r;
+
+        rf.next_of_obj=o.first_ref;
+        o.first_ref=r;
+        return;
     }
 
-    --level;
+    const quad leaf_q=m_leaves[leaf_idx].q;
+    const int child_size_x=leaf_q.size_x/2;
+    const int child_size_z=leaf_q.size_z/2;
+    const int center_x=leaf_q.x+child_size_x;
+    const int center_z=leaf_q.z+child_size_z;
 
-    quad child;
-    child.size_x=leaf.size_x/2;
-    child.size_z=leaf.size_z/2;
+    const bool use_x[2]={q.x<=center_x,q.x+q.size_x>center_x};
+    const bool use_z[2]={q.z<=center_z,q.z+q.size_z>center_z};
 
-    int center_x=leaf.x+child.size_x;
-    int center_z=leaf.z+child.size_z;
-
-    if(obj.x<=center_x)
+    for(int i=0;i<2;++i)
+    for(int j=0;j<2;++j)
     {
-        child.x=leaf.x;
+        if(!use_x[i] || !use_z[j])
+            continue;
 
-        if(obj.z<=center_z)
+        int child=m_leaves[leaf_idx].leaves[i][j];
+        if(child<0)
         {
-            child.z=leaf.z;
-            leaves[leaf_idx].leaves[0][0] = add_object(obj,obj_idx,min_y,max_y,child,leaves[leaf_idx].leaves[0][0],leaves,level);
+            child=int(m_leaves.size());
+            m_leaves.push_back(leaf());
+            m_leaves[child].q=quad(i?center_x:leaf_q.x,j?center_z:leaf_q.z,child_size_x,child_size_z);
+            m_leaves[child].parent=leaf_idx;
+            m_leaves[leaf_idx].leaves[i][j]=child;
         }
 
-        if(obj.z+obj.size_z>center_z)
-        {
-            child.z=center_z;
-            leaves[leaf_idx].leaves[0][1] = add_object(obj,obj_idx,min_y,max_y,child,leaves[leaf_idx].leaves[0][1],leaves,level);
-        }
+        insert(obj,q,min,max,child,level-1);
     }
+}
 
-    if(obj.x+obj.size_x>center_x)
+int quadtree::alloc_ref()
+{
+    if(m_free_ref>=0)
     {
-        child.x=center_x;
+        const int r=m_free_ref;
+        m_free_ref=m_refs[r].next_in_leaf;
+        return r;
+    }
 
-        if(obj.z<=center_z)
-        {
-            child.z=leaf.z;
-            leaves[leaf_idx].leaves[1][0] = add_object(obj,obj_idx,min_y,max_y,child,leaves[leaf_idx].leaves[1][0],leaves,level);
-        }
+    m_refs.resize(m_refs.size()+1);
+    return int(m_refs.size())-1;
+}
 
-        if(obj.z+obj.size_z>center_z)
-        {
-            child.z=center_z;
-            leaves[leaf_idx].leaves[1][1] = add_object(obj,obj_idx,min_y,max_y,child,leaves[leaf_idx].leaves[1][1],leaves,level);
-        }
+void quadtree::unlink(int obj)
+{
+    object &o=m_objects[obj];
+    for(int r=o.first_ref;r>=0;)
+    {
+        ref &rf=m_refs[r];
+        if(rf.prev_in_leaf>=0)
+            m_refs[rf.prev_in_leaf].next_in_leaf=rf.next_in_leaf;
+        else
+            m_leaves[rf.leaf].first_ref=rf.next_in_leaf;
+
+        if(rf.next_in_leaf>=0)
+            m_refs[rf.next_in_leaf].prev_in_leaf=rf.prev_in_leaf;
+
+        const int next=rf.next_of_obj;
+        rf.next_in_leaf=m_free_ref;
+        m_free_ref=r;
+        r=next;
     }
 
-    return leaf_idx;
+    o.first_ref= -1;
 }
 
 void quadtree::add_object(const aabb &box,int idx)
 {
-    if(m_leaves.empty())
+    if(m_leaves.empty() || idx<0)
         return;
 
-    objects_map::iterator it=m_objects.find(idx);
-    if(it!=m_objects.end())
-        remove_object(idx);
+    if(idx>=(int)m_objects.size())
+        m_objects.resize(idx+1);
 
-    m_objects[idx]=box;
+    object &o=m_objects[idx];
+    if(o.used)
+        unlink(idx);
+    else
+        ++m_objects_count;
 
-    quad obj(box);
-    quad leaf;leaf.x=m_x,leaf.z=m_z,leaf.size_x=m_size_x,leaf.size_z=m_size_z;
-    int root=0;
-    ::nya_math::add_object(quad(box),idx,box.origin.y-box.delta.y,box.origin.y+box.delta.y,leaf,root,m_leaves,m_max_level);
+    o.used=true;
+    o.box=box;
+    o.q=quad(box);
+    insert(idx,o.q,box.origin-box.delta,box.origin+box.delta,0,m_max_level);
 }
 
-template<typename t> void remove_object(int obj_idx,int leaf_idx,std::vector<t> &leaves,int parent)
+void quadtree::update_object(const aabb &box,int idx)
 {
-    if(leaf_idx<0)
+    if(idx<0 || idx>=(int)m_objects.size() || !m_objects[idx].used)
+    {
+        add_object(box,idx);
         return;
-    t &leaf=leaves[leaf_idx];
-    remove_object(obj_idx,leaf.leaves[0][0],leaves,leaf_idx);
-    remove_object(obj_idx,leaf.leaves[0][1],leaves,leaf_idx);
-    remove_object(obj_idx,leaf.leaves[1][0],leaves,leaf_idx);
-    remove_object(obj_idx,leaf.leaves[1][1],leaves,leaf_idx);
+    }
 
-    for(int i=0;i<(int)leaf.objects.size();++i)
+    object &o=m_objects[idx];
+    const quad q(box);
+    if(!(q==o.q))
     {
-        if(leaf.objects[i]!=obj_idx)
-            continue;
-
-        leaf.objects.erase(leaf.objects.begin()+i);
-        break;
+        add_object(box,idx);
+        return;
     }
 
-    //ToDo: remove leaves
+    o.box=box;
+    const vec3 min=box.origin-box.delta,max=box.origin+box.delta;
+    for(int r=o.first_ref;r>=0;r=m_refs[r].next_of_obj)
+    {
+        for(int l=m_refs[r].leaf;l>=0;l=m_leaves[l].parent)
+        {
+            leaf &lf=m_leaves[l];
+            if(contains(lf.min,lf.max,min,max))
+                break;
+
+            expand(lf.min,lf.max,min,max);
+        }
+    }
 }
 
 void quadtree::remove_object(int idx)
 {
-    objects_map::iterator it=m_objects.find(idx);
-    if(it==m_objects.end())
+    if(idx<0 || idx>=(int)m_objects.size() || !m_objects[idx].used)
         return;
 
-    m_objects.erase(it);
-    ::nya_math::remove_object(idx,0,m_leaves,-1);
+    unlink(idx);
+    m_objects[idx].used=false;
+    --m_objects_count;
+
+    //ToDo: remove leaves
 }
 
 const aabb &quadtree::get_object_aabb(int idx) const
 {
-    objects_map::const_iterator it=m_objects.find(idx);
-    if(it==m_objects.end())
+    if(idx<0 || idx>=(int)m_objects.size() || !m_objects[idx].used)
     {
         const static aabb invalid;
         return invalid;
     }
 
-    return it->second;
+    return m_objects[idx].box;
 }
 
-bool sort_objects(bool previous_result,std::vector<int> &result)
+unsigned int quadtree::next_mark() const
 {
-    if(!previous_result)
-        return false;
+    if(++m_mark)
+        return m_mark;
 
-    std::sort(result.begin(),result.end());
-    std::vector<int>::iterator last=std::unique(result.begin(),result.end());
-    result.erase(last,result.end());
-    return true;
+    for(size_t i=0;i<m_objects.size();++i)
+        m_objects[i].mark=0;
+
+    return m_mark=1;
 }
 
-template<typename t> bool get_objects(quad search,quad leaf,int leaf_idx,const std::vector<t> &leaves,std::vector<int> &result)
+template<typename t> int quadtree::query(const t &test,int *result,int max_count) const
 {
-    if(leaf_idx<0)
-        return false;
-
-    const t &l=leaves[leaf_idx];
-    if(!l.objects.empty())
-    {
-        result.insert(result.end(),l.objects.begin(),l.objects.end());
-        return !result.empty();
-    }
+    if(m_leaves.empty())
+        return 0;
 
-    quad child;
-    child.size_x=leaf.size_x/2;
-    child.size_z=leaf.size_z/2;
+    const unsigned int mark=next_mark();
+    int count=0;
 
-    int center_x=leaf.x+child.size_x;
-    int center_z=leaf.z+child.size_z;
+    int stack[max_stack_levels*3+1];
+    int stack_size=0;
+    stack[stack_size++]=0;
 
-    if(search.x<=center_x)
+    while(stack_size>0)
     {
-        child.x=leaf.x;
-
-        if(search.z<=center_z)
-        {
-            child.z=leaf.z;
-            get_objects(search,child,leaves[leaf_idx].leaves[0][0],leaves,result);
-        }
+        const leaf &l=m_leaves[stack[--stack_size]];
+        if(l.min.x>l.max.x || !test.test_bounds(l.min,l.max))
+            continue;
 
-        if(search.z+search.size_z>center_z)
+        for(int r=l.first_ref;r>=0;r=m_refs[r].next_in_leaf)
         {
-            child.z=center_z;
-            get_objects(search,child,leaves[leaf_idx].leaves[0][1],leaves,result);
-        }
-    }
+            const object &o=m_objects[m_refs[r].obj];
+            if(o.mark==mark)
+                continue;
 
-    if(search.x+search.size_x>center_x)
-    {
-        child.x=center_x;
+            o.mark=mark;
+            if(!test.test_box(o.box))
+                continue;
 
-        if(search.z<=center_z)
-        {
-            child.z=leaf.z;
-            get_objects(search,child,leaves[leaf_idx].leaves[1][0],leaves,result);
+            if(count<max_count)
+                result[count]=m_refs[r].obj;
+            ++count;
         }
 
-        if(search.z+search.size_z>center_z)
+        for(int i=0;i<4;++i)
         {
-            child.z=center_z;
-            get_objects(search,child,leaves[leaf_idx].leaves[1][1],leaves,result);
+            const int child=l.leaves[i/2][i%2];
+            if(child>=0)
+                stack[stack_size++]=child;
         }
     }
 
-    return !result.empty();
+    return count;
 }
 
-bool quadtree::get_objects(int x,int z, std::vector<int> &result) const
+int quadtree::get_objects(const vec3 &v,int *result,int max_count) const { return query(point_test(v),result,result?max_count:0); }
+int quadtree::get_objects(const aabb &box,int *result,int max_count) const { return query(box_test(box),result,result?max_count:0); }
+int quadtree::get_objects(const frustum &f,int *result,int max_count) const { return query(frustum_test(f),result,result?max_count:0); }
+
+namespace
 {
-    if(m_leaves.empty())
-        return false;
 
-    result.clear();
-    quad search;search.x=x;search.z=z;search.size_x=search.size_z=0;
-    quad leaf;leaf.x=m_x,leaf.z=m_z,leaf.size_x=m_size_x,leaf.size_z=m_size_z;
-    return sort_objects(::nya_math::get_objects(search,leaf,0,m_leaves,result),result);
+template<typename t,typename tree> bool query_vector(const tree &qt,const t &test,std::vector<int> &result)
+{
+    result.resize(result.capacity()>16?result.capacity():16);
+    int count=qt.get_objects(test,&result[0],int(result.size()));
+    if(count>int(result.size()))
+    {
+        result.resize(count);
+        count=qt.get_objects(test,&result[0],count);
+    }
+
+    result.resize(count);
+    return count>0;
 }
 
-bool quadtree::get_objects(int x,int z,int size_x,int size_z, std::vector<int> &result) const
+}
+
+bool quadtree::get_objects(const vec3 &v,std::vector<int> &result) const { return query_vector(*this,v,result); }
+bool quadtree::get_objects(const aabb &box,std::vector<int> &result) const { return query_vector(*this,box,result); }
+bool quadtree::get_objects(const frustum &f,std::vector<int> &result) const { return query_vector(*this,f,result); }
+
+bool quadtree::get_rect_objects(const quad &search,std::vector<int> &result) const
 {
+    result.clear();
     if(m_leaves.empty())
         return false;
 
-    result.clear();
-    quad search;search.x=x;search.z=z;search.size_x=size_x,search.size_z=size_z;
-    quad leaf;leaf.x=m_x,leaf.z=m_z,leaf.size_x=m_size_x,leaf.size_z=m_size_z;
-    return sort_objects(::nya_math::get_objects(search,leaf,0,m_leaves,result),result);
-}
+    const unsigned int mark=next_mark();
 
-/*
-bool quadtree::get_objects(const vec3 &v, std::vector<int> &result) const
-{
-    //ToDo
-    return false;
+    int stack[max_stack_levels*3+1];
+    int stack_size=0;
+    stack[stack_size++]=0;
+
+    while(stack_size>0)
+    {
+        const leaf &l=m_leaves[stack[--stack_size]];
+        if(l.first_ref>=0)
+        {
+            for(int r=l.first_ref;r>=0;r=m_refs[r].next_in_leaf)
+            {
+                const int obj=m_refs[r].obj;
+                if(m_objects[obj].mark==mark)
+                    continue;
+
+                m_objects[obj].mark=mark;
+                result.push_back(obj);
+            }
+
+            continue;
+        }
+
+        const int center_x=l.q.x+l.q.size_x/2;
+        const int center_z=l.q.z+l.q.size_z/2;
+        const bool use_x[2]={search.x<=center_x,search.x+search.size_x>center_x};
+        const bool use_z[2]={search.z<=center_z,search.z+search.size_z>center_z};
+
+        for(int i=0;i<2;++i)
+        for(int j=0;j<2;++j)
+        {
+            if(use_x[i] && use_z[j] && l.leaves[i][j]>=0)
+                stack[stack_size++]=l.leaves[i][j];
+        }
+    }
+
+    std::sort(result.begin(),result.end());
+    return !result.empty();
 }
 
-bool quadtree::get_objects(const aabb &box, std::vector<int> &result) const
+bool quadtree::get_objects(int x,int z, std::vector<int> &result) const
 {
-    //ToDo
-    return false;
+    return get_rect_objects(quad(x,z,0,0),result);
 }
 
-bool quadtree::get_objects(const frustum &f, std::vector<int> &result) const
+bool quadtree::get_objects(int x,int z,int size_x,int size_z, std::vector<int> &result) const
 {
-    //ToDo
-    return false;
+    return get_rect_objects(quad(x,z,size_x,size_z),result);
 }
-*/
 
-quadtree::quadtree(int x,int z,int size_x,int size_z,int max_level)
+quadtree::quadtree(int x,int z,int size_x,int size_z,int max_level): m_objects_count(0),m_free_ref(-1),m_mark(0)
 {
     m_x=x,m_z=z,m_size_x=size_x,m_size_z=size_z;
-    m_max_level=max_level;
+    m_max_level=max_level<max_stack_levels?max_level:max_stack_levels;
     m_leaves.resize(1);
+    m_leaves[0].q=quad(x,z,size_x,size_z);
 }
 
 }
@@ -3,50 +3,110 @@
 #pragma once
 
 #include "frustum.h"
-#include <map>
 #include <vector>
 #include <float.h>
 
 namespace nya_math
 {
 
+//objects are referenced by non-negative indices, preferably dense ones: they are used as array indices
+//queries are not thread-safe, they share a mutable visit mark to avoid duplicates
+
 class quadtree
 {
 public:
     void add_object(const aabb &box,int idx);
+    void update_object(const aabb &box,int idx); //cheap if the object stays within the same leaves
     void remove_object(int idx);
 
 public:
+    //rect queries return objects from all leaves touched by the rect, sorted
     bool get_objects(int x,int z, std::vector<int> &result) const;
     bool get_objects(int x,int z,int size_x,int size_z, std::vector<int> &result) const;
-/*
+
+    //objects whose aabb contains point, intersects box or frustum, unsorted
     bool get_objects(const vec3 &v, std::vector<int> &result) const;
     bool get_objects(const aabb &box, std::vector<int> &result) const;
     bool get_objects(const frustum &f, std::vector<int> &result) const;
-*/
+
+    //allocation-free versions, return count of found objects,
+    //only first max_count of them are written to result
+    int get_objects(const vec3 &v,int *result,int max_count) const;
+    int get_objects(const aabb &box,int *result,int max_count) const;
+    int get_objects(const frustum &f,int *result,int max_count) const;
+
 public:
     const aabb &get_object_aabb(int idx) const;
+    int get_objects_count() const { return m_objects_count; }
 
 public:
-    quadtree() {}
+    quadtree(): m_x(0),m_z(0),m_size_x(0),m_size_z(0),m_max_level(0),m_objects_count(0),m_free_ref(-1),m_mark(0) {}
     quadtree(int x,int z,int size_x,int size_z,int max_level);
 
 private:
+    struct quad
+    {
+        int x,z,size_x,size_z;
+
+        quad(): x(0),z(0),size_x(0),size_z(0) {}
+        quad(int x,int z,int size_x,int size_z): x(x),z(z),size_x(size_x),size_z(size_z) {}
+        explicit quad(const aabb &box);
+
+        bool operator == (const quad &q) const { return x==q.x && z==q.z && size_x==q.size_x && size_z==q.size_z; }
+    };
+
     struct leaf
     {
         int leaves[2][2];
-        std::vector<int> objects;
-        float min_y;
-        float max_y;
+        quad q;
+        vec3 min,max; //bounds of the objects, may exceed the quad
+        int parent;
+        int first_ref;
 
-        leaf() { leaves[0][0]=leaves[0][1]=leaves[1][0]=leaves[1][1]=-1; min_y=FLT_MAX; max_y=-FLT_MAX; }
+        leaf(): min(FLT_MAX,FLT_MAX,FLT_MAX),max(-FLT_MAX,-FLT_MAX,-FLT_MAX),parent(-1),first_ref(-1)
+        {
+            leaves[0][0]=leaves[0][1]=leaves[1][0]=leaves[1][1]=-1;
+        }
     };
 
+    //object in leaf reference, linked in both leaf and object lists
+    struct ref
+    {
+        int obj;
+        int leaf;
+        int prev_in_leaf;
+        int next_in_leaf;
+        int next_of_obj;
+    };
+
+    struct object
+    {
+        aabb box;
+        quad q;
+        int first_ref;
+        mutable unsigned int mark;
+        bool used;
+
+        object(): first_ref(-1),mark(0),used(false) {}
+    };
+
+private:
+    void insert(int obj,const quad &q,const vec3 &min,const vec3 &max,int leaf_idx,int level);
+    void unlink(int obj);
+    int alloc_ref();
+    unsigned int next_mark() const;
+    template<typename t> int query(const t &test,int *result,int max_count) const;
+    bool get_rect_objects(const quad &search,std::vector<int> &result) const;
+
+private:
     int m_x,m_z,m_size_x,m_size_z;
     int m_max_level;
     std::vector<leaf> m_leaves;
-    typedef std::map<int,aabb> objects_map;
-    objects_map m_objects;
+    std::vector<ref> m_refs;
+    std::vector<object> m_objects;
+    int m_objects_count;
+    int m_free_ref;
+    mutable unsigned int m_mark;
 };
 
 }
@@ -63,6 +63,25 @@ quat quat::nlerp(const quat &q1,const quat &q2,float t)
          t2*q1.w+t*q2.w).normalize();
 }
 
+quat quat::slerp_fast(const quat &q1,const quat &q2,float t)
+{
+    const float cosom=q1.v.dot(q2.v)+q1.w*q2.w;
+    const float d=fabsf(cosom);
+
+    //nlerp moves faster in the middle, t is adjusted by a cubic which factor depends on the angle
+    const float a=1.0904f+d*(-3.2452f+d*(3.55645f-d*1.43519f));
+    const float b=0.848013f+d*(-1.06021f+d*0.215638f);
+    const float k=a*(t-0.5f)*(t-0.5f)+b;
+    const float t1=t+t*(t-0.5f)*(t-1.0f)*k;
+    const float t0=1.0f-t1;
+    const float s1=cosom<0.0f?-t1:t1;
+
+    return quat(t0*q1.v.x+s1*q2.v.x,
+                t0*q1.v.y+s1*q2.v.y,
+                t0*q1.v.z+s1*q2.v.z,
+                t0*q1.w+s1*q2.w).normalize();
+}
+
 vec3 quat::get_euler() const
 {
     const float x2=v.x+v.x;
@@ -49,6 +49,9 @@ struct quat
 
     static quat slerp(const quat &from,const quat &to,float t);
     static quat nlerp(const quat &from,const quat &to,float t);
+    //nlerp with t corrected by polynomial fit to slerp, about 3 times faster than slerp
+    //rotation error from exact slerp: below 0.005 degrees for keys up to 100 degrees apart, below 0.05 degrees for any keys
+    static quat slerp_fast(const quat &from,const quat &to,float t);
 };
 
 }
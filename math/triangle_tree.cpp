@@ -0,0 +1,357 @@
+//https://code.google.com/p/nya-engine/
+
+#include "triangle_tree.h"
+#include "scalar.h"
+#include <algorithm>
+
+namespace nya_math
+{
+
+namespace
+{
+
+const int max_leaf_triangles=4;
+const int max_stack_size=128;
+
+struct center_less
+{
+    const std::vector<vec3> &centers;
+    int axis;
+
+    bool operator()(int a,int b) const { return (&centers[a].x)[axis]<(&centers[b].x)[axis]; }
+
+    center_less(const std::vector<vec3> &centers,int axis): centers(centers),axis(axis) {}
+};
+
+inline void expand(vec3 &min,vec3 &max,const vec3 &p)
+{
+    min=vec3::min(min,p);
+    max=vec3::max(max,p);
+}
+
+inline float dist_sq(const vec3 &p,const vec3 &min,const vec3 &max)
+{
+    const vec3 d(nya_math::max(nya_math::max(min.x-p.x,p.x-max.x),0.0f),
+                 nya_math::max(nya_math::max(min.y-p.y,p.y-max.y),0.0f),
+                 nya_math::max(nya_math::max(min.z-p.z,p.z-max.z),0.0f));
+    return d.length_sq();
+}
+
+inline bool ray_test(const vec3 &min,const vec3 &max,const vec3 &origin,const vec3 &inv_dir,float max_dist,float &dist)
+{
+    float t1=(min.x-origin.x)*inv_dir.x,t2=(max.x-origin.x)*inv_dir.x;
+    float tmin=nya_math::min(t1,t2),tmax=nya_math::max(t1,t2);
+
+    t1=(min.y-origin.y)*inv_dir.y,t2=(max.y-origin.y)*inv_dir.y;
+    tmin=nya_math::max(tmin,nya_math::min(t1,t2)),tmax=nya_math::min(tmax,nya_math::max(t1,t2));
+
+    t1=(min.z-origin.z)*inv_dir.z,t2=(max.z-origin.z)*inv_dir.z;
+    tmin=nya_math::max(tmin,nya_math::min(t1,t2)),tmax=nya_math::min(tmax,nya_math::max(t1,t2));
+
+    tmin=nya_math::max(tmin,0.0f);
+    if(tmax<tmin || tmin>max_dist)
+        return false;
+
+    dist=tmin;
+    return true;
+}
+
+//moller-trumbore, both sides
+inline bool ray_triangle(const vec3 &origin,const vec3 &dir,const vec3 &a,const vec3 &b,const vec3 &c,float max_dist,float &dist)
+{
+    const vec3 e1=b-a,e2=c-a;
+    const vec3 p=dir.cross(e2);
+    const float det=e1.dot(p);
+    if(fabsf(det)<1.0e-12f)
+        return false;
+
+    const float inv_det=1.0f/det;
+    const vec3 s=origin-a;
+    const float u=s.dot(p)*inv_det;
+    if(u<0.0f || u>1.0f)
+        return false;
+
+    const vec3 q=s.cross(e1);
+    const float v=dir.dot(q)*inv_det;
+    if(v<0.0f || u+v>1.0f)
+        return false;
+
+    const float t=e2.dot(q)*inv_det;
+    if(t<0.0f || t>max_dist)
+        return false;
+
+    dist=t;
+    return true;
+}
+
+//real-time collision detection, 5.1.5
+vec3 closest_on_triangle(const vec3 &p,const vec3 &a,const vec3 &b,const vec3 &c)
+{
+    const vec3 ab=b-a,ac=c-a,ap=p-a;
+    const float d1=ab.dot(ap),d2=ac.dot(ap);
+    if(d1<=0.0f && d2<=0.0f)
+        return a;
+
+    const vec3 bp=p-b;
+    const float d3=ab.dot(bp),d4=ac.dot(bp);
+    if(d3>=0.0f && d4<=d3)
+        return b;
+
+    const float vc=d1*d4-d3*d2;
+    if(vc<=0.0f && d1>=0.0f && d3<=0.0f)
+        return a+ab*(d1/(d1-d3));
+
+    const vec3 cp=p-c;
+    const float d5=ab.dot(cp),d6=ac.dot(cp);
+    if(d6>=0.0f && d5<=d6)
+        return c;
+
+    const float vb=d5*d2-d1*d6;
+    if(vb<=0.0f && d2>=0.0f && d6<=0.0f)
+        return a+ac*(d2/(d2-d6));
+
+    const float va=d3*d6-d5*d4;
+    if(va<=0.0f && d4-d3>=0.0f && d5-d6>=0.0f)
+        return b+(c-b)*((d4-d3)/((d4-d3)+(d5-d6)));
+
+    const float denom=1.0f/(va+vb+vc);
+    return a+ab*(vb*denom)+ac*(vc*denom);
+}
+
+}
+
+void triangle_tree::build(const vec3 *verts,int verts_count,const unsigned int *indices,int indices_count)
+{
+    clear();
+    if(!verts || !indices || verts_count<=0)
+        return;
+
+    const int count=indices_count/3;
+    std::vector<vec3> centers(count); //by original triangle idx
+    m_tri_idx.reserve(count);
+    for(int i=0;i<count;++i)
+    {
+        const unsigned int *t=indices+i*3;
+        if(t[0]>=(unsigned int)verts_count || t[1]>=(unsigned int)verts_count || t[2]>=(unsigned int)verts_count)
+            continue;
+
+        centers[i]=(verts[t[0]]+verts[t[1]]+verts[t[2]])/3.0f;
+        m_tri_idx.push_back(i);
+    }
+
+    if(m_tri_idx.empty())
+        return;
+
+    m_indices.resize(indices_count-indices_count%3);
+    for(size_t i=0;i<m_indices.size();++i)
+        m_indices[i]=indices[i];
+
+    m_verts_count=verts_count;
+    m_nodes.reserve(m_tri_idx.size()*2/max_leaf_triangles+1);
+    build(0,int(m_tri_idx.size()),centers,verts);
+
+    //reorder triangles by leaves
+    std::vector<unsigned int> reordered(m_tri_idx.size()*3);
+    for(size_t i=0;i<m_tri_idx.size();++i)
+    {
+        for(int j=0;j<3;++j)
+            reordered[i*3+j]=m_indices[m_tri_idx[i]*3+j];
+    }
+
+    m_indices.swap(reordered);
+}
+
+int triangle_tree::build(int from,int to,std::vector<vec3> &centers,const vec3 *verts)
+{
+    const int idx=int(m_nodes.size());
+    m_nodes.resize(idx+1);
+
+    vec3 cmin=centers[m_tri_idx[from]],cmax=cmin;
+    for(int i=from+1;i<to;++i)
+        expand(cmin,cmax,centers[m_tri_idx[i]]);
+
+    const vec3 size=cmax-cmin;
+    if(to-from<=max_leaf_triangles || size.length_sq()<=0.0f)
+    {
+        node &n=m_nodes[idx];
+        n.first=from;
+        n.count=to-from;
+
+        const unsigned int *t=&m_indices[m_tri_idx[from]*3];
+        n.min=n.max=verts[t[0]];
+        for(int i=from;i<to;++i)
+        {
+            t=&m_indices[m_tri_idx[i]*3];
+            for(int j=0;j<3;++j)
+                expand(n.min,n.max,verts[t[j]]);
+        }
+
+        return idx;
+    }
+
+    const int axis=size.x>=size.y && size.x>=size.z?0:(size.y>=size.z?1:2);
+    const int mid=(from+to)/2;
+    std::nth_element(m_tri_idx.begin()+from,m_tri_idx.begin()+mid,m_tri_idx.begin()+to,center_less(centers,axis));
+
+    build(from,mid,centers,verts);
+    const int second=build(mid,to,centers,verts);
+
+    node &n=m_nodes[idx];
+    const node &c0=m_nodes[idx+1],&c1=m_nodes[second];
+    n.min=vec3::min(c0.min,c1.min);
+    n.max=vec3::max(c0.max,c1.max);
+    n.first=second;
+    n.count=0;
+    return idx;
+}
+
+void triangle_tree::set_leaf_bounds(node &n,const vec3 *verts) const
+{
+    const unsigned int *t=&m_indices[n.first*3];
+    n.min=n.max=verts[t[0]];
+    for(int i=1;i<n.count*3;++i)
+        expand(n.min,n.max,verts[t[i]]);
+}
+
+void triangle_tree::refit(const vec3 *verts)
+{
+    if(!verts)
+        return;
+
+    //children are always after parents
+    for(int i=int(m_nodes.size())-1;i>=0;--i)
+    {
+        node &n=m_nodes[i];
+        if(n.count>0)
+        {
+            set_leaf_bounds(n,verts);
+            continue;
+        }
+
+        const node &c0=m_nodes[i+1],&c1=m_nodes[n.first];
+        n.min=vec3::min(c0.min,c1.min);
+        n.max=vec3::max(c0.max,c1.max);
+    }
+}
+
+int triangle_tree::raycast(const vec3 *verts,const vec3 &origin,const vec3 &dir,float max_dist,float *hit_dist) const
+{
+    if(m_nodes.empty() || !verts)
+        return -1;
+
+    const vec3 inv_dir(1.0f/dir.x,1.0f/dir.y,1.0f/dir.z);
+    int hit= -1;
+    float best=max_dist;
+
+    int stack[max_stack_size];
+    int stack_size=0;
+    stack[stack_size++]=0;
+
+    while(stack_size>0)
+    {
+        const int idx=stack[--stack_size];
+        const node &n=m_nodes[idx];
+        float dist;
+        if(!ray_test(n.min,n.max,origin,inv_dir,best,dist))
+            continue;
+
+        if(n.count>0)
+        {
+            for(int i=n.first;i<n.first+n.count;++i)
+            {
+                const unsigned int *t=&m_indices[i*3];
+                if(!ray_triangle(origin,dir,verts[t[0]],verts[t[1]],verts[t[2]],best,dist))
+                    continue;
+
+                best=dist;
+                hit=m_tri_idx[i];
+            }
+
+            continue;
+        }
+
+        if(stack_size+2>max_stack_size)
+            continue;
+
+        //closer child is visited first
+        float d0=0.0f,d1=0.0f;
+        const bool hit0=ray_test(m_nodes[idx+1].min,m_nodes[idx+1].max,origin,inv_dir,best,d0);
+        const bool hit1=ray_test(m_nodes[n.first].min,m_nodes[n.first].max,origin,inv_dir,best,d1);
+        if(hit0 && hit1)
+        {
+            const bool first=d0<=d1;
+            stack[stack_size++]=first?n.first:idx+1;
+            stack[stack_size++]=first?idx+1:n.first;
+        }
+        else if(hit0)
+            stack[stack_size++]=idx+1;
+        else if(hit1)
+            stack[stack_size++]=n.first;
+    }
+
+    if(hit>=0 && hit_dist)
+        *hit_dist=best;
+
+    return hit;
+}
+
+int triangle_tree::get_closest(const vec3 *verts,const vec3 &p,float max_dist,vec3 *point,float *dist) const
+{
+    if(m_nodes.empty() || !verts)
+        return -1;
+
+    int closest= -1;
+    float best_sq=max_dist*max_dist;
+    vec3 best_point;
+
+    int stack[max_stack_size];
+    int stack_size=0;
+    stack[stack_size++]=0;
+
+    while(stack_size>0)
+    {
+        const int idx=stack[--stack_size];
+        const node &n=m_nodes[idx];
+        if(dist_sq(p,n.min,n.max)>best_sq)
+            continue;
+
+        if(n.count>0)
+        {
+            for(int i=n.first;i<n.first+n.count;++i)
+            {
+                const unsigned int *t=&m_indices[i*3];
+                const vec3 c=closest_on_triangle(p,verts[t[0]],verts[t[1]],verts[t[2]]);
+                const float d=(c-p).length_sq();
+                if(d>best_sq || (d==best_sq && closest>=0))
+                    continue;
+
+                best_sq=d;
+                best_point=c;
+                closest=m_tri_idx[i];
+            }
+
+            continue;
+        }
+
+        if(stack_size+2>max_stack_size)
+            continue;
+
+        const node &c0=m_nodes[idx+1];
+        const node &c1=m_nodes[n.first];
+        const bool first=dist_sq(p,c0.min,c0.max)<=dist_sq(p,c1.min,c1.max);
+        stack[stack_size++]=first?n.first:idx+1;
+        stack[stack_size++]=first?idx+1:n.first;
+    }
+
+    if(closest<0)
+        return -1;
+
+    if(point)
+        *point=best_point;
+    if(dist)
+        *dist=sqrtf(best_sq);
+
+    return closest;
+}
+
+}
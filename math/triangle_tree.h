@@ -0,0 +1,55 @@
+//https://code.google.com/p/nya-engine/
+
+#pragma once
+
+//static bounding volume hierarchy over indexed triangles for ray and closest point queries
+//vertices aren't stored, the same vertices array is passed to queries,
+//moved vertices with the same topology (skinned poses) are supported via refit
+
+#include "vector.h"
+#include <vector>
+
+namespace nya_math
+{
+
+class triangle_tree
+{
+public:
+    //indices: 3 per triangle, triangle idx in results is the position in indices/3
+    void build(const vec3 *verts,int verts_count,const unsigned int *indices,int indices_count);
+    void refit(const vec3 *verts);
+    void clear() { *this=triangle_tree(); }
+
+public:
+    //closest triangle hit by ray, both sides, -1 if none
+    int raycast(const vec3 *verts,const vec3 &origin,const vec3 &dir,float max_dist,float *hit_dist=0) const;
+    //triangle with the closest point, -1 if none within max_dist
+    int get_closest(const vec3 *verts,const vec3 &p,float max_dist,vec3 *point=0,float *dist=0) const;
+
+public:
+    int get_triangles_count() const { return int(m_tri_idx.size()); }
+    bool is_empty() const { return m_nodes.empty(); }
+    int get_verts_count() const { return m_verts_count; }
+
+public:
+    triangle_tree(): m_verts_count(0) {}
+
+private:
+    struct node
+    {
+        vec3 min,max;
+        int first; //second child for internal nodes, first triangle for leaves
+        int count; //triangles count, 0 for internal nodes
+    };
+
+    int build(int from,int to,std::vector<vec3> &centers,const vec3 *verts);
+    void set_leaf_bounds(node &n,const vec3 *verts) const;
+
+private:
+    std::vector<node> m_nodes;
+    std::vector<unsigned int> m_indices; //reordered by leaves
+    std::vector<int> m_tri_idx; //original triangle idx
+    int m_verts_count;
+};
+
+}
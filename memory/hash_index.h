@@ -0,0 +1,127 @@
+//https://code.google.com/p/nya-engine/
+
+#pragma once
+
+// string to index map with open addressing
+// 'find' and 'insert' are O(1) average operations
+// keys are compared by hash first, so lookups rarely touch the key strings
+
+#include <string>
+#include <vector>
+
+namespace nya_memory
+{
+
+class hash_index
+{
+public:
+    int find(const char *key) const //< 0 if not found
+    {
+        if(!key || m_table.empty())
+            return -1;
+
+        const unsigned int h=get_hash(key);
+        const unsigned int mask=(unsigned int)m_table.size()-1;
+        for(unsigned int i=h&mask;;i=(i+1)&mask)
+        {
+            const entry &e=m_table[i];
+            if(e.idx<0)
+                return -1;
+
+            if(e.hash==h && e.key==key)
+                return e.idx;
+        }
+    }
+
+    int insert(const char *key,int idx) //returns existing idx if key was already inserted
+    {
+        if(!key || idx<0)
+            return -1;
+
+        if((m_count+1)*2>(int)m_table.size())
+            rehash(m_table.empty()?16:(unsigned int)m_table.size()*2);
+
+        const unsigned int h=get_hash(key);
+        const unsigned int mask=(unsigned int)m_table.size()-1;
+        for(unsigned int i=h&mask;;i=(i+1)&mask)
+        {
+            entry &e=m_table[i];
+            if(e.idx<0)
+            {
+                e.key.assign(key);
+                e.hash=h;
+                e.idx=idx;
+                ++m_count;
+                return idx;
+            }
+
+            if(e.hash==h && e.key==key)
+                return e.idx;
+        }
+    }
+
+    int get_count() const { return m_count; }
+
+    void reserve(int count)
+    {
+        unsigned int size=16;
+        while((int)size<count*2)
+            size*=2;
+
+        if(size>m_table.size())
+            rehash(size);
+    }
+
+    void clear() { m_table.clear(); m_count=0; }
+
+public:
+    static unsigned int get_hash(const char *key)
+    {
+        unsigned int h=2166136261u;
+        for(const unsigned char *c=(const unsigned char *)key;*c;++c)
+            h=(h^*c)*16777619u;
+
+        return h;
+    }
+
+public:
+    hash_index(): m_count(0) {}
+
+private:
+    void rehash(unsigned int size)
+    {
+        std::vector<entry> old;
+        old.swap(m_table);
+        m_table.resize(size);
+
+        const unsigned int mask=size-1;
+        for(size_t j=0;j<old.size();++j)
+        {
+            if(old[j].idx<0)
+                continue;
+
+            unsigned int i=old[j].hash&mask;
+            while(m_table[i].idx>=0)
+                i=(i+1)&mask;
+
+            m_table[i].key.swap(old[j].key);
+            m_table[i].hash=old[j].hash;
+            m_table[i].idx=old[j].idx;
+        }
+    }
+
+private:
+    struct entry
+    {
+        std::string key;
+        unsigned int hash;
+        int idx;
+
+        entry(): hash(0),idx(-1) {}
+    };
+
+    std::vector<entry> m_table;
+    int m_count;
+};
+
+}
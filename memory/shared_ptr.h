@@ -17,10 +17,10 @@ public:
     const t *operator -> () const { return m_ref; };
     t *operator -> () { return m_ref; };
 
-    bool operator == (const shared_ptr &other) { return other.m_ref==m_ref; }
-    bool operator != (const shared_ptr &other) { return other.m_ref!=m_ref; }
+    bool operator == (const shared_ptr &other) const { return other.m_ref==m_ref; }
+    bool operator != (const shared_ptr &other) const { return other.m_ref!=m_ref; }
 
-    int get_ref_count() { return m_ref?*m_ref_count:0; }
+    int get_ref_count() const { return m_ref?*m_ref_count:0; }
 
     void free()
     {
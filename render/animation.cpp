@@ -1,6 +1,10 @@
 //https://code.google.com/p/nya-engine/
 
 #include "animation.h"
+#include "math/batch.h"
+#include "math/scalar.h"
+#include <algorithm>
+#include <math.h>
 
 namespace
 {
@@ -12,13 +16,10 @@ template<typename t_map,typename t_data,typename t_names_data> int add_bone_curv
         return -1;
 
     const int idx=(int)data.size();
-    std::pair<typename t_map::iterator,bool> ret=
-    map.insert(std::pair<std::string,int>(name,idx));
+    const int ret=map.insert(name,idx);
+    if(ret!=idx)
+        return ret;
 
-    if(ret.second==false)
-        return ret.first->second;
-
-    map[name]=idx;
     data.resize(idx+1);
     names.resize(idx+1);
     names.back().assign(name);
@@ -26,66 +27,295 @@ template<typename t_map,typename t_data,typename t_names_data> int add_bone_curv
     return idx;
 }
 
-template<typename t_list,typename t_frame> void add_frame(t_list &seq,const t_frame &f,
-                                                          unsigned int time,unsigned int &duration)
+template<typename t_track,typename t_frame> void add_frame(t_track &seq,const t_frame &f,
+                                                           unsigned int time,unsigned int &duration)
 {
     if(time>duration)
         duration=time;
 
-    seq[time]=f;
+    //frames usually come in order
+    if(seq.times.empty() || seq.times.back()<time)
+    {
+        seq.times.push_back(time);
+        seq.frames.push_back(f);
+        return;
+    }
+
+    const size_t idx=std::lower_bound(seq.times.begin(),seq.times.end(),time)-seq.times.begin();
+    if(seq.times[idx]==time)
+    {
+        seq.frames[idx]=f;
+        return;
+    }
+
+    seq.times.insert(seq.times.begin()+idx,time);
+    seq.frames.insert(seq.frames.begin()+idx,f);
 }
 
-template<typename t_map> int get_idx(const char *name,t_map &map)
+template<typename t_map> int get_idx(const char *name,t_map &map) { return map.find(name); }
+
+//first frame with time not less than given
+inline unsigned int find_next(const std::vector<unsigned int> &times,unsigned int time,unsigned int *hint)
 {
-    if(!name)
-        return -1;
+    const unsigned int count=(unsigned int)times.size();
+    if(hint && *hint<count)
+    {
+        //sequential playback stays on the same frame or moves to the next ones
+        unsigned int i=*hint;
+        if(i==0 || times[i-1]<time)
+        {
+            for(int j=0;j<3 && i<count && times[i]<time;++j)
+                ++i;
+
+            if(i==count || times[i]>=time)
+            {
+                *hint=i<count?i:count-1;
+                return i;
+            }
+        }
+    }
 
-    typename t_map::const_iterator it=map.find(name);
-    if(it==map.end())
-        return -1;
+    const unsigned int i=(unsigned int)(std::lower_bound(times.begin(),times.end(),time)-times.begin());
+    if(hint)
+        *hint=i<count?i:(count?count-1:0);
 
-    return it->second;
+    return i;
 }
 
-template<typename t_value,typename t_data,typename t_frame> t_value get_value(int idx,
-                  unsigned int time,bool looped,const std::vector<t_data> &data,unsigned int duration)
+inline unsigned int wrap_time(unsigned int time,bool looped,unsigned int duration)
+{
+    if(time<=duration)
+        return time;
+
+    if(!looped)
+        return duration;
+
+    return duration?time%duration:0;
+}
+
+//returns count of found frames: 0 if none, 1 if only next, 2 if k should be used to interpolate
+template<typename t_track,typename t_frame> int get_frames(const t_track &seq,unsigned int time,unsigned int *hint,
+                                                           const t_frame *&prev,const t_frame *&next,float &k)
+{
+    if(seq.times.empty())
+        return 0;
+
+    const unsigned int i=find_next(seq.times,time,hint);
+    if(i>=seq.times.size())
+    {
+        next=&seq.frames.back();
+        return 1;
+    }
+
+    next=&seq.frames[i];
+    if(i==0)
+        return 1;
+
+    const unsigned int prev_time=seq.times[i-1];
+    const int time_diff=seq.times[i]-prev_time;
+    if(time_diff==0)
+        return 1;
+
+    prev=&seq.frames[i-1];
+    k=float(time-prev_time)/time_diff;
+    return 2;
+}
+
+template<typename t_data,typename t_frame> int get_frames(int idx,unsigned int time,bool looped,
+                  const std::vector<t_data> &data,unsigned int duration,std::vector<unsigned int> *cursor,
+                  const t_frame *&prev,const t_frame *&next,float &k)
 {
     if(idx<0 || idx>=(int)data.size())
-        return t_value();
+        return 0;
 
-    const t_data &seq=data[idx];
+    unsigned int *hint=0;
+    if(cursor)
+    {
+        if(cursor->size()<data.size())
+            cursor->resize(data.size(),0);
 
-    if(time>duration)
+        hint=&(*cursor)[idx];
+    }
+
+    return get_frames(data[idx],wrap_time(time,looped,duration),hint,prev,next,k);
+}
+
+template<typename t_value,typename t_data,typename t_frame> t_value get_value(int idx,
+                  unsigned int time,bool looped,const std::vector<t_data> &data,unsigned int duration,std::vector<unsigned int> *cursor,
+                  const nya_math::bezier *inters)
+{
+    const t_frame *prev=0,*next=0;
+    float k=0.0f;
+    switch(get_frames(idx,time,looped,data,duration,cursor,prev,next,k))
+    {
+        case 1: return next->value;
+        case 2: return next->interpolate(*prev,k,inters);
+    }
+
+    return t_value();
+}
+
+template<typename t_data> nya_math::quat get_rot_value(int idx,unsigned int time,bool looped,
+                  const std::vector<t_data> &data,unsigned int duration,std::vector<unsigned int> *cursor,
+                  const nya_math::bezier *inters,bool fast)
+{
+    typedef typename t_data::frame_type t_frame;
+    const t_frame *prev=0,*next=0;
+    float k=0.0f;
+    switch(get_frames(idx,time,looped,data,duration,cursor,prev,next,k))
+    {
+        case 1: return next->value;
+        case 2: return next->interpolate(*prev,k,inters,fast);
+    }
+
+    return nya_math::quat();
+}
+
+template<typename t_pos_data,typename t_rot_data> void sample_pose(const std::vector<t_pos_data> &pos_data,const std::vector<t_rot_data> &rot_data,
+                  unsigned int time,const int *bones_map,int count,nya_math::vec3 *pos,nya_math::quat *rot,
+                  const nya_math::bezier *inters,bool fast,unsigned int *pos_hints,unsigned int *rot_hints)
+{
+    typedef typename t_pos_data::frame_type t_pos_frame;
+    typedef typename t_rot_data::frame_type t_rot_frame;
+
+    //rotations which need interpolation are gathered and slerped in batches
+    const int batch_size=64;
+    nya_math::quat from[batch_size],to[batch_size];
+    float t[batch_size];
+    int batch_idx[batch_size];
+    int batch_count=0;
+
+    const int tracks_count=(int)pos_data.size();
+    for(int i=0;i<count;++i)
     {
-        if(looped)
+        const int idx=bones_map[i];
+        if(idx<0 || idx>=tracks_count)
+            continue;
+
+        const t_pos_frame *pos_prev=0,*pos_next=0;
+        float k=0.0f;
+        switch(get_frames(pos_data[idx],time,pos_hints?pos_hints+idx:0,pos_prev,pos_next,k))
         {
-            if(duration)
-                time=time%duration;
-            else
-                time=0;
+            case 0: pos[i]=nya_math::vec3(); break;
+            case 1: pos[i]=pos_next->value; break;
+            case 2: pos[i]=pos_next->interpolate(*pos_prev,k,inters); break;
         }
-        else
-            time=duration;
+
+        const t_rot_frame *rot_prev=0,*rot_next=0;
+        switch(get_frames(rot_data[idx],time,rot_hints?rot_hints+idx:0,rot_prev,rot_next,k))
+        {
+            case 0: rot[i]=nya_math::quat(); break;
+            case 1: rot[i]=rot_next->value; break;
+            case 2:
+                from[batch_count]=rot_prev->value;
+                to[batch_count]=rot_next->value;
+                t[batch_count]=rot_next->inter?inters[rot_next->inter-1].get(k):k;
+                batch_idx[batch_count++]=i;
+                break;
+        }
+
+        if(batch_count<batch_size)
+            continue;
+
+        nya_math::slerp_n(from,to,t,from,batch_count,fast);
+        for(int j=0;j<batch_count;++j)
+            rot[batch_idx[j]]=from[j];
+        batch_count=0;
     }
 
-    typename t_data::const_iterator it_next=seq.lower_bound(time);
-    if(it_next==seq.end())
-        return seq.empty()?t_value():seq.rbegin()->second.value;
+    if(batch_count>0)
+    {
+        nya_math::slerp_n(from,to,t,from,batch_count,fast);
+        for(int j=0;j<batch_count;++j)
+            rot[batch_idx[j]]=from[j];
+    }
+}
 
-    if(it_next==seq.begin())
-        return it_next->second.value;
+inline bool is_close(const nya_math::vec3 &a,const nya_math::vec3 &b,float tolerance) { return (a-b).length_sq()<=tolerance*tolerance; }
+inline bool is_close(float a,float b,float tolerance) { return fabsf(a-b)<=tolerance; }
 
-    typename t_data::const_iterator it=it_next;
-    --it;
+inline bool is_close(const nya_math::quat &a,const nya_math::quat &b,float tolerance)
+{
+    //tolerance is the angle between rotations
+    const float d=fabsf(a.v.dot(b.v)+a.w*b.w)/sqrtf(a.v.length_sq()+a.w*a.w)/sqrtf(b.v.length_sq()+b.w*b.w);
+    return d>=cosf(tolerance*0.5f);
+}
 
-    const int time_diff=it_next->first-it->first;
+//segment from a to b replaces frames between them if it matches original frames and their midpoints
+template<typename t_track> bool is_reducible(const t_track &seq,size_t a,size_t b,const nya_math::bezier *inters,float tolerance)
+{
+    const float from=float(seq.times[a]);
+    const float rdt=1.0f/(seq.times[b]-seq.times[a]);
+    for(size_t i=a+1;i<=b;++i)
+    {
+        const float t=float(seq.times[i]);
+        if(i<b && !is_close(seq.frames[b].interpolate(seq.frames[a],(t-from)*rdt,inters),seq.frames[i].value,tolerance))
+            return false;
+
+        const float mid=(t+seq.times[i-1])*0.5f;
+        if(!is_close(seq.frames[b].interpolate(seq.frames[a],(mid-from)*rdt,inters),
+                     seq.frames[i].interpolate(seq.frames[i-1],0.5f,inters),tolerance))
+            return false;
+    }
 
-    if(time_diff==0)
-        return it_next->second.value;
+    return true;
+}
+
+template<typename t_track> void reduce_track(t_track &seq,const nya_math::bezier *inters,float tolerance)
+{
+    const size_t count=seq.times.size();
+    if(count<2 || !(tolerance>0.0f))
+        return;
+
+    const size_t max_segment_frames=256;
+    std::vector<size_t> keep(1,0);
+    for(size_t a=0,b=2;b<count;++b)
+    {
+        if(b-a<=max_segment_frames && is_reducible(seq,a,b,inters,tolerance))
+            continue;
+
+        a=b-1;
+        keep.push_back(a);
+    }
+
+    keep.push_back(count-1);
 
-    return it_next->second.interpolate(it->second,float(time-it->first)/time_diff);
+    //constant track
+    if(keep.size()==2 && is_reducible(seq,0,count-1,inters,tolerance)
+       && is_close(seq.frames[0].value,seq.frames[count-1].value,tolerance))
+        keep.erase(keep.begin());
+
+    if(keep.size()==count)
+        return;
+
+    t_track reduced;
+    reduced.times.resize(keep.size());
+    reduced.frames.resize(keep.size());
+    for(size_t i=0;i<keep.size();++i)
+    {
+        reduced.times[i]=seq.times[keep[i]];
+        reduced.frames[i]=seq.frames[keep[i]];
+    }
+
+    std::swap(seq.times,reduced.times);
+    std::swap(seq.frames,reduced.frames);
 }
 
+template<typename t_track> int get_frames_count(const std::vector<t_track> &tracks)
+{
+    int count=0;
+    for(size_t i=0;i<tracks.size();++i)
+        count+=(int)tracks[i].times.size();
+
+    return count;
+}
+
+nya_render::animation::rot_interpolation_mode default_rot_interpolation=nya_render::animation::rot_interpolation_slerp;
+
+inline bool is_slerp_fast(nya_render::animation::rot_interpolation_mode mode)
+{
+    return (mode==nya_render::animation::rot_interpolation_default?default_rot_interpolation:mode)==nya_render::animation::rot_interpolation_slerp_fast;
+}
 
 }
 
@@ -96,27 +326,87 @@ int animation::get_bone_idx(const char *name) const { return get_idx(name,m_bone
 
 nya_math::vec3 animation::get_bone_pos(int idx,unsigned int time,bool looped) const
 {
-    return get_value<nya_math::vec3,pos_sequence,pos_frame>(idx,time,looped,m_pos_sequences,m_duration);
+    return get_value<nya_math::vec3,pos_sequence,pos_frame>(idx,time,looped,m_pos_sequences,m_duration,0,get_interpolations());
+}
+
+nya_math::vec3 animation::get_bone_pos(int idx,unsigned int time,bool looped,cursor &c) const
+{
+    return get_value<nya_math::vec3,pos_sequence,pos_frame>(idx,time,looped,m_pos_sequences,m_duration,&c.pos,get_interpolations());
 }
 
 nya_math::quat animation::get_bone_rot(int idx,unsigned int time,bool looped) const
 {
-    return get_value<nya_math::quat,rot_sequence,rot_frame>(idx,time,looped,m_rot_sequences,m_duration);
+    const bool fast=is_slerp_fast(m_rot_interpolation);
+    return get_rot_value(idx,time,looped,m_rot_sequences,m_duration,0,get_interpolations(),fast);
 }
 
-nya_math::vec3 animation::pos_frame::interpolate(const pos_frame &prev,float k) const
+nya_math::quat animation::get_bone_rot(int idx,unsigned int time,bool looped,cursor &c) const
 {
-    return prev.value+nya_math::vec3(inter.x.get(k)*(value.x-prev.value.x),
-                                     inter.y.get(k)*(value.y-prev.value.y),
-                                     inter.z.get(k)*(value.z-prev.value.z));
+    const bool fast=is_slerp_fast(m_rot_interpolation);
+    return get_rot_value(idx,time,looped,m_rot_sequences,m_duration,&c.rot,get_interpolations(),fast);
 }
 
-nya_math::quat animation::rot_frame::interpolate(const rot_frame &prev,float k) const
+void animation::sample_pose(unsigned int time,bool looped,const int *bones_map,int count,nya_math::vec3 *pos,nya_math::quat *rot) const
 {
-    return nya_math::quat::slerp(prev.value,value,inter.get(k));
+    if(!bones_map || !pos || !rot)
+        return;
+
+    if(is_baked())
+    {
+        sample_baked(wrap_time(time,looped,m_duration),bones_map,count,pos,rot);
+        return;
+    }
+
+    const bool fast=is_slerp_fast(m_rot_interpolation);
+    ::sample_pose(m_pos_sequences,m_rot_sequences,wrap_time(time,looped,m_duration),bones_map,count,pos,rot,get_interpolations(),fast,0,0);
 }
 
-float animation::curve_frame::interpolate(const curve_frame &prev,float k) const { return prev.value+k*(value-prev.value); }
+void animation::sample_pose(unsigned int time,bool looped,const int *bones_map,int count,nya_math::vec3 *pos,nya_math::quat *rot,cursor &c) const
+{
+    if(!bones_map || !pos || !rot)
+        return;
+
+    if(is_baked())
+    {
+        sample_baked(wrap_time(time,looped,m_duration),bones_map,count,pos,rot);
+        return;
+    }
+
+    if(c.pos.size()<m_pos_sequences.size())
+        c.pos.resize(m_pos_sequences.size(),0);
+    if(c.rot.size()<m_rot_sequences.size())
+        c.rot.resize(m_rot_sequences.size(),0);
+
+    unsigned int *pos_hints=c.pos.empty()?0:&c.pos[0];
+    unsigned int *rot_hints=c.rot.empty()?0:&c.rot[0];
+    const bool fast=is_slerp_fast(m_rot_interpolation);
+    ::sample_pose(m_pos_sequences,m_rot_sequences,wrap_time(time,looped,m_duration),bones_map,count,pos,rot,get_interpolations(),fast,pos_hints,rot_hints);
+}
+
+void animation::set_default_rot_interpolation(rot_interpolation_mode mode)
+{
+    default_rot_interpolation=mode==rot_interpolation_default?rot_interpolation_slerp:mode;
+}
+
+animation::rot_interpolation_mode animation::get_default_rot_interpolation() { return default_rot_interpolation; }
+
+nya_math::vec3 animation::pos_frame::interpolate(const pos_frame &prev,float k,const nya_math::bezier *inters) const
+{
+    return prev.value+nya_math::vec3((inter[0]?inters[inter[0]-1].get(k):k)*(value.x-prev.value.x),
+                                     (inter[1]?inters[inter[1]-1].get(k):k)*(value.y-prev.value.y),
+                                     (inter[2]?inters[inter[2]-1].get(k):k)*(value.z-prev.value.z));
+}
+
+nya_math::quat animation::rot_frame::interpolate(const rot_frame &prev,float k,const nya_math::bezier *inters,bool fast) const
+{
+    const float t=inter?inters[inter-1].get(k):k;
+    if(fast)
+        return nya_math::quat::slerp_fast(prev.value,value,t);
+
+    return nya_math::quat::slerp(prev.value,value,t);
+}
+
+float animation::curve_frame::interpolate(const curve_frame &prev,float k,const nya_math::bezier *) const { return prev.value+k*(value-prev.value); }
 
 const char *animation::get_bone_name(int idx) const
 {
@@ -130,7 +420,12 @@ int animation::get_curve_idx(const char *name) const { return get_idx(name,m_cur
 
 float animation::get_curve(int idx,unsigned int time,bool looped) const
 {
-    return get_value<float,curve_sequence,curve_frame>(idx,time,looped,m_curves,m_duration);
+    return get_value<float,curve_sequence,curve_frame>(idx,time,looped,m_curves,m_duration,0,0);
+}
+
+float animation::get_curve(int idx,unsigned int time,bool looped,cursor &c) const
+{
+    return get_value<float,curve_sequence,curve_frame>(idx,time,looped,m_curves,m_duration,&c.curves,0);
 }
 
 const char *animation::get_curve_name(int idx) const
@@ -143,6 +438,7 @@ const char *animation::get_curve_name(int idx) const
 
 int animation::add_bone(const char *name)
 {
+    clear_bake();
     const int idx=add_bone_curve(name,m_bones_map,m_pos_sequences,m_bone_names);
     if(idx>=int(m_rot_sequences.size()))
         m_rot_sequences.resize(idx+1);
@@ -155,9 +451,13 @@ void animation::add_bone_pos_frame(int bone_idx,unsigned int time,const nya_math
     if(bone_idx<0 || bone_idx>=(int)m_pos_sequences.size())
         return;
 
+    clear_bake();
+
     pos_frame pf;
     pf.value=pos;
-    pf.inter=interpolation;
+    pf.inter[0]=add_interpolation(interpolation.x);
+    pf.inter[1]=add_interpolation(interpolation.y);
+    pf.inter[2]=add_interpolation(interpolation.z);
     add_frame(m_pos_sequences[bone_idx],pf,time,m_duration);
 }
 
@@ -166,9 +466,11 @@ void animation::add_bone_rot_frame(int bone_idx,unsigned int time,const nya_math
     if(bone_idx<0 || bone_idx>=(int)m_rot_sequences.size())
         return;
 
+    clear_bake();
+
     rot_frame rf;
     rf.value=rot;
-    rf.inter=interpolation;
+    rf.inter=add_interpolation(interpolation);
     add_frame(m_rot_sequences[bone_idx],rf,time,m_duration);
 }
 
@@ -184,4 +486,161 @@ void animation::add_curve_frame(int idx,unsigned int time,float value)
     add_frame(m_curves[idx],f,time,m_duration);
 }
 
+void animation::reduce_frames(float pos_tolerance,float rot_tolerance,float curve_tolerance)
+{
+    clear_bake();
+    for(size_t i=0;i<m_pos_sequences.size();++i)
+        reduce_track(m_pos_sequences[i],get_interpolations(),pos_tolerance);
+    for(size_t i=0;i<m_rot_sequences.size();++i)
+        reduce_track(m_rot_sequences[i],get_interpolations(),rot_tolerance);
+    for(size_t i=0;i<m_curves.size();++i)
+        reduce_track(m_curves[i],0,curve_tolerance);
+}
+
+int animation::get_frames_count() const
+{
+    return ::get_frames_count(m_pos_sequences)+::get_frames_count(m_rot_sequences)+::get_frames_count(m_curves);
+}
+
+unsigned int animation::add_interpolation(const nya_math::bezier &b)
+{
+    if(b.is_linear())
+        return 0;
+
+    const unsigned int hash=b.get_hash();
+    typedef std::multimap<unsigned int,unsigned int>::const_iterator iterator;
+    for(iterator it=m_interpolations_map.lower_bound(hash);it!=m_interpolations_map.end() && it->first==hash;++it)
+    {
+        if(m_interpolations[it->second-1]==b)
+            return it->second;
+    }
+
+    m_interpolations.push_back(b);
+    const unsigned int idx=(unsigned int)m_interpolations.size();
+    m_interpolations_map.insert(std::make_pair(hash,idx));
+    return idx;
+}
+
+void animation::bake(unsigned int frame_time)
+{
+    clear_bake();
+
+    const int bones_count=get_bones_count();
+    if(!frame_time || !bones_count)
+        return;
+
+    const int frames_count=int((m_duration+frame_time-1)/frame_time)+1;
+    std::vector<nya_math::vec3> pos(size_t(frames_count)*bones_count);
+    std::vector<nya_math::quat> rot(pos.size());
+    std::vector<int> bones_map(bones_count);
+    for(int i=0;i<bones_count;++i)
+        bones_map[i]=i;
+
+    cursor c;
+    for(int i=0;i<frames_count;++i)
+    {
+        const unsigned int time=std::min(i*frame_time,m_duration);
+        sample_pose(time,false,&bones_map[0],bones_count,&pos[i*bones_count],&rot[i*bones_count],c);
+    }
+
+    m_baked_pos_min.resize(bones_count);
+    m_baked_pos_scale.resize(bones_count);
+    for(int j=0;j<bones_count;++j)
+    {
+        nya_math::vec3 min=pos[j],max=pos[j];
+        for(int i=1;i<frames_count;++i)
+        {
+            min=nya_math::vec3::min(min,pos[i*bones_count+j]);
+            max=nya_math::vec3::max(max,pos[i*bones_count+j]);
+        }
+
+        m_baked_pos_min[j]=min;
+        m_baked_pos_scale[j]=(max-min)/65535.0f;
+    }
+
+    m_baked.resize(pos.size());
+    for(int i=0;i<frames_count;++i)
+    {
+        for(int j=0;j<bones_count;++j)
+        {
+            const size_t idx=size_t(i)*bones_count+j;
+            baked_bone &b=m_baked[idx];
+
+            //same hemisphere as the previous frame, for lerp
+            nya_math::quat q=rot[idx].normalize();
+            if(i>0 && q.v.dot(rot[idx-bones_count].v)+q.w*rot[idx-bones_count].w<0.0f)
+                q.v= -q.v,q.w= -q.w;
+            rot[idx]=q;
+
+            const float c[4]={q.v.x,q.v.y,q.v.z,q.w};
+            for(int k=0;k<4;++k)
+                b.rot[k]=short(floorf(nya_math::clamp(c[k],-1.0f,1.0f)*32767.0f+0.5f));
+
+            const nya_math::vec3 p=pos[idx]-m_baked_pos_min[j],&scale=m_baked_pos_scale[j];
+            const float d[3]={p.x,p.y,p.z},s[3]={scale.x,scale.y,scale.z};
+            for(int k=0;k<3;++k)
+                b.pos[k]=(unsigned short)(s[k]>0.0f?nya_math::min(floorf(d[k]/s[k]+0.5f),65535.0f):0.0f);
+        }
+    }
+
+    m_bake_frame_time=frame_time;
+    m_baked_frames_count=frames_count;
+}
+
+void animation::clear_bake()
+{
+    if(m_baked.empty())
+        return;
+
+    std::vector<baked_bone>().swap(m_baked);
+    std::vector<nya_math::vec3>().swap(m_baked_pos_min);
+    std::vector<nya_math::vec3>().swap(m_baked_pos_scale);
+    m_bake_frame_time=0;
+    m_baked_frames_count=0;
+}
+
+size_t animation::get_baked_size() const
+{
+    return m_baked.size()*sizeof(baked_bone)+(m_baked_pos_min.size()+m_baked_pos_scale.size())*sizeof(nya_math::vec3);
+}
+
+void animation::sample_baked(unsigned int time,const int *bones_map,int count,nya_math::vec3 *pos,nya_math::quat *rot) const
+{
+    const int bones_count=(int)m_baked_pos_min.size();
+    int frame=int(time/m_bake_frame_time);
+    float k=0.0f;
+    if(frame>=m_baked_frames_count-1)
+        frame=m_baked_frames_count-1;
+    else
+    {
+        const unsigned int from=frame*m_bake_frame_time,to=std::min(from+m_bake_frame_time,m_duration);
+        if(to>from)
+            k=float(time-from)/(to-from);
+    }
+
+    const baked_bone *prev=&m_baked[size_t(frame)*bones_count];
+    const baked_bone *next=k>0.0f?prev+bones_count:prev;
+    const float rs=(1.0f-k)/32767.0f,rn=k/32767.0f;
+    for(int i=0;i<count;++i)
+    {
+        const int idx=bones_map[i];
+        if(idx<0 || idx>=bones_count)
+            continue;
+
+        const baked_bone &a=prev[idx],&b=next[idx];
+        const nya_math::vec3 &s=m_baked_pos_scale[idx];
+        const float ka=1.0f-k;
+        pos[i]=m_baked_pos_min[idx]+nya_math::vec3(s.x*(a.pos[0]*ka+b.pos[0]*k),
+                                                    s.y*(a.pos[1]*ka+b.pos[1]*k),
+                                                    s.z*(a.pos[2]*ka+b.pos[2]*k));
+
+        nya_math::quat &q=rot[i];
+        q.v.x=a.rot[0]*rs+b.rot[0]*rn;
+        q.v.y=a.rot[1]*rs+b.rot[1]*rn;
+        q.v.z=a.rot[2]*rs+b.rot[2]*rn;
+        q.w=a.rot[3]*rs+b.rot[3]*rn;
+        q.normalize();
+    }
+}
+
 }
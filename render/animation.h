@@ -5,9 +5,10 @@
 #include "math/vector.h"
 #include "math/quaternion.h"
 #include "math/bezier.h"
+#include "memory/hash_index.h"
 #include <vector>
-#include <map>
 #include <string>
+#include <map>
 
 namespace nya_render
 {
@@ -27,6 +28,41 @@ public:
     int get_cuves_count() const { return (int)m_curves.size(); }
     const char *get_curve_name(int idx) const;
 
+public:
+    //last sampled frame per track, makes sequential playback O(1)
+    //one per consumer, stored frames are only hints and are validated on use
+    struct cursor
+    {
+        std::vector<unsigned int> pos;
+        std::vector<unsigned int> rot;
+        std::vector<unsigned int> curves;
+    };
+
+    nya_math::vec3 get_bone_pos(int idx,unsigned int time,bool looped,cursor &c) const;
+    nya_math::quat get_bone_rot(int idx,unsigned int time,bool looped,cursor &c) const;
+    float get_curve(int idx,unsigned int time,bool looped,cursor &c) const;
+
+public:
+    //samples bone bones_map[i] to pos[i] and rot[i] for i<count, time is wrapped once for all bones
+    //elements with bones_map[i]<0 are left unchanged
+    void sample_pose(unsigned int time,bool looped,const int *bones_map,int count,nya_math::vec3 *pos,nya_math::quat *rot) const;
+    void sample_pose(unsigned int time,bool looped,const int *bones_map,int count,nya_math::vec3 *pos,nya_math::quat *rot,cursor &c) const;
+
+public:
+    enum rot_interpolation_mode
+    {
+        rot_interpolation_default, //use global default
+        rot_interpolation_slerp,
+        rot_interpolation_slerp_fast //see nya_math::quat::slerp_fast for error bounds
+    };
+
+    void set_rot_interpolation(rot_interpolation_mode mode) { m_rot_interpolation=mode; }
+    rot_interpolation_mode get_rot_interpolation() const { return m_rot_interpolation; }
+
+    //for animations with rot_interpolation_default mode, rot_interpolation_slerp if not set
+    static void set_default_rot_interpolation(rot_interpolation_mode mode);
+    static rot_interpolation_mode get_default_rot_interpolation();
+
 public:
     int add_bone(const char *name); //create or return existing
     void add_bone_pos_frame(int bone_idx,unsigned int time,const nya_math::vec3 &pos) { pos_interpolation i; add_bone_pos_frame(bone_idx,time,pos,i); }
@@ -46,26 +82,57 @@ public:
     int add_curve(const char *name); //create or return existing
     void add_curve_frame(int idx,unsigned int time,float value);
 
+public:
+    //removes frames which could be interpolated from neighbours within tolerance,
+    //pos tolerance is distance, rot tolerance is angle in radians, 0 keeps the track
+    void reduce_frames(float pos_tolerance,float rot_tolerance,float curve_tolerance);
+
+    int get_frames_count() const;
+    int get_interpolations_count() const { return (int)m_interpolations.size(); }
+
+public:
+    //samples all bones every frame_time ms into a quantized pose table,
+    //sample_pose then lerps between baked poses instead of interpolating frames
+    //adding frames clears the bake
+    void bake(unsigned int frame_time);
+    void clear_bake();
+    bool is_baked() const { return !m_baked.empty(); }
+    size_t get_baked_size() const; //in bytes
+
 public:
     void release() { *this=animation(); }
 
 public:
-    animation(): m_duration(0) {}
+    animation(): m_duration(0),m_rot_interpolation(rot_interpolation_default),m_bake_frame_time(0),m_baked_frames_count(0) {}
 
 private:
-    template<typename t,typename interpolation>struct frame
+    //interpolation curves are shared, frames store 1-based idx in m_interpolations, 0 is linear
+    struct pos_frame
     {
-        t value;
-        interpolation inter;
+        nya_math::vec3 value;
+        unsigned int inter[3];
+        nya_math::vec3 interpolate(const pos_frame &prev,float k,const nya_math::bezier *inters) const;
     };
 
-    struct pos_frame: public frame<nya_math::vec3,pos_interpolation> { nya_math::vec3 interpolate(const pos_frame &prev,float k) const; };
-    struct rot_frame: public frame<nya_math::quat,nya_math::bezier> { nya_math::quat interpolate(const rot_frame &prev,float k) const; };
+    struct rot_frame
+    {
+        nya_math::quat value;
+        unsigned int inter;
+        nya_math::quat interpolate(const rot_frame &prev,float k,const nya_math::bezier *inters,bool fast=false) const;
+    };
+
+    //frames sorted by time
+    template<typename t_frame> struct track
+    {
+        typedef t_frame frame_type;
+        std::vector<unsigned int> times;
+        std::vector<t_frame> frames;
+    };
 
-    typedef std::map<unsigned int,pos_frame> pos_sequence;
-    typedef std::map<unsigned int,rot_frame> rot_sequence;
+    typedef track<pos_frame> pos_sequence;
+    typedef track<rot_frame> rot_sequence;
 
-    typedef std::map<std::string,unsigned int> index_map;
+    typedef nya_memory::hash_index index_map;
     index_map m_bones_map;
     std::vector<std::string> m_bone_names;
     std::vector<pos_sequence> m_pos_sequences;
@@ -74,16 +141,38 @@ private:
     struct curve_frame
     {
         float value;
-        float interpolate(const curve_frame &prev,float k) const;
+        float interpolate(const curve_frame &prev,float k,const nya_math::bezier *inters) const; //always linear
     };
 
-    typedef std::map<unsigned int,curve_frame> curve_sequence;
+    typedef track<curve_frame> curve_sequence;
 
     index_map m_curves_map;
     std::vector<curve_sequence> m_curves;
     std::vector<std::string> m_curve_names;
 
+    unsigned int add_interpolation(const nya_math::bezier &b);
+    const nya_math::bezier *get_interpolations() const { return m_interpolations.empty()?0:&m_interpolations[0]; }
+
+    std::vector<nya_math::bezier> m_interpolations;
+    std::multimap<unsigned int,unsigned int> m_interpolations_map; //hash to idx
+
     unsigned int m_duration;
+    rot_interpolation_mode m_rot_interpolation;
+
+    //rot components and pos in track range, quantized to 16 bits
+    struct baked_bone
+    {
+        short rot[4];
+        unsigned short pos[3];
+    };
+
+    void sample_baked(unsigned int time,const int *bones_map,int count,nya_math::vec3 *pos,nya_math::quat *rot) const;
+
+    std::vector<baked_bone> m_baked; //frames_count*bones_count
+    std::vector<nya_math::vec3> m_baked_pos_min; //by bone
+    std::vector<nya_math::vec3> m_baked_pos_scale;
+    unsigned int m_bake_frame_time;
+    int m_baked_frames_count;
 };
 
 }
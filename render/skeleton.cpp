@@ -1,191 +1,393 @@
 //https://code.google.com/p/nya-engine/
 
 #include "skeleton.h"
+#include "statistics.h"
+#include "math/batch.h"
+#include "math/constants.h"
+#include "memory/tmp_buffer.h"
 
 namespace nya_render
 {
 
+namespace
+{
+
+const float ik_eps=0.0001f;
+const float ik_stall=0.999f; //iteration should reduce effector error at least by that
+bool analytic_ik=true;
+unsigned int last_version=0;
+unsigned int last_definition_id=0;
+
+inline float wrap_angle(float a)
+{
+    const float pi=nya_math::constants::pi;
+    while(a>pi)
+        a-=pi*2.0f;
+    while(a< -pi)
+        a+=pi*2.0f;
+    return a;
+}
+
+}
+
+int skeleton_definition::get_bone_idx(const char *name) const
+{
+    if(!name)
+        return -1;
+
+    return m_bones_map.find(name);
+}
+
+int skeleton_definition::get_bone_parent_idx(int idx) const
+{
+    if(idx<0 || idx>=(int)m_bones.size())
+        return -1;
+
+    return m_parent[idx];
+}
+
+const char *skeleton_definition::get_bone_name(int idx) const
+{
+    if(idx<0 || idx>=(int)m_bones.size())
+        return 0;
+
+    return m_bones[idx].name.c_str();
+}
+
+nya_math::vec3 skeleton_definition::get_bone_original_pos(int idx) const
+{
+    if(idx<0 || idx>=(int)m_bones.size())
+        return nya_math::vec3();
+
+    return m_bones[idx].pos_org;
+}
+
+nya_math::quat skeleton_definition::get_bone_original_rot(int idx) const
+{
+    if(idx<0 || idx>=(int)m_rot_org.size())
+        return nya_math::quat();
+
+    return m_rot_org[idx];
+}
+
+void skeleton_definition::update_order() const
+{
+    const int count=(int)m_bones.size();
+    if((int)m_order.size()==count)
+        return;
+
+    //childs lists in idx order
+    std::vector<int> first(count+1,0),childs(count);
+    for(int i=0;i<count;++i)
+    {
+        if(m_parent[i]>=0)
+            ++first[m_parent[i]+1];
+    }
+
+    for(int i=0;i<count;++i)
+        first[i+1]+=first[i];
+
+    std::vector<int> fill(first.begin(),first.end()-1);
+    for(int i=0;i<count;++i)
+    {
+        if(m_parent[i]>=0)
+            childs[fill[m_parent[i]]++]=i;
+    }
+
+    m_order.clear();
+    m_order.reserve(count);
+    m_order_idx.resize(count);
+    m_subtree_end.resize(count);
+
+    std::vector<int> stack;
+    for(int i=0;i<count;++i)
+    {
+        if(m_parent[i]>=0)
+            continue;
+
+        stack.push_back(i);
+        while(!stack.empty())
+        {
+            const int idx=stack.back();
+            stack.pop_back();
+            if(idx<0)
+            {
+                m_subtree_end[-idx-1]=(int)m_order.size();
+                continue;
+            }
+
+            m_order_idx[idx]=(int)m_order.size();
+            m_order.push_back(idx);
+
+            //subtree end marker, then childs in reverse so that they are popped in idx order
+            stack.push_back(-idx-1);
+            for(int j=first[idx+1]-1;j>=first[idx];--j)
+                stack.push_back(childs[j]);
+        }
+    }
+
+    //breadth-first, depth by depth
+    m_depth_order.clear();
+    m_depth_order.reserve(count);
+    m_depth_start.clear();
+    for(int i=0;i<count;++i)
+    {
+        if(m_parent[i]<0)
+            m_depth_order.push_back(i);
+    }
+
+    for(int from=0;from<(int)m_depth_order.size();)
+    {
+        m_depth_start.push_back(from);
+        const int to=(int)m_depth_order.size();
+        for(int i=from;i<to;++i)
+        {
+            const int idx=m_depth_order[i];
+            m_depth_order.insert(m_depth_order.end(),childs.begin()+first[idx],childs.begin()+first[idx+1]);
+        }
+
+        from=to;
+    }
+
+    m_depth_start.push_back(count);
+
+    for(int i=0;i<(int)m_iks.size();++i)
+    {
+        const ik &k=m_iks[i];
+        k.solver=ik_ccd;
+        if(k.links.empty() || !is_ancestor(k.links[0].idx,k.eff))
+            continue;
+
+        bool chain=true;
+        for(int j=1;j<(int)k.links.size() && chain;++j)
+            chain=is_ancestor(k.links[j].idx,k.links[j-1].idx);
+
+        if(!chain)
+            continue;
+
+        k.solver=ik_ccd_chain;
+        if(k.links.size()==2 && m_parent[k.eff]==k.links[0].idx && m_parent[k.links[0].idx]==k.links[1].idx
+           && k.links[0].limit && !k.links[1].limit)
+            k.solver=ik_two_bone;
+    }
+}
+
+bool skeleton_definition::is_ancestor(int idx,int child) const
+{
+    const int count=(int)m_bones.size();
+    if(idx<0 || idx>=count || child<0 || child>=count || idx==child)
+        return false;
+
+    return m_order_idx[idx]<m_order_idx[child] && m_order_idx[child]<m_subtree_end[idx];
+}
+
+const skeleton_definition &skeleton::get_definition() const
+{
+    if(!m_def.is_valid())
+    {
+        static skeleton_definition empty;
+        return empty;
+    }
+
+    return *m_def.operator->();
+}
+
+skeleton_definition &skeleton::get_definition_w()
+{
+    if(!m_def.is_valid())
+        m_def=nya_memory::shared_ptr<skeleton_definition>(skeleton_definition());
+    else if(m_def.get_ref_count()>1)
+    {
+        const nya_memory::shared_ptr<skeleton_definition> shared=m_def;
+        m_def=nya_memory::shared_ptr<skeleton_definition>(*shared.operator->());
+    }
+
+    skeleton_definition &d=*m_def.operator->();
+    d.m_order.clear();
+    d.m_id=++last_definition_id;
+    if(!d.m_id)
+        d.m_id=++last_definition_id;
+
+    return d;
+}
+
 int skeleton::add_bone(const char *name,const nya_math::vec3 &pos,const nya_math::quat &rot,int parent,bool allow_doublicate)
 {
     if(!name)
         return -1;
 
-    if(parent>=(int)m_bones.size())
+    if(parent>=get_bones_count())
         return -1;
 
-    int bone_idx=(int)m_bones.size();
-    std::pair<index_map::iterator,bool> ret=
-            m_bones_map.insert (std::pair<std::string,int>(name,bone_idx));
+    if(!allow_doublicate)
+    {
+        const int idx=get_bone_idx(name);
+        if(idx>=0)
+            return idx;
+    }
 
-    if(!allow_doublicate && ret.second==false)
-        return ret.first->second;
+    skeleton_definition &d=get_definition_w();
 
-    m_bones.resize(bone_idx+1);
-    m_pos_tr.resize(bone_idx+1);
-    m_rot_tr.resize(bone_idx+1);
+    const int bone_idx=(int)d.m_bones.size();
+    d.m_bones_map.insert(name,bone_idx);
 
-    if(!m_rot_org.empty() || rot.v.length_sq()>0.001f)
-        m_rot_org.resize(m_bones.size());
+    d.m_bones.resize(bone_idx+1);
+    d.m_parent.resize(bone_idx+1);
+    d.m_offset.resize(bone_idx+1);
+    m_pose.pos.resize(bone_idx+1);
+    m_pose.rot.resize(bone_idx+1);
+    m_pose.pos_tr.resize(bone_idx+1);
+    m_pose.rot_tr.resize(bone_idx+1);
+    m_pose.dirty.resize(bone_idx+1,1);
 
-    bone &b=m_bones[bone_idx];
-    b.parent=parent;
-    b.name.assign(name);
+    if(!d.m_rot_org.empty() || rot.v.length_sq()>0.001f)
+    {
+        d.m_rot_org.resize(d.m_bones.size());
+        d.m_rot_offset.resize(d.m_bones.size());
+    }
 
+    skeleton_definition::bone &b=d.m_bones[bone_idx];
+    b.name.assign(name);
     b.pos_org=pos;
+
+    d.m_parent[bone_idx]=parent;
+    nya_math::vec3 &offset=d.m_offset[bone_idx];
     if(parent>=0)
-    {
-        const bone &p=m_bones[parent];
-        b.offset=pos-p.pos_org;
-    }
+        offset=pos-d.m_bones[parent].pos_org;
     else
-        b.offset=pos;
+        offset=pos;
 
-    if(!m_rot_org.empty())
+    if(!d.m_rot_org.empty())
     {
-        m_rot_org[bone_idx].rot_org=rot;
+        d.m_rot_org[bone_idx]=rot;
         if(parent>=0)
         {
-            nya_math::quat pq=m_rot_org[parent].rot_org;
+            nya_math::quat pq=d.m_rot_org[parent];
             pq.v= -pq.v;
-            m_rot_org[bone_idx].offset=pq*m_rot_org[bone_idx].rot_org;
-            b.offset=pq.rotate(b.offset);
+            d.m_rot_offset[bone_idx]=pq*d.m_rot_org[bone_idx];
+            offset=pq.rotate(offset);
         }
         else
-            m_rot_org[bone_idx].offset=m_rot_org[bone_idx].rot_org;
+            d.m_rot_offset[bone_idx]=d.m_rot_org[bone_idx];
     }
 
     update_bone(bone_idx);
+    m_version=++last_version;
 
     return bone_idx;
 }
 
 void skeleton::update_bone(int idx,const nya_math::vec3 &pos,const nya_math::quat &rot)
 {
-    const bone &b=m_bones[idx];
-    if(b.parent<0)
+    const skeleton_definition &d=*m_def.operator->();
+    const int parent=d.m_parent[idx];
+    if(parent<0)
     {
-        m_pos_tr[idx]=pos+b.offset;
-        if(m_rot_org.empty())
-            m_rot_tr[idx]=rot;
+        m_pose.pos_tr[idx]=pos+d.m_offset[idx];
+        if(d.m_rot_offset.empty())
+            m_pose.rot_tr[idx]=rot;
         else
-            m_rot_tr[idx]=m_rot_org[idx].offset*rot;
+            m_pose.rot_tr[idx]=d.m_rot_offset[idx]*rot;
 
         return;
     }
 
-    m_pos_tr[idx]=m_pos_tr[b.parent] + m_rot_tr[b.parent].rotate(pos+b.offset);
+    m_pose.pos_tr[idx]=m_pose.pos_tr[parent] + m_pose.rot_tr[parent].rotate(pos+d.m_offset[idx]);
 
-    if(m_rot_org.empty())
-        m_rot_tr[idx]=m_rot_tr[b.parent]*rot;
+    if(d.m_rot_offset.empty())
+        m_pose.rot_tr[idx]=m_pose.rot_tr[parent]*rot;
     else
-        m_rot_tr[idx]=m_rot_tr[b.parent]*(m_rot_org[idx].offset*rot);
+        m_pose.rot_tr[idx]=m_pose.rot_tr[parent]*(d.m_rot_offset[idx]*rot);
 }
 
 int skeleton::get_bone_idx(const char *name) const
 {
-    if(!name)
-        return -1;
-
-    index_map::const_iterator it=m_bones_map.find(name);
-    if(it==m_bones_map.end())
-        return -1;
-
-    return (int)it->second;
+    return get_definition().get_bone_idx(name);
 }
 
 int skeleton::get_bone_parent_idx(int idx) const
 {
-    if(idx<0 || idx>=(int)m_bones.size())
-        return -1;
-
-    return m_bones[idx].parent;
+    return get_definition().get_bone_parent_idx(idx);
 }
 
 const char *skeleton::get_bone_name(int idx) const
 {
-    if(idx<0 || idx>=(int)m_bones.size())
-        return 0;
-
-    return m_bones[idx].name.c_str();
+    return get_definition().get_bone_name(idx);
 }
 
 nya_math::vec3 skeleton::get_bone_pos(int idx) const
 {
-    if(idx<0 || idx>=(int)m_bones.size())
+    if(idx<0 || idx>=get_bones_count())
         return nya_math::vec3();
 
-    return m_pos_tr[idx];
+    return m_pose.pos_tr[idx];
 }
 
 nya_math::quat skeleton::get_bone_rot(int idx) const
 {
-    if(idx<0 || idx>=(int)m_bones.size())
+    if(idx<0 || idx>=get_bones_count())
         return nya_math::quat();
 
-    return m_rot_tr[idx];
+    return m_pose.rot_tr[idx];
 }
 
 nya_math::vec3 skeleton::get_bone_local_pos(int idx) const
 {
-    if(idx<0 || idx>=(int)m_bones.size())
+    if(idx<0 || idx>=get_bones_count())
         return nya_math::vec3();
 
-    return m_bones[idx].pos;
+    return m_pose.pos[idx];
 }
 
 nya_math::quat skeleton::get_bone_local_rot(int idx) const
 {
-    if(idx<0 || idx>=(int)m_bones.size())
+    if(idx<0 || idx>=get_bones_count())
         return nya_math::quat();
 
-    return m_bones[idx].rot;
+    return m_pose.rot[idx];
 }
 
 nya_math::vec3 skeleton::get_bone_original_pos(int idx) const
 {
-    if(idx<0 || idx>=(int)m_bones.size())
-        return nya_math::vec3();
-
-    return m_bones[idx].pos_org;
+    return get_definition().get_bone_original_pos(idx);
 }
 
 nya_math::quat skeleton::get_bone_original_rot(int idx) const
 {
-    if(idx<0 || idx>=(int)m_rot_org.size())
-        return nya_math::quat();
-
-    return m_rot_org[idx].rot_org;
+    return get_definition().get_bone_original_rot(idx);
 }
 
 int skeleton::add_ik(int target_bone_idx,int effect_bone_idx,int count,float fact,bool allow_invalid)
 {
-    if(target_bone_idx<0 || (!allow_invalid && target_bone_idx>=(int)m_bones.size()))
+    if(target_bone_idx<0 || (!allow_invalid && target_bone_idx>=get_bones_count()))
         return -1;
 
-    if(effect_bone_idx<0 || (!allow_invalid && effect_bone_idx>=(int)m_bones.size()))
+    if(effect_bone_idx<0 || (!allow_invalid && effect_bone_idx>=get_bones_count()))
         return -1;
 
-    int ik_idx=(int)m_iks.size();
-    m_iks.resize(ik_idx+1);
+    std::vector<skeleton_definition::ik> &iks=get_definition_w().m_iks;
+    int ik_idx=(int)iks.size();
+    iks.resize(ik_idx+1);
 
-    ik &k=m_iks[ik_idx];
+    skeleton_definition::ik &k=iks[ik_idx];
     k.target=target_bone_idx;
     k.eff=effect_bone_idx;
     k.count=count;
     k.fact=fact;
+    k.solver=skeleton_definition::ik_ccd;
 
     return ik_idx;
 }
 
 bool skeleton::add_ik_link(int ik_idx,int bone_idx,bool allow_invalid)
 {
-    if(ik_idx<0 || ik_idx>=(int)m_iks.size())
+    if(ik_idx<0 || ik_idx>=(int)get_definition().m_iks.size())
         return false;
 
-    if(bone_idx<0 || (!allow_invalid && bone_idx>=(int)m_bones.size()))
+    if(bone_idx<0 || (!allow_invalid && bone_idx>=get_bones_count()))
         return false;
 
-    ik &k=m_iks[ik_idx];
+    skeleton_definition::ik &k=get_definition_w().m_iks[ik_idx];
     k.links.resize(k.links.size()+1);
     k.links.back().idx=bone_idx;
     k.links.back().limit=false;
@@ -195,13 +397,13 @@ bool skeleton::add_ik_link(int ik_idx,int bone_idx,bool allow_invalid)
 
 bool skeleton::add_ik_link(int ik_idx,int bone_idx,float limit_from,float limit_to,bool allow_invalid)
 {
-    if(ik_idx<0 || ik_idx>=(int)m_iks.size())
+    if(ik_idx<0 || ik_idx>=(int)get_definition().m_iks.size())
         return false;
 
-    if(bone_idx<0 || (!allow_invalid && bone_idx>=(int)m_bones.size()))
+    if(bone_idx<0 || (!allow_invalid && bone_idx>=get_bones_count()))
         return false;
 
-    ik &k=m_iks[ik_idx];
+    skeleton_definition::ik &k=get_definition_w().m_iks[ik_idx];
     k.links.resize(k.links.size()+1);
     k.links.back().idx=bone_idx;
     k.links.back().limit=true;
@@ -213,153 +415,383 @@ bool skeleton::add_ik_link(int ik_idx,int bone_idx,float limit_from,float limit_
 
 bool skeleton::add_bound(int bone_idx,int target_bone_idx,float k,bool pos,bool rot,bool allow_invalid)
 {
-    if(bone_idx<0 || (!allow_invalid && bone_idx>=(int)m_bones.size()))
+    if(bone_idx<0 || (!allow_invalid && bone_idx>=get_bones_count()))
         return false;
 
-    if(target_bone_idx<0 || (!allow_invalid && target_bone_idx>=(int)m_bones.size()))
+    if(target_bone_idx<0 || (!allow_invalid && target_bone_idx>=get_bones_count()))
         return false;
 
     if(!pos && !rot)
         return false;
 
-    m_bounds.resize(m_bounds.size()+1);
-    m_bounds.back().idx=bone_idx;
-    m_bounds.back().target=target_bone_idx;
-    m_bounds.back().k=k;
-    m_bounds.back().pos=pos;
-    m_bounds.back().rot=rot;
+    std::vector<skeleton_definition::bound> &bounds=get_definition_w().m_bounds;
+    bounds.resize(bounds.size()+1);
+    bounds.back().idx=bone_idx;
+    bounds.back().target=target_bone_idx;
+    bounds.back().k=k;
+    bounds.back().pos=pos;
+    bounds.back().rot=rot;
 
     return true;
 }
 
 void skeleton::set_bone_transform(int bone_idx,const nya_math::vec3 &pos,const nya_math::quat &rot)
 {
-    if(bone_idx<0 || bone_idx>=(int)m_bones.size())
+    if(bone_idx<0 || bone_idx>=get_bones_count())
         return;
 
-    bone &b=m_bones[bone_idx];
-    b.pos=pos;
-    b.rot=rot;
+    nya_math::vec3 &p=m_pose.pos[bone_idx];
+    nya_math::quat &r=m_pose.rot[bone_idx];
+    if(p.x==pos.x && p.y==pos.y && p.z==pos.z &&
+       r.v.x==rot.v.x && r.v.y==rot.v.y && r.v.z==rot.v.z && r.w==rot.w)
+        return;
+
+    p=pos;
+    r=rot;
+    m_pose.dirty[bone_idx]=1;
 }
 
-void skeleton::update_bone_childs(int idx) //ToDo: better realisation
+void skeleton::update_bone_childs(int idx)
 {
-    for(int j=0;j<(int)m_bones.size();++j)
-    {
-        if(m_bones[j].parent==idx)
-        {
-            update_bone(j);
-            update_bone_childs(j);
-        }
-    }
+    const skeleton_definition &d=get_definition();
+    d.update_order();
+    for(int i=d.m_order_idx[idx]+1;i<d.m_subtree_end[idx];++i)
+        update_bone(d.m_order[i]);
 }
 
-void skeleton::update_ik(int idx)
+bool skeleton::update_ik_link(const skeleton_definition::ik &k,int link,const nya_math::vec3 &target,float fact,nya_math::vec3 &eff)
 {
-    const ik &k=m_iks[idx];
-    const nya_math::vec3 target_pos_org=m_pos_tr[k.target];
+    const skeleton_definition::ik_link &l=k.links[link];
+    const nya_math::quat lnk_rot_tr=m_pose.rot_tr[l.idx];
+    const nya_math::vec3 lnk_pos_tr=m_pose.pos_tr[l.idx];
 
-    for(int j=0;j<k.count;++j)
+    nya_math::vec3 target_pos=lnk_rot_tr.rotate_inv(target-lnk_pos_tr);
+    const nya_math::vec3 eff_local=lnk_rot_tr.rotate_inv(eff-lnk_pos_tr);
+    nya_math::vec3 eff_pos=eff_local;
+
+    const nya_math::vec3 diff=eff_pos-target_pos;
+    if(diff.length_sq()<ik_eps)
+        return false;
+
+    eff_pos.normalize();
+    target_pos.normalize();
+
+    float ang=acosf(eff_pos.dot(target_pos));
+    if(fabsf(ang)<ik_eps)
+        return false;
+
+    if(ang< -fact)
+        ang= -fact;
+    else if(ang>fact)
+        ang=fact;
+
+    nya_math::vec3 axis=nya_math::vec3::cross(eff_pos,target_pos);
+    const float axis_len=axis.length();
+    if(axis_len<0.001f)
+        return false;
+
+    axis*=(1.0f/axis_len);
+
+    nya_math::quat rot(axis,ang);
+
+    if(l.limit)
+        rot.limit_pitch(l.limit_from,l.limit_to);
+
+    rot.normalize();
+
+    nya_math::quat &lnk_rot=m_pose.rot[l.idx];
+    lnk_rot=lnk_rot*rot;
+    lnk_rot.normalize();
+
+    if(statistics::enabled())
+        ++statistics::get().ik_links_count;
+
+    if(k.solver==skeleton_definition::ik_ccd)
     {
-        for(int l=0;l<(int)k.links.size();++l)
-        {
-            const int lnk_idx=k.links[l].idx;
-            bone &lnk=m_bones[lnk_idx];
+        for(int m=link;m>=0;--m)
+            update_bone(k.links[m].idx);
+
+        update_bone(k.eff);
+        eff=m_pose.pos_tr[k.eff];
+        return true;
+    }
+
+    //links below aren't needed until the next iteration, only the effector is moved
+    m_pose.rot_tr[l.idx]=lnk_rot_tr*rot;
+    eff=lnk_pos_tr+m_pose.rot_tr[l.idx].rotate(eff_local);
+    return true;
+}
 
-            nya_math::vec3 target_pos=
-            m_rot_tr[lnk_idx].rotate_inv(target_pos_org-m_pos_tr[lnk_idx]);
+void skeleton::update_ik_chain(const skeleton_definition::ik &k)
+{
+    for(int m=(int)k.links.size()-1;m>=0;--m)
+        update_bone(k.links[m].idx);
 
-            nya_math::vec3 eff_pos=
-            m_rot_tr[lnk_idx].rotate_inv(m_pos_tr[k.eff]-m_pos_tr[lnk_idx]);
+    update_bone(k.eff);
+}
+
+bool skeleton::update_ik_two_bone(const skeleton_definition::ik &k,const nya_math::vec3 &target)
+{
+    const skeleton_definition::ik_link &knee=k.links[0];
+    const int hip=k.links[1].idx;
+
+    //knee bend makes hip to effector distance equal to hip to target distance,
+    //bend is a pitch rotation as in quat::limit_pitch: y,z components rotate around x in knee space
+    const nya_math::quat knee_rot_tr=m_pose.rot_tr[knee.idx];
+    const nya_math::vec3 u=knee_rot_tr.rotate_inv(m_pose.pos_tr[hip]-m_pose.pos_tr[knee.idx]);
+    const nya_math::vec3 v=knee_rot_tr.rotate_inv(m_pose.pos_tr[k.eff]-m_pose.pos_tr[knee.idx]);
+    const float ru=sqrtf(u.y*u.y+u.z*u.z),rv=sqrtf(v.y*v.y+v.z*v.z);
+    if(ru<0.001f || rv<0.001f)
+        return false;
 
-            const float eps=0.0001f;
+    const float dist_sq=(target-m_pose.pos_tr[hip]).length_sq();
+    const float c=(u.length_sq()+v.length_sq()-dist_sq-2.0f*u.x*v.x)/(2.0f*ru*rv);
+    const float a=acosf(c>1.0f?1.0f:(c< -1.0f? -1.0f:c));
+    const float base=atan2f(u.z,u.y)-atan2f(v.z,v.y);
 
-            const nya_math::vec3 diff=eff_pos-target_pos;
-            if(diff.length_sq()<eps)
-                return;
+    //the solution within limits, the closest limit otherwise
+    float pitch=0.0f,best=0.0f;
+    for(int i=0;i<2;++i)
+    {
+        float p=wrap_angle(i?base-a:base+a);
+        const float clamped=p<knee.limit_from?knee.limit_from:(p>knee.limit_to?knee.limit_to:p);
+        const float err=fabsf(p-clamped);
+        if(i && err>=best)
+            continue;
 
-            eff_pos.normalize();
-            target_pos.normalize();
+        pitch=clamped,best=err;
+    }
 
-            float ang=acosf(eff_pos.dot(target_pos));
-            if(fabsf(ang)<eps)
-                return;
+    nya_math::quat &knee_rot=m_pose.rot[knee.idx];
+    knee_rot=knee_rot*nya_math::quat(sinf(pitch*0.5f),0.0f,0.0f,cosf(pitch*0.5f));
+    knee_rot.normalize();
+    update_bone(knee.idx);
+    update_bone(k.eff);
 
-            if(ang< -k.fact)
-                ang= -k.fact;
-            else if(ang>k.fact)
-                ang=k.fact;
+    //swing hip to the target, the knee bend has already set the distance
+    nya_math::vec3 eff=m_pose.pos_tr[k.eff];
+    if(update_ik_link(k,1,target,nya_math::constants::pi,eff))
+        update_ik_chain(k);
 
-            nya_math::vec3 axis=nya_math::vec3::cross(eff_pos,target_pos);
-            const float axis_len=axis.length();
-            if(axis_len<0.001f)
-                return;
+    if(statistics::enabled())
+        ++statistics::get().ik_links_count;
 
-            axis*=(1.0f/axis_len);
+    return true;
+}
 
-            nya_math::quat rot(axis,ang);
+void skeleton::update_ik(int idx)
+{
+    const skeleton_definition::ik &k=get_definition().m_iks[idx];
+    if(k.links.empty() || k.count<=0)
+        return;
 
-            if(k.links[l].limit)
-                rot.limit_pitch(k.links[l].limit_from,k.links[l].limit_to);
+    if(statistics::enabled())
+        ++statistics::get().ik_count;
 
-            rot.normalize();
+    const nya_math::vec3 target=m_pose.pos_tr[k.target];
+    if(k.solver==skeleton_definition::ik_two_bone && analytic_ik && update_ik_two_bone(k,target))
+        return;
 
-            lnk.rot=lnk.rot*rot;
-            lnk.rot.normalize();
+    nya_math::vec3 eff=m_pose.pos_tr[k.eff];
+    float err=(eff-target).length_sq();
+    for(int j=0;j<k.count;++j)
+    {
+        for(int l=0;l<(int)k.links.size();++l)
+        {
+            if(update_ik_link(k,l,target,k.fact,eff))
+                continue;
 
-            for(int m=l;m>=0;--m)
-                update_bone(k.links[m].idx);
+            if(k.solver!=skeleton_definition::ik_ccd)
+                update_ik_chain(k);
+            return;
+        }
 
-            update_bone(k.eff);
+        if(k.solver!=skeleton_definition::ik_ccd)
+        {
+            update_ik_chain(k);
+            eff=m_pose.pos_tr[k.eff];
         }
+
+        //stalled, usually the target is out of reach or limited
+        const float prev_err=err;
+        err=(eff-target).length_sq();
+        if(err>=prev_err*ik_stall)
+            return;
     }
 }
 
+void skeleton::set_analytic_ik(bool enable) { analytic_ik=enable; }
+
 void skeleton::update()
 {
-    for(int i=0;i<(int)m_bones.size();++i)
-        update_bone(i);
+    const skeleton_definition &d=get_definition();
+    std::vector<char> &dirty=m_pose.dirty;
 
-    for(int i=0;i<(int)m_iks.size();++i)
+    //bones changed by iks and bounds are recalculated from their local transforms
+    for(int i=0;i<(int)d.m_iks.size();++i)
+    {
+        const skeleton_definition::ik &k=d.m_iks[i];
+        if(k.eff>=0 && k.eff<(int)dirty.size())
+            dirty[k.eff]=1;
+
+        for(int j=0;j<(int)k.links.size();++j)
+        {
+            if(k.links[j].idx<(int)dirty.size())
+                dirty[k.links[j].idx]=1;
+        }
+    }
+
+    for(int i=0;i<(int)d.m_bounds.size();++i)
+    {
+        if(d.m_bounds[i].target<(int)dirty.size())
+            dirty[d.m_bounds[i].target]=1;
+    }
+
+    //bones of the same depth are composed in batches, roots are only offset
+    d.update_order();
+    nya_memory::tmp_buffer_scoped buf(d.m_bones.size()*sizeof(int));
+    int *idx=(int *)buf.get_data();
+    for(int i=0;i+1<(int)d.m_depth_start.size();++i)
+    {
+        int count=0;
+        for(int j=d.m_depth_start[i];j<d.m_depth_start[i+1];++j)
+        {
+            const int b=d.m_depth_order[j];
+            const int parent=d.m_parent[b];
+            if(parent>=0 && dirty[parent])
+                dirty[b]=1;
+
+            if(dirty[b])
+                idx[count++]=b;
+        }
+
+        if(!i)
+        {
+            for(int j=0;j<count;++j)
+                update_bone(idx[j]);
+            continue;
+        }
+
+        nya_math::compose(idx,count,&d.m_parent[0],&d.m_offset[0],d.m_rot_offset.empty()?0:&d.m_rot_offset[0],
+                          &m_pose.pos[0],&m_pose.rot[0],&m_pose.pos_tr[0],&m_pose.rot_tr[0]);
+    }
+
+    for(int i=0;i<(int)d.m_iks.size();++i)
         update_ik(i);
 
-    for(int i=0;i<(int)m_bounds.size();++i)
+    for(int i=0;i<(int)d.m_bounds.size();++i)
     {
-        const bound &b=m_bounds[i];
-        const bone &f=m_bones[b.idx];
-        bone &t=m_bones[b.target];
+        const skeleton_definition::bound &b=d.m_bounds[i];
+        const nya_math::vec3 &f_pos=m_pose.pos[b.idx],&t_pos=m_pose.pos[b.target];
+        const nya_math::quat &f_rot=m_pose.rot[b.idx],&t_rot=m_pose.rot[b.target];
 
-        nya_math::quat tmp=f.rot;
+        nya_math::quat tmp=f_rot;
         if(b.rot)
             tmp.apply_weight(b.k);
 
-        update_bone(b.target,b.pos?t.pos+f.pos*b.k:t.pos,b.rot?(t.rot*tmp).normalize():t.rot);
+        update_bone(b.target,b.pos?t_pos+f_pos*b.k:t_pos,b.rot?(t_rot*tmp).normalize():t_rot);
         update_bone_childs(b.target);
     }
+
+    dirty.assign(dirty.size(),0);
+    m_version=++last_version;
 }
 
 nya_math::vec3 skeleton::transform(int bone_idx,const nya_math::vec3 &point) const
 {
-    if(bone_idx<0 || bone_idx>=(int)m_bones.size())
+    if(bone_idx<0 || bone_idx>=get_bones_count())
         return point;
 
-    return m_pos_tr[bone_idx]+m_rot_tr[bone_idx].rotate(point);
+    return m_pose.pos_tr[bone_idx]+m_pose.rot_tr[bone_idx].rotate(point);
 }
 
 const float *skeleton::get_pos_buffer() const
 {
-    if(m_pos_tr.empty())
+    if(m_pose.pos_tr.empty())
         return 0;
 
-    return &m_pos_tr[0].x;
+    return &m_pose.pos_tr[0].x;
 }
 
 const float *skeleton::get_rot_buffer() const
 {
-    if(m_rot_tr.empty())
+    if(m_pose.rot_tr.empty())
+        return 0;
+
+    return &m_pose.rot_tr[0].v.x;
+}
+
+const float *skeleton::get_pos_tr_buffer() const
+{
+    if(m_pose.pos_tr.empty())
+        return 0;
+
+    if(m_pos_tr_version!=m_version || m_pos_tr.size()!=m_pose.pos_tr.size())
+    {
+        const skeleton_definition &d=get_definition();
+        m_pos_tr.resize(m_pose.pos_tr.size());
+        for(int i=0;i<(int)m_pos_tr.size();++i)
+            m_pos_tr[i]=m_pose.pos_tr[i]+m_pose.rot_tr[i].rotate(-d.m_bones[i].pos_org);
+        m_pos_tr_version=m_version;
+    }
+
+    return &m_pos_tr[0].x;
+}
+
+const float *skeleton::get_matrix_buffer() const
+{
+    const float *pos_tr=get_pos_tr_buffer();
+    if(!pos_tr)
+        return 0;
+
+    if(m_matrix_version!=m_version || m_matrix.size()!=m_pose.rot_tr.size()*12)
+    {
+        m_matrix.resize(m_pose.rot_tr.size()*12);
+        for(int i=0;i<(int)m_pose.rot_tr.size();++i)
+        {
+            const nya_math::quat &q=m_pose.rot_tr[i];
+            const float x2=q.v.x+q.v.x,y2=q.v.y+q.v.y,z2=q.v.z+q.v.z;
+            const float xx=q.v.x*x2,yy=q.v.y*y2,zz=q.v.z*z2;
+            const float xy=q.v.x*y2,xz=q.v.x*z2,yz=q.v.y*z2;
+            const float wx=q.w*x2,wy=q.w*y2,wz=q.w*z2;
+            const float *t=pos_tr+i*3;
+
+            float *m=&m_matrix[i*12];
+            m[0]=1.0f-(yy+zz),m[1]=xy-wz,m[2]=xz+wy,m[3]=t[0];
+            m[4]=xy+wz,m[5]=1.0f-(xx+zz),m[6]=yz-wx,m[7]=t[1];
+            m[8]=xz-wy,m[9]=yz+wx,m[10]=1.0f-(xx+yy),m[11]=t[2];
+        }
+
+        m_matrix_version=m_version;
+    }
+
+    return &m_matrix[0];
+}
+
+const float *skeleton::get_dual_quat_buffer() const
+{
+    const float *pos_tr=get_pos_tr_buffer();
+    if(!pos_tr)
         return 0;
 
-    return &m_rot_tr[0].v.x;
+    if(m_dual_quat_version!=m_version || m_dual_quat.size()!=m_pose.rot_tr.size()*8)
+    {
+        m_dual_quat.resize(m_pose.rot_tr.size()*8);
+        for(int i=0;i<(int)m_pose.rot_tr.size();++i)
+        {
+            const nya_math::quat &q=m_pose.rot_tr[i];
+            const nya_math::vec3 t(pos_tr[i*3],pos_tr[i*3+1],pos_tr[i*3+2]);
+            const nya_math::vec3 d=(t*q.w+t.cross(q.v))*0.5f;
+
+            float *dq=&m_dual_quat[i*8];
+            dq[0]=q.v.x,dq[1]=q.v.y,dq[2]=q.v.z,dq[3]=q.w;
+            dq[4]=d.x,dq[5]=d.y,dq[6]=d.z,dq[7]= -0.5f*t.dot(q.v);
+        }
+
+        m_dual_quat_version=m_version;
+    }
+
+    return &m_dual_quat[0];
 }
 
 }
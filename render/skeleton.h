@@ -4,6 +4,8 @@
 
 #include "math/vector.h"
 #include "math/quaternion.h"
+#include "memory/hash_index.h"
+#include "memory/shared_ptr.h"
 
 #include <string>
 #include <map>
@@ -12,77 +14,57 @@
 namespace nya_render
 {
 
-class skeleton
+//immutable part of a skeleton: hierarchy, names, iks, bounds and original transforms
+//shared between skeleton copies, copied on write
+class skeleton_definition
 {
 public:
     int get_bone_idx(const char *name) const; //< 0 if invalid
     const char *get_bone_name(int idx) const;
     int get_bone_parent_idx(int idx) const;
-    nya_math::vec3 transform(int bone_idx,const nya_math::vec3 &point) const;
     int get_bones_count() const { return (int)m_bones.size(); }
 
-    nya_math::vec3 get_bone_pos(int idx) const;
-    nya_math::quat get_bone_rot(int idx) const;
-    nya_math::vec3 get_bone_local_pos(int idx) const;
-    nya_math::quat get_bone_local_rot(int idx) const;
     nya_math::vec3 get_bone_original_pos(int idx) const;
     nya_math::quat get_bone_original_rot(int idx) const;
 
-    void set_bone_transform(int bone_idx,const nya_math::vec3 &pos,
-                                                const nya_math::quat &rot);
-    void update();
-
-public:
-    const float *get_pos_buffer() const;
-    const float *get_rot_buffer() const;
-
-public:
-    int add_bone(const char *name,const nya_math::vec3 &pos,
-                 const nya_math::quat &rot=nya_math::quat(),int parent_bone_idx= -1,bool allow_doublicate=false);
-
-public:
-    int add_ik(int target_bone_idx,int effect_bone_idx,int count,float fact,bool allow_invalid=false);
-    bool add_ik_link(int ik_idx,int bone_idx,bool allow_invalid=false);
-    bool add_ik_link(int ik_idx,int bone_idx,float limit_from,float limit_to,bool allow_invalid=false);
+    //unique among all definitions, changes on every modification, 0 for empty
+    unsigned int get_id() const { return m_id; }
 
 public:
-    bool add_bound(int bone_idx,int target_bone_idx,float k,bool bound_pos,bool bound_rot,bool allow_invalid=false);
+    skeleton_definition(): m_id(0) {}
 
 private:
-    void update_bone(int idx,const nya_math::vec3 &pos,const nya_math::quat &rot);
-    void update_bone(int idx) { update_bone(idx,m_bones[idx].pos,m_bones[idx].rot); }
-    void update_bone_childs(int idx);
-    void update_ik(int idx);
+    friend class skeleton;
+
+    void update_order() const;
+    bool is_ancestor(int idx,int child) const;
 
 private:
-    typedef std::map<std::string,unsigned int> index_map;
+    typedef nya_memory::hash_index index_map;
 
     struct bone
     {
         nya_math::vec3 pos_org;
-        nya_math::vec3 offset;
-
-        nya_math::vec3	pos;
-        nya_math::quat	rot;
-
-        int parent;
-
         std::string name;
     };
 
     index_map m_bones_map;
     std::vector<bone> m_bones;
 
-    struct bone_r
-    {
-        nya_math::quat rot_org;
-        nya_math::quat offset;
-    };
-
-    std::vector<bone_r> m_rot_org;
-
-    std::vector<nya_math::vec3> m_pos_tr;
-    std::vector<nya_math::quat> m_rot_tr;
+    //by bone idx, parent idx is always less than bone idx, so bones order is parent-before-child
+    std::vector<int> m_parent;
+    std::vector<nya_math::vec3> m_offset;
+    std::vector<nya_math::quat> m_rot_org; //empty if all original rotations are identity
+    std::vector<nya_math::quat> m_rot_offset; //same size as m_rot_org
+
+    //built on demand
+    //depth-first order, subtree of a bone is a continuous range
+    mutable std::vector<int> m_order;
+    mutable std::vector<int> m_order_idx; //by bone
+    mutable std::vector<int> m_subtree_end; //by bone, m_order idx after the last child
+    //bones sorted by hierarchy depth, bones of the same depth are independent
+    mutable std::vector<int> m_depth_order;
+    mutable std::vector<int> m_depth_start; //m_depth_order idx by depth, the last is bones count
 
     struct ik_link
     {
@@ -92,6 +74,13 @@ private:
         float limit_to;
     };
 
+    enum ik_solver
+    {
+        ik_ccd, //links in any order, chain is updated after each link
+        ik_ccd_chain, //each link is an ancestor of the previous one, the first is an ancestor of eff
+        ik_two_bone //eff-knee-hip chain with pitch limited knee, solved analytically
+    };
+
     struct ik
     {
         int target;
@@ -101,6 +90,8 @@ private:
         float fact;
 
         std::vector<ik_link> links;
+
+        mutable ik_solver solver; //built on demand
     };
 
     std::vector<ik> m_iks;
@@ -117,6 +108,100 @@ private:
     };
 
     std::vector<bound> m_bounds;
+
+    unsigned int m_id;
+};
+
+//per instance transforms by bone idx
+struct skeleton_pose
+{
+    std::vector<nya_math::vec3> pos; //local
+    std::vector<nya_math::quat> rot;
+
+    std::vector<nya_math::vec3> pos_tr; //model space
+    std::vector<nya_math::quat> rot_tr;
+
+    std::vector<char> dirty; //local transform changed since last update
+};
+
+//skeleton copies share the definition and only own the pose
+class skeleton
+{
+public:
+    int get_bone_idx(const char *name) const; //< 0 if invalid
+    const char *get_bone_name(int idx) const;
+    int get_bone_parent_idx(int idx) const;
+    nya_math::vec3 transform(int bone_idx,const nya_math::vec3 &point) const;
+    int get_bones_count() const { return (int)m_pose.pos.size(); }
+
+    nya_math::vec3 get_bone_pos(int idx) const;
+    nya_math::quat get_bone_rot(int idx) const;
+    nya_math::vec3 get_bone_local_pos(int idx) const;
+    nya_math::quat get_bone_local_rot(int idx) const;
+    nya_math::vec3 get_bone_original_pos(int idx) const;
+    nya_math::quat get_bone_original_rot(int idx) const;
+
+    //only bones with changed transforms, their childs and bones affected by iks and bounds are updated
+    void set_bone_transform(int bone_idx,const nya_math::vec3 &pos,
+                                                const nya_math::quat &rot);
+    void update();
+
+    //two-link iks with pitch limited middle link (legs) are solved analytically instead of ccd, enabled by default
+    static void set_analytic_ik(bool enable);
+
+public:
+    const float *get_pos_buffer() const;
+    const float *get_rot_buffer() const;
+
+    //skinning palette, built once per version on demand
+    const float *get_pos_tr_buffer() const; //vec3 per bone, pos+rot.rotate(-original_pos), goes with rot buffer
+    const float *get_matrix_buffer() const; //3x4 row-major matrix per bone, rotation and pos_tr translation in the last column
+    const float *get_dual_quat_buffer() const; //8 floats per bone, rot and dual part 0.5*pos_tr*rot
+
+    //changes on every update, different skeletons have different versions unless one is an unchanged copy of another
+    unsigned int get_version() const { return m_version; }
+
+public:
+    const skeleton_definition &get_definition() const;
+    const skeleton_pose &get_pose() const { return m_pose; }
+    bool is_definition_shared(const skeleton &other) const { return m_def.is_valid() && m_def==other.m_def; }
+
+public:
+    int add_bone(const char *name,const nya_math::vec3 &pos,
+                 const nya_math::quat &rot=nya_math::quat(),int parent_bone_idx= -1,bool allow_doublicate=false);
+
+public:
+    int add_ik(int target_bone_idx,int effect_bone_idx,int count,float fact,bool allow_invalid=false);
+    bool add_ik_link(int ik_idx,int bone_idx,bool allow_invalid=false);
+    bool add_ik_link(int ik_idx,int bone_idx,float limit_from,float limit_to,bool allow_invalid=false);
+
+public:
+    bool add_bound(int bone_idx,int target_bone_idx,float k,bool bound_pos,bool bound_rot,bool allow_invalid=false);
+
+private:
+    skeleton_definition &get_definition_w();
+    void update_bone(int idx,const nya_math::vec3 &pos,const nya_math::quat &rot);
+    void update_bone(int idx) { update_bone(idx,m_pose.pos[idx],m_pose.rot[idx]); }
+    void update_bone_childs(int idx);
+    void update_ik(int idx);
+    bool update_ik_link(const skeleton_definition::ik &k,int link,const nya_math::vec3 &target,float fact,nya_math::vec3 &eff);
+    void update_ik_chain(const skeleton_definition::ik &k);
+    bool update_ik_two_bone(const skeleton_definition::ik &k,const nya_math::vec3 &target);
+
+public:
+    skeleton(): m_version(0),m_pos_tr_version(0),m_matrix_version(0),m_dual_quat_version(0) {}
+
+private:
+    nya_memory::shared_ptr<skeleton_definition> m_def;
+    skeleton_pose m_pose;
+
+    unsigned int m_version;
+    mutable std::vector<nya_math::vec3> m_pos_tr;
+    mutable unsigned int m_pos_tr_version;
+    mutable std::vector<float> m_matrix;
+    mutable unsigned int m_matrix_version;
+    mutable std::vector<float> m_dual_quat;
+    mutable unsigned int m_dual_quat_version;
 };
 
 }
@@ -16,8 +16,12 @@ public:
     unsigned int verts_count;
     unsigned int opaque_poly_count;
     unsigned int transparent_poly_count;
+    unsigned int lod_saved_poly_count;
+    unsigned int ik_count; //solved ik chains
+    unsigned int ik_links_count; //ik link rotations
 
-    statistics(): draw_count(0),verts_count(0),opaque_poly_count(0),transparent_poly_count(0) {}
+    statistics(): draw_count(0),verts_count(0),opaque_poly_count(0),transparent_poly_count(0),lod_saved_poly_count(0),
+                  ik_count(0),ik_links_count(0) {}
 
 public:
     static bool enabled();
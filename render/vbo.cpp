@@ -171,6 +171,16 @@ DXGI_FORMAT get_dx_format(int dimension,vbo::vertex_atrib_type type)
     if(type==vbo::uint8)
         return DXGI_FORMAT_R8G8B8A8_UNORM;
 
+    if(type==vbo::uint16)
+    {
+        switch(dimension)
+        {
+            case 1: return DXGI_FORMAT_R16_UNORM;
+            case 2: return DXGI_FORMAT_R16G16_UNORM;
+            case 3: case 4: return DXGI_FORMAT_R16G16B16A16_UNORM;
+        }
+    }
+
     if(type==vbo::float16)
     {
         switch(dimension)
@@ -229,6 +239,7 @@ int get_gl_element_type(vbo::vertex_atrib_type type)
         case vbo::float16: return GL_HALF_FLOAT;
         case vbo::float32: return GL_FLOAT;
         case vbo::uint8: return GL_UNSIGNED_BYTE;
+        case vbo::uint16: return GL_UNSIGNED_SHORT;
     }
 
     return GL_FLOAT;
@@ -414,7 +425,7 @@ void vbo::draw(unsigned int offset,unsigned int count,element_type el_type,unsig
         if(vobj.normals.has)
         {
             d.SemanticName="NORMAL";
-            d.Format=get_dx_format(3,vobj.normals.type);
+            d.Format=get_dx_format(vobj.normals.dimension,vobj.normals.type);
             d.AlignedByteOffset=vobj.normals.offset;
             desc.push_back(d);
         }
@@ -556,7 +567,7 @@ void vbo::draw(unsigned int offset,unsigned int count,element_type el_type,unsig
       #ifdef ATTRIBUTES_INSTEAD_OF_CLIENTSTATES
                     if(!active_attributes.normals.has)
                         glEnableVertexAttribArray(normal_attribute);
-                    glVertexAttribPointer(normal_attribute,3,get_gl_element_type(vobj.normals.type),true,
+                    glVertexAttribPointer(normal_attribute,vobj.normals.dimension,get_gl_element_type(vobj.normals.type),true,
                                           vobj.vertex_stride,(void*)(ptrdiff_t)(vobj.normals.offset));
       #else
                     if(!active_attributes.normals.has)
@@ -906,13 +917,23 @@ void vbo::set_vertices(unsigned int offset,unsigned int dimension,vertex_atrib_t
         return;
     }
 
+#if !defined DIRECTX11 && !defined ATTRIBUTES_INSTEAD_OF_CLIENTSTATES
+    //client state pointers aren't normalized, half floats need an extension and normals are always 3d
+    if(type!=float32)
+    {
+        log()<<"Unable to set vertices: only float32 is supported without vertex attributes\n";
+        obj.vertices.has=false;
+        return;
+    }
+#endif
+
     obj.vertices.has=true;
     obj.vertices.offset=offset;
     obj.vertices.dimension=dimension;
     obj.vertices.type=type;
 }
 
-void vbo::set_normals(unsigned int offset,vertex_atrib_type type)
+void vbo::set_normals(unsigned int offset,vertex_atrib_type type,unsigned int dimension)
 {
     if(m_verts<0)
         m_verts=vbo_obj::add();
@@ -926,8 +947,24 @@ void vbo::set_normals(unsigned int offset,vertex_atrib_type type)
     DIRECTX11_ONLY(remove_layout(m_verts));
     OPENGL_ONLY(if(m_verts==active_verts) active_verts= -1);
 
+    if(dimension==0 || dimension>4)
+    {
+        obj.normals.has=false;
+        return;
+    }
+
+#if !defined DIRECTX11 && !defined ATTRIBUTES_INSTEAD_OF_CLIENTSTATES
+    if(type!=float32 || dimension!=3)
+    {
+        log()<<"Unable to set normals: only 3d float32 is supported without vertex attributes\n";
+        obj.normals.has=false;
+        return;
+    }
+#endif
+
     obj.normals.has=true;
     obj.normals.offset=offset;
+    obj.normals.dimension=dimension;
     obj.normals.type=type;
 }
 
@@ -955,6 +992,15 @@ void vbo::set_tc(unsigned int tc_idx,unsigned int offset,unsigned int dimension,
         return;
     }
 
+#if !defined DIRECTX11 && !defined ATTRIBUTES_INSTEAD_OF_CLIENTSTATES
+    if(type!=float32)
+    {
+        log()<<"Unable to set tc: only float32 is supported without vertex attributes\n";
+        tc.has=false;
+        return;
+    }
+#endif
+
     tc.has=true;
     tc.offset=offset;
     tc.dimension=dimension;
@@ -29,7 +29,8 @@ public:
     {
         float16,
         float32,
-        uint8
+        uint8,
+        uint16
     };
 
     enum usage_hint
@@ -46,7 +47,7 @@ public:
     bool set_index_data(const void*data,index_size size,unsigned int indices_count,usage_hint usage=static_draw);
     void set_element_type(element_type type);
     void set_vertices(unsigned int offset,unsigned int dimension,vertex_atrib_type=float32);
-    void set_normals(unsigned int offset,vertex_atrib_type=float32);
+    void set_normals(unsigned int offset,vertex_atrib_type=float32,unsigned int dimension=3); //dimension!=3 requires shader decode
     void set_tc(unsigned int tc_idx,unsigned int offset,unsigned int dimension,vertex_atrib_type=float32);
     void set_colors(unsigned int offset,unsigned int dimension,vertex_atrib_type=float32);
 
@@ -2,10 +2,48 @@
 
 #include "animation.h"
 #include "memory/memory_reader.h"
+#include <math.h>
 
 namespace nya_scene
 {
 
+namespace
+{
+
+float reduce_pos_tolerance=0.0f,reduce_rot_tolerance=0.0f,reduce_curve_tolerance=0.0f;
+unsigned int bake_frame_time=0;
+
+void process_loaded(nya_render::animation &anim)
+{
+    if(reduce_pos_tolerance>0.0f || reduce_rot_tolerance>0.0f || reduce_curve_tolerance>0.0f)
+        anim.reduce_frames(reduce_pos_tolerance,reduce_rot_tolerance,reduce_curve_tolerance);
+
+    if(bake_frame_time)
+        anim.bake(bake_frame_time);
+}
+
+//smallest three: 15 bits per component, largest component idx in the lowest bits of the first two
+nya_math::quat unpack_quat(const unsigned short *p)
+{
+    const float s=1.0f/sqrtf(2.0f);
+    float c[4];
+    const int largest=(p[0]&1)|((p[1]&1)<<1);
+    float sum=0.0f;
+    for(int i=0,j=0;i<4;++i)
+    {
+        if(i==largest)
+            continue;
+
+        c[i]=((p[j++]>>1)*(2.0f/32767.0f)-1.0f)*s;
+        sum+=c[i]*c[i];
+    }
+
+    c[largest]=sum<1.0f?sqrtf(1.0f-sum):0.0f;
+    return nya_math::quat(c[0],c[1],c[2],c[3]);
+}
+
+}
+
 bool animation::load(const char *name)
 {
     if(!scene_shared<shared_animation>::load(name))
@@ -53,20 +91,40 @@ bool animation::load_nan(shared_animation &res,resource_data &data,const char* n
         return false;
 
     typedef unsigned int uint;
+    typedef unsigned short ushort;
     const uint version=reader.read<uint>();
-    if(version!=1)
+    if(version!=1 && version!=2)
         return false;
 
-    enum curve_type //ToDo
+    enum curve_type
     {
         pos_vec3_linear=10,
-        //pos_vec3_bezier=11,
+        pos_vec3_bezier=11, //version 2
         rot_quat_linear=20,
-        //rot_quat_bezier=21,
-        //scale_vec3_linear=30,
+        rot_quat_bezier=21, //version 2
+        rot_packed_linear=22, //version 2
+        rot_packed_bezier=23, //version 2
+        //scale_vec3_linear=30, //ToDo
         curve_float_linear=70
     };
 
+    //shared interpolation curves, referenced by 1-based idx, 0 is linear
+    std::vector<nya_math::bezier> inters(1);
+    if(version>=2)
+    {
+        const uint inters_count=reader.read<uint>();
+        if(!reader.check_remained(inters_count*sizeof(float)*4))
+            return false;
+
+        inters.resize(inters_count+1);
+        for(uint i=1;i<=inters_count;++i)
+        {
+            const float x1=reader.read<float>(),y1=reader.read<float>();
+            const float x2=reader.read<float>(),y2=reader.read<float>();
+            inters[i]=nya_math::bezier(x1,y1,x2,y2);
+        }
+    }
+
     const int bones_count=reader.read<int>();
     for(int i=0;i<bones_count;++i)
     {
@@ -102,6 +160,60 @@ bool animation::load_nan(shared_animation &res,resource_data &data,const char* n
             }
             break;
 
+            case pos_vec3_bezier:
+            {
+                if(version<2)
+                    return false;
+
+                const int bone_idx=res.anim.add_bone(bone_name.c_str());
+                for(uint j=0;j<frames_count;++j)
+                {
+                    const uint time=reader.read<uint>();
+                    const nya_math::vec3 pos=reader.read<nya_math::vec3>();
+                    nya_render::animation::pos_interpolation inter;
+                    const ushort ix=reader.read<ushort>(),iy=reader.read<ushort>(),iz=reader.read<ushort>();
+                    if(ix>=inters.size() || iy>=inters.size() || iz>=inters.size())
+                        return false;
+
+                    inter.x=inters[ix],inter.y=inters[iy],inter.z=inters[iz];
+                    res.anim.add_bone_pos_frame(bone_idx,time,pos,inter);
+                }
+            }
+            break;
+
+            case rot_quat_bezier:
+            case rot_packed_linear:
+            case rot_packed_bezier:
+            {
+                if(version<2)
+                    return false;
+
+                const bool packed=type!=rot_quat_bezier;
+                const bool has_inter=type!=rot_packed_linear;
+                const int bone_idx=res.anim.add_bone(bone_name.c_str());
+                for(uint j=0;j<frames_count;++j)
+                {
+                    const uint time=reader.read<uint>();
+                    nya_math::quat rot;
+                    if(packed)
+                    {
+                        ushort p[3];
+                        for(int k=0;k<3;++k)
+                            p[k]=reader.read<ushort>();
+                        rot=unpack_quat(p);
+                    }
+                    else
+                        rot=reader.read<nya_math::quat>();
+
+                    const ushort inter=has_inter?reader.read<ushort>():0;
+                    if(inter>=inters.size())
+                        return false;
+
+                    res.anim.add_bone_rot_frame(bone_idx,time,rot,inters[inter]);
+                }
+            }
+            break;
+
             case curve_float_linear:
             {
                 const int bone_idx=res.anim.add_curve(bone_name.c_str());
@@ -118,6 +230,7 @@ bool animation::load_nan(shared_animation &res,resource_data &data,const char* n
         }
     }
 
+    process_loaded(res.anim);
     return true;
 }
 
@@ -203,9 +316,19 @@ bool animation::load_vmd(shared_animation &res,resource_data &data,const char* n
         res.anim.add_bone_rot_frame(bone_idx,time,bone_frame.rot,rot_inter);
     }
 
+    process_loaded(res.anim);
     return true;
 }
 
+void animation::set_load_reduction(float pos_tolerance,float rot_tolerance,float curve_tolerance)
+{
+    reduce_pos_tolerance=pos_tolerance;
+    reduce_rot_tolerance=rot_tolerance;
+    reduce_curve_tolerance=curve_tolerance;
+}
+
+void animation::set_load_bake(unsigned int frame_time) { bake_frame_time=frame_time; }
+
 unsigned int animation::get_duration() const
 {
     if(!m_shared.is_valid())
@@ -247,9 +370,9 @@ void animation::mask_all(bool enabled)
     {
         if(!m_mask.is_valid())
             m_mask.allocate();
-        else
-            m_mask->data.clear();
 
+        const int bones_count=m_shared.is_valid()?m_shared->anim.get_bones_count():0;
+        m_mask->bits.assign((bones_count+31)/32,0);
         update_version();
     }
 }
@@ -268,7 +391,8 @@ void animation::add_mask(const char *name,bool enabled)
     if(!m_shared.is_valid())
         return;
 
-    if(m_shared->anim.get_bone_idx(name)<0)
+    const int idx=m_shared->anim.get_bone_idx(name);
+    if(idx<0)
         return;
 
     if(enabled)
@@ -276,7 +400,7 @@ void animation::add_mask(const char *name,bool enabled)
         if(!m_mask.is_valid())
             return;
 
-        m_mask->data[name]=true;
+        m_mask->set(idx,true);
         update_version();
     }
     else
@@ -284,14 +408,10 @@ void animation::add_mask(const char *name,bool enabled)
         if(!m_mask.is_valid())
         {
             m_mask.allocate();
-            for(int i=0;i<m_shared->anim.get_bones_count();++i)
-                m_mask->data[m_shared->anim.get_bone_name(i)]=true;
+            m_mask->bits.assign((m_shared->anim.get_bones_count()+31)/32,0xffffffff);
         }
 
-        std::map<std::string,bool>::iterator it=m_mask->data.find(name);
-        if(it!=m_mask->data.end())
-            m_mask->data.erase(it);
-
+        m_mask->set(idx,false);
         update_version();
     }
 }
@@ -13,9 +13,19 @@ struct shared_animation
 {
     nya_render::animation anim;
 
+    //skeleton bone idx to anim bone idx, shared by meshes with the same skeleton definition
+    struct bones_mapping
+    {
+        unsigned int skeleton_id;
+        std::vector<int> bones_map;
+    };
+
+    mutable std::vector<bones_mapping> mappings;
+
     bool release()
     {
         anim.release();
+        mappings.clear();
         return true;
     }
 };
@@ -57,6 +67,11 @@ public:
     static bool load_vmd(shared_animation &res,resource_data &data,const char* name);
     static bool load_nan(shared_animation &res,resource_data &data,const char* name);
 
+    //reduce frames of loaded animations, see nya_render::animation::reduce_frames, disabled by default
+    static void set_load_reduction(float pos_tolerance,float rot_tolerance,float curve_tolerance);
+    //bake loaded animations for mesh playback, see nya_render::animation::bake, 0 disables (default)
+    static void set_load_bake(unsigned int frame_time);
+
 private:
     bool m_looped;
     unsigned int m_range_from;
@@ -66,7 +81,14 @@ private:
 
     unsigned int m_version;
 
-    struct mask_data { std::map<std::string,bool> data; };
+    //enabled anim bones, bit per shared anim bone idx
+    struct mask_data
+    {
+        std::vector<unsigned int> bits;
+
+        bool get(int idx) const { return idx>=0 && idx/32<(int)bits.size() && (bits[idx/32]>>(idx%32)&1); }
+        void set(int idx,bool enabled) { if(enabled) bits[idx/32]|=1u<<(idx%32); else bits[idx/32]&=~(1u<<(idx%32)); }
+    };
 
     nya_memory::optional<mask_data> m_mask;
 };
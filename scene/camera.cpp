@@ -11,7 +11,11 @@
 namespace nya_scene
 {
 
-namespace { camera_proxy active_camera=camera_proxy(camera()); }
+namespace
+{
+    camera_proxy active_camera=camera_proxy(camera());
+    unsigned int last_frustum_version=0;
+}
 
 void camera::set_proj(float fov,float aspect,float near,float far)
 {
@@ -97,6 +101,9 @@ const nya_math::frustum &camera::get_frustum() const
     if(m_recalc_frustum)
     {
         m_recalc_frustum=false;
+        m_frustum_version=++last_frustum_version;
+        if(!m_frustum_version)
+            m_frustum_version=++last_frustum_version;
 
         if(nya_render::transform::get().has_orientation_matrix())
             m_frustum=nya_math::frustum(get_view_matrix()*get_proj_matrix()*nya_render::transform::get().get_orientation_matrix());
@@ -107,6 +114,12 @@ const nya_math::frustum &camera::get_frustum() const
     return m_frustum;
 }
 
+unsigned int camera::get_frustum_version() const
+{
+    get_frustum();
+    return m_frustum_version;
+}
+
 void set_camera(const camera_proxy &cam)
 {
     active_camera=cam;
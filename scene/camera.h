@@ -29,6 +29,7 @@ public:
     const nya_math::mat4 &get_view_matrix() const;
 
     const nya_math::frustum &get_frustum() const;
+    unsigned int get_frustum_version() const; //unique among all cameras, changes when frustum changes
 
 public:
 	const nya_math::vec3 &get_pos() const { return m_pos; }
@@ -36,7 +37,7 @@ public:
     const nya_math::vec3 get_dir() const { return m_rot.rotate(nya_math::vec3(0.0f,0.0f,1.0f)); }
 
 public:
-    camera(): m_recalc_view(true), m_recalc_frustum(true) {}
+    camera(): m_frustum_version(0), m_recalc_view(true), m_recalc_frustum(true) {}
 
 private:
     nya_math::vec3 m_pos;
@@ -46,6 +47,7 @@ private:
     mutable nya_math::mat4 m_view;
 
     mutable nya_math::frustum m_frustum;
+    mutable unsigned int m_frustum_version;
 
     mutable bool m_recalc_view;
     mutable bool m_recalc_frustum;
@@ -131,12 +131,6 @@ void material_internal::param_holder::apply_to_shader(const shader &shader,int u
     }
 }
 
-void material_internal::skeleton_changed(const nya_render::skeleton *skeleton) const
-{
-    for(int i=0;i<(int)m_passes.size();++i)
-        m_passes[i].m_shader.internal().skeleton_changed(skeleton);
-}
-
 bool material::load_text(shared_material &res,resource_data &data,const char* name)
 {
     nya_formats::text_parser parser;
@@ -21,7 +21,6 @@ public:
 public:
     void set(const char *pass_name=default_pass) const;
     void unset() const;
-    void skeleton_changed(const nya_render::skeleton *skeleton) const;
     int get_param_idx(const char *name) const;
     int get_texture_idx(const char *semantics) const;
     bool release();
@@ -2,16 +2,22 @@
 
 #include "camera.h"
 #include "math/constants.h"
+#include "math/batch.h"
 #include "memory/invalid_object.h"
 #include "memory/memory_reader.h"
 #include "memory/tmp_buffer.h"
 #include "formats/string_convert.h"
 #include "formats/nms.h"
+#include "formats/nms_quantizer.h"
 #include "mesh.h"
 #include "render/render.h"
+#include "render/statistics.h"
+#include "math/scalar.h"
 #include "scene.h"
 #include "shader.h"
 #include <stdint.h>
+#include <string.h>
+#include <algorithm>
 
 namespace nya_scene
 {
@@ -29,7 +35,335 @@ material::pass &material_default_pass(material &m)
 }
 
 bool frustum_cull_enabled=true;
+float lod1_screen_size=0.25f;
+float lod_hysteresis=0.1f;
+float lod_bias_scale=1.0f;
+bool keep_geometry=true;
 
+void load_nms_groups(const std::vector<nya_formats::nms_mesh_chunk::group> &from,std::vector<shared_mesh::group> &to)
+{
+    to.resize(from.size());
+    for(size_t i=0;i<to.size();++i)
+    {
+        const nya_formats::nms_mesh_chunk::group &f=from[i];
+        shared_mesh::group &t=to[i];
+
+        t.name=f.name;
+
+        t.aabb=nya_math::aabb(f.aabb_min,f.aabb_max);
+
+        t.material_idx=f.material_idx;
+        t.offset=f.offset;
+        t.count=f.count;
+
+        t.elem_type=nya_render::vbo::element_type(f.element_type);
+    }
+}
+
+unsigned int get_poly_count(const shared_mesh::group &g)
+{
+    switch(g.elem_type)
+    {
+        case nya_render::vbo::triangles: return g.count/3;
+        case nya_render::vbo::triangle_strip: return g.count>2?g.count-2:0;
+        default: return 0;
+    }
+}
+
+float read_attrib(const char *data,nya_formats::nms_mesh_chunk::vertex_atrib_type type,unsigned int idx,bool normalized)
+{
+    switch(type)
+    {
+        case nya_formats::nms_mesh_chunk::float16:
+        {
+            uint16_t h;
+            memcpy(&h,data+idx*2,2);
+            return nya_formats::nms_quantizer::half_to_float(h);
+        }
+
+        case nya_formats::nms_mesh_chunk::float32:
+        {
+            float f;
+            memcpy(&f,data+idx*4,4);
+            return f;
+        }
+
+        case nya_formats::nms_mesh_chunk::uint8: return ((const uint8_t *)data)[idx]/(normalized?255.0f:1.0f);
+
+        case nya_formats::nms_mesh_chunk::uint16:
+        {
+            uint16_t u;
+            memcpy(&u,data+idx*2,2);
+            return u/(normalized?65535.0f:1.0f);
+        }
+    }
+
+    return 0.0f;
+}
+
+void read_attrib(const nya_formats::nms_mesh_chunk &c,const nya_formats::nms_mesh_chunk::element &e,bool normalized,
+                 float *to,int to_dimension)
+{
+    const char *data=(const char *)c.vertices_data+e.offset;
+    const unsigned int dimension=e.dimension<(unsigned int)to_dimension?e.dimension:to_dimension;
+    for(unsigned int i=0;i<c.verts_count;++i,data+=c.vertex_stride,to+=to_dimension)
+    {
+        for(unsigned int j=0;j<dimension;++j)
+            to[j]=read_attrib(data,e.data_type,j,normalized);
+    }
+}
+
+typedef const nya_formats::nms_mesh_chunk::element *nms_element_ptr;
+
+void find_geometry_elements(const nya_formats::nms_mesh_chunk &c,nms_element_ptr &pos,nms_element_ptr &bone_idx,nms_element_ptr &bone_weight)
+{
+    pos=bone_idx=bone_weight=0;
+    for(size_t i=0;i<c.elements.size();++i)
+    {
+        const nya_formats::nms_mesh_chunk::element &e=c.elements[i];
+        if(e.type==nya_formats::nms_mesh_chunk::pos)
+            pos=&e;
+        else if(e.type>=nya_formats::nms_mesh_chunk::tc0)
+        {
+            if(e.semantics.find("weight")!=std::string::npos)
+                bone_weight=&e;
+            else if(e.semantics.find("bone")!=std::string::npos)
+                bone_idx=&e;
+        }
+    }
+}
+
+bool has_bone_weights(const nya_formats::nms_mesh_chunk &c)
+{
+    nms_element_ptr pos,bone_idx,bone_weight;
+    find_geometry_elements(c,pos,bone_idx,bone_weight);
+    return pos && bone_idx && bone_weight;
+}
+
+void load_nms_geometry(const nya_formats::nms_mesh_chunk &c,shared_mesh::cpu_geometry &g)
+{
+    g.clear();
+    if(!c.vertices_data || !c.verts_count)
+        return;
+
+    nms_element_ptr pos,bone_idx,bone_weight;
+    find_geometry_elements(c,pos,bone_idx,bone_weight);
+    if(!pos)
+        return;
+
+    g.verts.resize(c.verts_count);
+    read_attrib(c,*pos,true,&g.verts[0].x,3);
+
+    //quantized positions are relative to mesh bounds, see nms_quantizer
+    if(pos->data_type!=nya_formats::nms_mesh_chunk::float16 && pos->data_type!=nya_formats::nms_mesh_chunk::float32)
+    {
+        const nya_math::vec3 scale=c.aabb_max-c.aabb_min;
+        for(size_t i=0;i<g.verts.size();++i)
+            g.verts[i]=c.aabb_min+nya_math::vec3(g.verts[i].x*scale.x,g.verts[i].y*scale.y,g.verts[i].z*scale.z);
+    }
+
+    if(bone_idx && bone_weight)
+    {
+        g.bone_idx.resize(c.verts_count);
+        g.bone_weight.resize(c.verts_count);
+        read_attrib(c,*bone_idx,false,&g.bone_idx[0].x,4);
+        read_attrib(c,*bone_weight,true,&g.bone_weight[0].x,4);
+    }
+
+    if(!c.indices_data)
+        return;
+
+    g.indices.resize(c.indices_count);
+    if(c.index_size==nya_formats::nms_mesh_chunk::index2b)
+    {
+        const uint16_t *ind=(const uint16_t *)c.indices_data;
+        for(unsigned int i=0;i<c.indices_count;++i)
+            g.indices[i]=ind[i];
+    }
+    else if(c.index_size==nya_formats::nms_mesh_chunk::index4b)
+        memcpy(&g.indices[0],c.indices_data,c.indices_count*4);
+    else
+        g.clear();
+}
+
+//indices may be 0 for vertices from..to
+void get_bones_aabb(const shared_mesh::cpu_geometry &g,const unsigned int *indices,unsigned int from,unsigned int to,
+                    std::vector<shared_mesh::bone_aabb> &result)
+{
+    result.clear();
+    if(g.bone_idx.size()!=g.verts.size() || g.bone_weight.size()!=g.verts.size())
+        return;
+
+    std::vector<nya_math::vec3> bmin,bmax;
+    std::vector<bool> used;
+    for(unsigned int i=from;i<to;++i)
+    {
+        const unsigned int v=indices?indices[i]:i;
+        if(v>=g.verts.size())
+            continue;
+
+        const nya_math::vec3 &p=g.verts[v];
+        const float *idx=&g.bone_idx[v].x,*w=&g.bone_weight[v].x;
+        for(int j=0;j<4;++j)
+        {
+            const int b=int(idx[j]+0.5f);
+            if(!(w[j]>0.0f) || b<0)
+                continue;
+
+            if(b>=(int)used.size())
+            {
+                used.resize(b+1,false);
+                bmin.resize(b+1);
+                bmax.resize(b+1);
+            }
+
+            if(!used[b])
+            {
+                used[b]=true;
+                bmin[b]=bmax[b]=p;
+                continue;
+            }
+
+            bmin[b]=nya_math::vec3::min(bmin[b],p);
+            bmax[b]=nya_math::vec3::max(bmax[b],p);
+        }
+    }
+
+    for(int i=0;i<(int)used.size();++i)
+    {
+        if(!used[i])
+            continue;
+
+        result.resize(result.size()+1);
+        result.back().bone_idx=i;
+        result.back().aabb=nya_math::aabb(bmin[i],bmax[i]);
+    }
+}
+
+//union of bone boxes transformed by 3x4 skinning matrices, false if no valid bones
+bool get_animated_aabb(const std::vector<shared_mesh::bone_aabb> &boxes,const float *matrices,int bones_count,nya_math::aabb &result)
+{
+    nya_math::vec3 rmin,rmax;
+    bool any=false;
+    for(size_t i=0;i<boxes.size();++i)
+    {
+        const shared_mesh::bone_aabb &b=boxes[i];
+        if(b.bone_idx>=bones_count)
+            continue;
+
+        const float *m=matrices+b.bone_idx*12;
+        const nya_math::vec3 &o=b.aabb.origin,&d=b.aabb.delta;
+        const nya_math::vec3 origin(m[0]*o.x+m[1]*o.y+m[2]*o.z+m[3],
+                                    m[4]*o.x+m[5]*o.y+m[6]*o.z+m[7],
+                                    m[8]*o.x+m[9]*o.y+m[10]*o.z+m[11]);
+        const nya_math::vec3 delta(fabsf(m[0])*d.x+fabsf(m[1])*d.y+fabsf(m[2])*d.z,
+                                   fabsf(m[4])*d.x+fabsf(m[5])*d.y+fabsf(m[6])*d.z,
+                                   fabsf(m[8])*d.x+fabsf(m[9])*d.y+fabsf(m[10])*d.z);
+        if(!any)
+        {
+            rmin=origin-delta,rmax=origin+delta;
+            any=true;
+            continue;
+        }
+
+        rmin=nya_math::vec3::min(rmin,origin-delta);
+        rmax=nya_math::vec3::max(rmax,origin+delta);
+    }
+
+    if(any)
+        result=nya_math::aabb(rmin,rmax);
+
+    return any;
+}
+
+void add_triangle(std::vector<unsigned int> &triangles,unsigned int a,unsigned int b,unsigned int c)
+{
+    if(a==b || b==c || a==c)
+        return;
+
+    triangles.push_back(a);
+    triangles.push_back(b);
+    triangles.push_back(c);
+}
+
+void build_geometry_tree(const shared_mesh &res)
+{
+    const shared_mesh::cpu_geometry &g=res.geometry;
+    const std::vector<unsigned int> &ind=g.indices;
+    const unsigned int count=(unsigned int)(ind.empty()?g.verts.size():ind.size());
+
+    g.triangles.clear();
+    g.group_first_triangle.resize(res.groups.size()+1,0);
+    for(size_t i=0;i<res.groups.size();++i)
+    {
+        const shared_mesh::group &gr=res.groups[i];
+        g.group_first_triangle[i]=int(g.triangles.size()/3);
+        if(gr.offset+gr.count>count)
+            continue;
+
+        const unsigned int from=gr.offset,to=gr.offset+gr.count;
+        switch(gr.elem_type)
+        {
+            case nya_render::vbo::triangles:
+                for(unsigned int j=from;j+2<to;j+=3)
+                {
+                    if(ind.empty())
+                        add_triangle(g.triangles,j,j+1,j+2);
+                    else
+                        add_triangle(g.triangles,ind[j],ind[j+1],ind[j+2]);
+                }
+                break;
+
+            case nya_render::vbo::triangle_strip:
+                for(unsigned int j=from;j+2<to;++j)
+                {
+                    if(ind.empty())
+                        add_triangle(g.triangles,j,j+1,j+2);
+                    else
+                        add_triangle(g.triangles,ind[j],ind[j+1],ind[j+2]);
+                }
+                break;
+
+            default: break;
+        }
+    }
+
+    g.group_first_triangle.back()=int(g.triangles.size()/3);
+
+    if(!g.triangles.empty())
+        g.tree.build(&g.verts[0],int(g.verts.size()),&g.triangles[0],int(g.triangles.size()));
+}
+
+unsigned int get_poly_count(const std::vector<shared_mesh::group> &groups)
+{
+    unsigned int count=0;
+    for(size_t i=0;i<groups.size();++i)
+        count+=get_poly_count(groups[i]);
+
+    return count;
+}
+
+}
+
+unsigned int shared_mesh::lod::get_poly_count() const { return ::nya_scene::get_poly_count(groups); }
+
+void shared_mesh::update_bones_aabb(const cpu_geometry &g)
+{
+    for(size_t i=0;i<groups.size();++i)
+        groups[i].bones_aabb.clear();
+
+    get_bones_aabb(g,0,0,(unsigned int)g.verts.size(),bones_aabb);
+    if(bones_aabb.empty())
+        return;
+
+    const std::vector<unsigned int> &ind=g.indices;
+    const unsigned int count=(unsigned int)(ind.empty()?g.verts.size():ind.size());
+    for(size_t i=0;i<groups.size();++i)
+    {
+        group &gr=groups[i];
+        if(gr.offset+gr.count<=count)
+            get_bones_aabb(g,ind.empty()?0:&ind[0],gr.offset,gr.offset+gr.count,gr.bones_aabb);
+    }
 }
 
 bool mesh::load_nms_mesh_section(shared_mesh &res,const void *data,size_t size,int version)
@@ -47,7 +381,7 @@ bool mesh::load_nms_mesh_section(shared_mesh &res,const void *data,size_t size,i
         switch(e.type)
         {
             case nya_formats::nms_mesh_chunk::pos: res.vbo.set_vertices(e.offset,e.dimension,type); break;
-            case nya_formats::nms_mesh_chunk::normal: res.vbo.set_normals(e.offset,type); break;
+            case nya_formats::nms_mesh_chunk::normal: res.vbo.set_normals(e.offset,type,e.dimension); break;
             case nya_formats::nms_mesh_chunk::color: res.vbo.set_colors(e.offset,e.dimension,type); break;
             default:
                 res.vbo.set_tc(e.type-nya_formats::nms_mesh_chunk::tc0,e.offset,e.dimension,type); break;
@@ -64,26 +398,41 @@ bool mesh::load_nms_mesh_section(shared_mesh &res,const void *data,size_t size,i
         default: return false;
     }
 
-    for(size_t i=0;i<c.lods.size();++i)
-    {
-        res.groups.resize(c.lods[i].groups.size());
-        for(size_t j=0;j<res.groups.size();++j)
-        {
-            const nya_formats::nms_mesh_chunk::group &from=c.lods[i].groups[j];
-            shared_mesh::group &to=res.groups[j];
+    shared_mesh::cpu_geometry tmp_geometry;
+    if(keep_geometry)
+        load_nms_geometry(c,res.geometry);
+    else if(has_bone_weights(c))
+        load_nms_geometry(c,tmp_geometry); //for bones bounds only
 
-            to.name=from.name;
+    if(!c.lods.empty())
+        load_nms_groups(c.lods[0].groups,res.groups);
 
-            to.aabb=nya_math::aabb(from.aabb_min,from.aabb_max);
+    res.update_bones_aabb(keep_geometry?res.geometry:tmp_geometry);
 
-            to.material_idx=from.material_idx;
-            to.offset=from.offset;
-            to.count=from.count;
+    if(c.lods.empty())
+        return true;
 
-            to.elem_type=nya_render::vbo::element_type(from.element_type);
-        }
+    res.lods.resize(c.lods.size()-1);
+    for(size_t i=0;i<res.lods.size();++i)
+    {
+        shared_mesh::lod &l=res.lods[i];
+        load_nms_groups(c.lods[i+1].groups,l.groups);
 
-        break; //ToDo: load all lods
+        l.lod0_groups.resize(l.groups.size(),-1);
+        for(size_t j=0;j<l.groups.size();++j)
+        {
+            for(size_t k=0;k<res.groups.size();++k)
+            {
+                if(!l.groups[j].name.empty() && res.groups[k].name==l.groups[j].name)
+                {
+                    l.lod0_groups[j]=int(k);
+                    break;
+                }
+
+                if(l.lod0_groups[j]<0 && res.groups[k].material_idx==l.groups[j].material_idx)
+                    l.lod0_groups[j]=int(k);
+            }
+        }
     }
 
     return true;
@@ -98,6 +447,16 @@ bool mesh::load_nms_skeleton_section(shared_mesh &res,const void *data,size_t si
         return false;
     }
 
+    //reordering bones would break vertex bone indices, so unsorted skeletons are rejected
+    for(int i=0;i<(int)c.bones.size();++i)
+    {
+        if(c.bones[i].parent>=i)
+        {
+            log()<<"nms load error: skeleton bones are not sorted parent before child, bone: "<<c.bones[i].name.c_str()<<"\n";
+            return false;
+        }
+    }
+
     for(size_t i=0;i<c.bones.size();++i)
     {
         nya_formats::nms_skeleton_chunk::bone &b=c.bones[i];
@@ -176,17 +535,22 @@ bool mesh::load_nms_material_section(shared_mesh &res,const void *data,size_t si
 
 bool mesh::load_nms(shared_mesh &res,resource_data &data,const char* name)
 {
-    if(!data.get_size() || data.get_size()<8 || memcmp(data.get_data(),"nya mesh",8)!=0)
+    return load_nms(res,data.get_data(),data.get_size(),name);
+}
+
+bool mesh::load_nms(shared_mesh &res,const void *data,size_t size,const char* name)
+{
+    if(!data || size<8 || memcmp(data,"nya mesh",8)!=0)
         return false;
 
     nya_formats::nms m;
-    if(!m.read_chunks_info(data.get_data(),data.get_size()))
+    if(!m.read_chunks_info(data,size))
     {
         log()<<"nms load error: invalid nms\n";
         return false;
     }
 
-    if(m.version!=1 && m.version!=2)
+    if(m.version<1 || m.version>nya_formats::nms::latest_version)
     {
         log()<<"nms load error: unsupported version: "<<m.version<<"\n";
         return false;
@@ -219,16 +583,20 @@ bool mesh_internal::init_from_shared()
     m_skeleton=m_shared->skeleton;
     m_bone_controls.clear();
 
-    for(int i=0;i<int(m_shared->materials.size());++i)
-        m_shared->materials[i].internal().skeleton_changed(&m_skeleton);
-
     m_recalc_aabb=true;
     m_has_aabb=m_shared->aabb.delta.length_sq()>0.0001f;
+    m_lod=0;
+    for(int i=0;i<2;++i)
+        m_lod_state[i]=lod_state();
 
     m_groups.resize(m_shared->groups.size());
     for(int i=0;i<(int)m_groups.size();++i)
         m_groups[i].has_aabb=m_shared->groups[i].aabb.delta.length_sq()>0.0001f;
 
+    m_skinned_verts.clear();
+    m_skinned_tree.clear();
+    m_skinned_verts_valid=false;
+
     return true;
 }
 
@@ -259,6 +627,7 @@ void mesh::unload()
     m_internal.m_skeleton=nya_render::skeleton();
     m_internal.m_aabb=nya_math::aabb();
     m_internal.m_groups.clear();
+    m_internal.m_groups_aabb.clear();
 }
 
 int mesh_internal::get_materials_count() const
@@ -314,8 +683,11 @@ void mesh_internal::draw_group(int idx, const char *pass_name) const
         return;
     }
 
-    const shared_mesh::group &g=m_shared->groups[idx];
+    draw_group(m_shared->groups[idx],mat_idx,pass_name);
+}
 
+void mesh_internal::draw_group(const shared_mesh::group &g,int mat_idx,const char *pass_name) const
+{
     const material &m=mat(mat_idx);
     m.internal().set(pass_name);
     m_shared->vbo.bind();
@@ -324,16 +696,124 @@ void mesh_internal::draw_group(int idx, const char *pass_name) const
     m.internal().unset();
 }
 
+int mesh_internal::select_lod() const
+{
+    if(!m_shared.is_valid() || m_shared->lods.empty())
+        return m_lod=0;
+
+    const int max_lod=int(m_shared->lods.size());
+    if(m_forced_lod>=0)
+        return m_lod=m_forced_lod<max_lod?m_forced_lod:max_lod;
+
+    if(!m_has_aabb)
+        return m_lod=0;
+
+    update_aabb_transform();
+
+    const camera &cam=get_camera();
+    const nya_math::mat4 &proj=cam.get_proj_matrix();
+    const float radius=m_aabb.delta.length();
+    float screen_size=radius*proj[1][1];
+    if(fabsf(proj[2][3])>0.0001f) //perspective
+    {
+        const float dist=(m_aabb.origin-cam.get_pos()).length();
+        if(dist<=radius)
+            return m_lod=0;
+
+        screen_size/=dist;
+    }
+
+    screen_size*=lod_bias_scale;
+
+    lod_state *state=0;
+    for(int i=0;i<2 && !state;++i)
+    {
+        if(m_lod_state[i].cam==&cam)
+            state=&m_lod_state[m_last_lod_state=i];
+    }
+
+    if(!state)
+    {
+        m_last_lod_state=1-m_last_lod_state;
+        state=&m_lod_state[m_last_lod_state];
+        state->cam=&cam;
+        state->lod=0;
+    }
+
+    int lod=state->lod<max_lod?state->lod:max_lod;
+
+    //lod l is used below lod1_screen_size/2^(l-1)
+    while(lod>0 && screen_size>lod1_screen_size/float(1<<(lod-1))*(1.0f+lod_hysteresis))
+        --lod;
+
+    while(lod<max_lod && screen_size<lod1_screen_size/float(1<<lod)*(1.0f-lod_hysteresis))
+        ++lod;
+
+    state->lod=lod;
+    return m_lod=lod;
+}
+
 void mesh::draw(const char *pass_name) const
 {
     if(!pass_name)
         return;
 
-    if(internal().m_has_aabb && frustum_cull_enabled && !get_camera().get_frustum().test_intersect(get_aabb()))
+    if(frustum_cull_enabled && !internal().get_visibility().visible)
+        return;
+
+    const int lod=internal().select_lod();
+    if(!lod)
+    {
+        for(int i=0;i<get_groups_count();++i)
+            draw_group(i,pass_name);
+
         return;
+    }
+
+    const shared_mesh::lod &l=internal().m_shared->lods[lod-1];
+
+    transform::set(internal().m_transform);
+    shader_internal::set_skeleton(&internal().m_skeleton);
 
-    for(int i=0;i<get_groups_count();++i)
-        draw_group(i,pass_name);
+    const bool stats=nya_render::statistics::enabled();
+    unsigned int lod_count=0;
+
+    for(int i=0;i<(int)l.groups.size();++i)
+    {
+        const shared_mesh::group &g=l.groups[i];
+        int mat_idx=l.lod0_groups[i]>=0?internal().get_mat_idx(l.lod0_groups[i]):int(g.material_idx);
+        if(mat_idx<0 || mat_idx>=internal().get_materials_count())
+            continue;
+
+        if(internal().mat(mat_idx).get_pass_idx(pass_name)<0)
+            continue;
+
+        internal().draw_group(g,mat_idx,pass_name);
+        if(stats)
+            lod_count+=get_poly_count(g);
+    }
+
+    shader_internal::set_skeleton(0);
+
+    if(stats)
+    {
+        //only groups lod 0 would draw in this pass, same checks as draw_group
+        unsigned int lod0_count=0;
+        for(int i=0;i<get_groups_count();++i)
+        {
+            const int mat_idx=internal().get_mat_idx(i);
+            if(mat_idx<0 || internal().mat(mat_idx).get_pass_idx(pass_name)<0)
+                continue;
+
+            if(frustum_cull_enabled && !internal().is_group_visible(i))
+                continue;
+
+            lod0_count+=get_poly_count(internal().m_shared->groups[i]);
+        }
+
+        if(lod0_count>lod_count)
+            nya_render::statistics::get().lod_saved_poly_count+=lod0_count-lod_count;
+    }
 }
 
 void mesh::draw_group(int idx,const char *pass_name) const
@@ -348,17 +828,8 @@ void mesh::draw_group(int idx,const char *pass_name) const
     if(internal().mat(mat_idx).get_pass_idx(pass_name)<0)
         return;
 
-    if(frustum_cull_enabled)
-    {
-        internal().update_aabb_transform();
-        if(internal().m_groups[idx].has_aabb)
-        {
-            if(!get_camera().get_frustum().test_intersect(internal().m_groups[idx].aabb))
-                return;
-        }
-        else if(internal().m_has_aabb && !get_camera().get_frustum().test_intersect(get_aabb()))
-            return;
-    }
+    if(frustum_cull_enabled && !internal().is_group_visible(idx))
+        return;
 
     transform::set(internal().m_transform);
     shader_internal::set_skeleton(&internal().m_skeleton);
@@ -368,6 +839,14 @@ void mesh::draw_group(int idx,const char *pass_name) const
     shader_internal::set_skeleton(0);
 }
 
+int mesh::get_lods_count() const
+{
+    if(!internal().m_shared.is_valid())
+        return 0;
+
+    return int(internal().m_shared->lods.size())+1;
+}
+
 int mesh::get_groups_count() const
 {
     if(!internal().m_shared.is_valid())
@@ -516,22 +995,39 @@ void mesh_internal::anim_update_mapping(applied_anim &a)
     if(!a.anim.is_valid() || !a.anim->m_shared.is_valid())
         return;
 
-    const nya_render::animation &ra=a.anim->m_shared->anim;
-    a.bones_map.resize(m_skeleton.get_bones_count(),-1);
+    const shared_animation &sa=*a.anim->m_shared.const_get();
+    const unsigned int skeleton_id=m_skeleton.get_definition().get_id();
+    const int bones_count=m_skeleton.get_bones_count();
 
-    if(a.anim->m_mask.is_valid())
+    const shared_animation::bones_mapping *mapping=0;
+    for(size_t i=0;i<sa.mappings.size();++i)
     {
-        for(int j=0;j<int(m_skeleton.get_bones_count());++j)
+        if(sa.mappings[i].skeleton_id==skeleton_id)
         {
-            const char *bone_name=m_skeleton.get_bone_name(j);
-            if(a.anim->m_mask->data.find(bone_name)!=a.anim->m_mask->data.end())
-                a.bones_map[j]=ra.get_bone_idx(bone_name);
+            mapping=&sa.mappings[i];
+            break;
         }
     }
-    else
+
+    if(!mapping)
     {
-        for(int j=0;j<int(m_skeleton.get_bones_count());++j)
-            a.bones_map[j]=ra.get_bone_idx(m_skeleton.get_bone_name(j));
+        sa.mappings.resize(sa.mappings.size()+1);
+        shared_animation::bones_mapping &m=sa.mappings.back();
+        m.skeleton_id=skeleton_id;
+        m.bones_map.resize(bones_count);
+        for(int j=0;j<bones_count;++j)
+            m.bones_map[j]=sa.anim.get_bone_idx(m_skeleton.get_bone_name(j));
+        mapping=&m;
+    }
+
+    a.bones_map=mapping->bones_map;
+    if(!a.anim->m_mask.is_valid())
+        return;
+
+    for(int j=0;j<bones_count;++j)
+    {
+        if(!a.anim->m_mask->get(a.bones_map[j]))
+            a.bones_map[j]= -1;
     }
 }
 
@@ -544,14 +1040,233 @@ void mesh_internal::update_aabb_transform() const
         return;
 
     m_recalc_aabb=false;
-    m_aabb=m_transform.transform_aabb(m_shared->aabb);
-    for(int i=0;i<(int)m_groups.size();++i)
+
+    const int bones_count=m_skeleton.get_bones_count();
+    const float *bones=m_shared->bones_aabb.empty() || !bones_count?0:m_skeleton.get_matrix_buffer();
+
+    nya_math::aabb local;
+    m_aabb=m_transform.transform_aabb(bones && get_animated_aabb(m_shared->bones_aabb,bones,bones_count,local)?local:m_shared->aabb);
+
+    const int count=(int)m_groups.size();
+    m_groups_aabb.resize(count*6);
+    float *ox=m_groups_aabb.empty()?0:&m_groups_aabb[0];
+    float *oy=ox+count,*oz=oy+count,*dx=oz+count,*dy=dx+count,*dz=dy+count;
+
+    for(int i=0;i<count;++i)
     {
-        if(!m_groups[i].has_aabb)
-            continue;
+        nya_math::aabb box;
+        if(bones && get_animated_aabb(m_shared->groups[i].bones_aabb,bones,bones_count,local))
+            box=m_groups[i].aabb=m_transform.transform_aabb(local);
+        else if(m_groups[i].has_aabb)
+            box=m_groups[i].aabb=m_transform.transform_aabb(m_shared->groups[i].aabb);
+        else if(m_has_aabb)
+            box=m_aabb;
+        else
+            box.delta=nya_math::vec3(1.0e+30f,1.0e+30f,1.0e+30f);
+
+        ox[i]=box.origin.x,oy[i]=box.origin.y,oz[i]=box.origin.z;
+        dx[i]=box.delta.x,dy[i]=box.delta.y,dz[i]=box.delta.z;
+    }
+
+    for(int i=0;i<2;++i)
+        m_visibility[i].frustum_version=0;
+}
+
+const mesh_internal::visibility &mesh_internal::get_visibility() const
+{
+    update_aabb_transform();
+
+    const camera &cam=get_camera();
+    const unsigned int version=cam.get_frustum_version();
+    for(int i=0;i<2;++i)
+    {
+        if(m_visibility[i].frustum_version==version)
+            return m_visibility[m_last_visibility=i];
+    }
+
+    m_last_visibility=1-m_last_visibility;
+    visibility &v=m_visibility[m_last_visibility];
+    v.frustum_version=version;
+
+    const nya_math::frustum &f=cam.get_frustum();
+    v.visible=!m_has_aabb || f.test_intersect(m_aabb);
+
+    const int count=(int)m_groups.size();
+    v.groups.resize(nya_math::frustum::get_visibility_size(count));
+    v.plane_hints.resize(nya_math::frustum::get_plane_hints_size(count));
+    if(count)
+    {
+        const float *ox=&m_groups_aabb[0];
+        const float *oy=ox+count,*oz=oy+count,*dx=oz+count,*dy=dx+count,*dz=dy+count;
+        f.test_intersect(ox,oy,oz,dx,dy,dz,count,&v.groups[0],&v.plane_hints[0]);
+    }
+
+    return v;
+}
+
+bool mesh_internal::is_group_visible(int idx) const
+{
+    const visibility &v=get_visibility();
+    if(idx<0 || idx>=(int)m_groups.size())
+        return v.visible;
+
+    return (v.groups[idx/32]>>(idx%32))&1;
+}
+
+const nya_math::triangle_tree *mesh_internal::get_geometry(const nya_math::vec3 *&verts) const
+{
+    if(!m_shared.is_valid())
+        return 0;
+
+    const shared_mesh::cpu_geometry &g=m_shared->geometry;
+    if(g.verts.empty())
+        return 0;
+
+    if(g.group_first_triangle.empty())
+        build_geometry_tree(*m_shared.const_get());
+
+    if(g.tree.is_empty())
+        return 0;
+
+    const int bones_count=m_skeleton.get_bones_count();
+    if(!bones_count || g.bone_idx.size()!=g.verts.size() || g.bone_weight.size()!=g.verts.size())
+    {
+        verts=&g.verts[0];
+        return &g.tree;
+    }
+
+    if(!m_skinned_verts_valid)
+    {
+        m_skinned_verts.resize(g.verts.size());
+        skin(&m_skinned_verts[0],0,int(g.verts.size()),false);
+
+        if(m_skinned_tree.is_empty())
+            m_skinned_tree=g.tree;
+
+        m_skinned_tree.refit(&m_skinned_verts[0]);
+        m_skinned_verts_valid=true;
+    }
+
+    verts=&m_skinned_verts[0];
+    return &m_skinned_tree;
+}
+
+int mesh_internal::get_skinning_verts_count() const
+{
+    if(!m_shared.is_valid() || !m_skeleton.get_bones_count())
+        return 0;
 
-        m_groups[i].aabb=m_transform.transform_aabb(m_shared->groups[i].aabb);
+    const shared_mesh::cpu_geometry &g=m_shared->geometry;
+    if(g.bone_idx.size()!=g.verts.size() || g.bone_weight.size()!=g.verts.size())
+        return 0;
+
+    return int(g.verts.size());
+}
+
+bool mesh_internal::skin(nya_math::vec3 *result,int from,int count,bool dual_quat) const
+{
+    const int verts_count=get_skinning_verts_count();
+    if(!result || from<0 || count<0 || from+count>verts_count)
+        return false;
+
+    const shared_mesh::cpu_geometry &g=m_shared->geometry;
+    if(dual_quat)
+    {
+        nya_math::skin_dq(m_skeleton.get_dual_quat_buffer(),m_skeleton.get_bones_count(),&g.verts[from],
+                          &g.bone_idx[from],&g.bone_weight[from],result,count);
+    }
+    else
+    {
+        nya_math::skin(m_skeleton.get_matrix_buffer(),m_skeleton.get_bones_count(),&g.verts[from],
+                       &g.bone_idx[from],&g.bone_weight[from],result,count);
     }
+
+    return true;
+}
+
+int mesh_internal::get_triangle_group(int triangle_idx) const
+{
+    const std::vector<int> &first=m_shared->geometry.group_first_triangle;
+    const int idx=int(std::upper_bound(first.begin(),first.end(),triangle_idx)-first.begin())-1;
+    return idx>=0 && idx<int(first.size())-1?idx:-1;
+}
+
+bool mesh::raycast(const nya_math::vec3 &origin,const nya_math::vec3 &dir,float max_dist,float *hit_dist,int *group_idx) const
+{
+    const nya_math::vec3 *verts=0;
+    const nya_math::triangle_tree *tree=internal().get_geometry(verts);
+    if(!tree)
+        return false;
+
+    //transform is linear, distances along dir are the same in local space
+    const transform &tr=internal().m_transform;
+    const nya_math::vec3 local_origin=tr.inverse_transform(origin);
+    const nya_math::vec3 local_dir=tr.inverse_transform(origin+dir)-local_origin;
+
+    const int tri=tree->raycast(verts,local_origin,local_dir,max_dist,hit_dist);
+    if(tri<0)
+        return false;
+
+    if(group_idx)
+        *group_idx=internal().get_triangle_group(tri);
+
+    return true;
+}
+
+bool mesh::prepare_skinning(bool dual_quat) const
+{
+    if(!get_skinning_verts_count())
+        return false;
+
+    //builds the lazy palette, skin reads it without changes until next update
+    const nya_render::skeleton &sk=get_skeleton();
+    return (dual_quat?sk.get_dual_quat_buffer():sk.get_matrix_buffer())!=0;
+}
+
+bool mesh::skin(nya_render::vbo &vbo,bool dual_quat) const
+{
+    const int count=get_skinning_verts_count();
+    if(!count)
+        return false;
+
+    nya_memory::tmp_buffer_scoped buf(count*sizeof(nya_math::vec3));
+    if(!skin((nya_math::vec3 *)buf.get_data(),0,count,dual_quat))
+        return false;
+
+    if(!vbo.set_vertex_data(buf.get_data(),sizeof(nya_math::vec3),count,nya_render::vbo::dynamic_draw))
+        return false;
+
+    vbo.set_vertices(0,3);
+    return true;
+}
+
+bool mesh::closest_point(const nya_math::vec3 &p,float max_dist,nya_math::vec3 &result,int *group_idx) const
+{
+    const nya_math::vec3 *verts=0;
+    const nya_math::triangle_tree *tree=internal().get_geometry(verts);
+    if(!tree)
+        return false;
+
+    const transform &tr=internal().m_transform;
+    const nya_math::vec3 s=nya_math::vec3::abs(tr.get_scale());
+    const float min_scale=nya_math::min(nya_math::min(s.x,s.y),s.z);
+    if(min_scale<0.0001f)
+        return false;
+
+    nya_math::vec3 local_result;
+    const int tri=tree->get_closest(verts,tr.inverse_transform(p),max_dist/min_scale,&local_result);
+    if(tri<0)
+        return false;
+
+    const nya_math::vec3 r=tr.transform_vec(local_result);
+    if((r-p).length_sq()>max_dist*max_dist)
+        return false;
+
+    result=r;
+    if(group_idx)
+        *group_idx=internal().get_triangle_group(tri);
+
+    return true;
 }
 
 const animation_proxy & mesh::get_anim(int layer) const
@@ -676,57 +1391,71 @@ void mesh_internal::update(unsigned int dt)
         a.full_weight=(fabsf(1.0f-a.anim->m_weight)<eps);
     }
 
-    for(int i=0;i<m_skeleton.get_bones_count();++i)
+    const int bones_count=m_skeleton.get_bones_count();
+    m_pose_pos.assign(bones_count,nya_math::vec3());
+    m_pose_rot.assign(bones_count,nya_math::quat());
+    m_layer_pos.resize(bones_count);
+    m_layer_rot.resize(bones_count);
+
+    for(int j=0;j<(int)m_anims.size();++j)
     {
-        nya_math::vec3 pos;
-        nya_math::quat rot;
+        applied_anim &a=m_anims[j];
+        const int count=std::min((int)a.bones_map.size(),bones_count);
+        if(count<=0)
+            continue;
+
+        const unsigned int time=(unsigned int)a.time+a.anim->m_range_from;
+        a.anim->m_shared->anim.sample_pose(time,a.anim->get_loop(),&a.bones_map[0],count,&m_layer_pos[0],&m_layer_rot[0],a.cursor);
 
-        for(int j=0;j<(int)m_anims.size();++j)
+        const float weight=a.anim->m_weight;
+        for(int i=0;i<count;++i)
         {
-            const applied_anim &a=m_anims[j];
-            if(i>=(int)a.bones_map.size() || a.bones_map[i]<0)
+            if(a.bones_map[i]<0)
                 continue;
 
-            const unsigned int time=(unsigned int)a.time+a.anim->m_range_from;
-            nya_math::vec3 bone_pos=a.anim->m_shared->anim.get_bone_pos(a.bones_map[i],time,a.anim->get_loop());
-            nya_math::quat bone_rot=a.anim->m_shared->anim.get_bone_rot(a.bones_map[i],time,a.anim->get_loop());
+            nya_math::vec3 &bone_pos=m_layer_pos[i];
+            nya_math::quat &bone_rot=m_layer_rot[i];
             if(!a.full_weight)
-                bone_pos*=a.anim->m_weight,bone_rot.apply_weight(a.anim->m_weight);
+                bone_pos*=weight,bone_rot.apply_weight(weight);
 
             if(j==0)
-                pos=bone_pos,rot=bone_rot;
+                m_pose_pos[i]=bone_pos,m_pose_rot[i]=bone_rot;
             else
-                pos+=bone_pos,rot=rot*bone_rot;
+                m_pose_pos[i]+=bone_pos,m_pose_rot[i]=m_pose_rot[i]*bone_rot;
         }
+    }
 
-        bone_control_map::const_iterator it=m_bone_controls.find(i);
-        if(it!=m_bone_controls.end())
-        {
-            const bone_control &b=it->second;
+    for(bone_control_map::const_iterator it=m_bone_controls.begin();it!=m_bone_controls.end();++it)
+    {
+        if(it->first<0 || it->first>=bones_count)
+            continue;
 
-            switch(b.pos_ctrl)
-            {
-                case bone_override: pos=b.pos; break;
-                case bone_additive: pos+=b.pos; break;
-                case bone_free: break;
-            }
+        const bone_control &b=it->second;
+        nya_math::vec3 &pos=m_pose_pos[it->first];
+        nya_math::quat &rot=m_pose_rot[it->first];
 
-            switch(b.rot_ctrl)
-            {
-                case bone_override: rot=b.rot; break;
-                case bone_additive: rot=rot*b.rot; break;
-                case bone_free: break;
-            }
+        switch(b.pos_ctrl)
+        {
+            case bone_override: pos=b.pos; break;
+            case bone_additive: pos+=b.pos; break;
+            case bone_free: break;
         }
 
-        m_skeleton.set_bone_transform(i,pos,rot);
+        switch(b.rot_ctrl)
+        {
+            case bone_override: rot=b.rot; break;
+            case bone_additive: rot=rot*b.rot; break;
+            case bone_free: break;
+        }
     }
 
-    m_skeleton.update();
+    for(int i=0;i<bones_count;++i)
+        m_skeleton.set_bone_transform(i,m_pose_pos[i],m_pose_rot[i]);
 
-    const int mat_count=get_materials_count();
-    for(int i=0;i<mat_count;++i)
-        mat(i).internal().skeleton_changed(&m_skeleton);
+    m_skeleton.update();
+    m_skinned_verts_valid=false;
+    if(!m_shared->bones_aabb.empty())
+        m_recalc_aabb=true;
 }
 
 const nya_math::aabb &mesh::get_aabb() const
@@ -737,4 +1466,14 @@ const nya_math::aabb &mesh::get_aabb() const
 
 void mesh::set_frustum_cull(bool enable) { frustum_cull_enabled=enable; }
 
+void mesh::set_lod_screen_size(float lod1_size,float hysteresis)
+{
+    lod1_screen_size=lod1_size;
+    lod_hysteresis=nya_math::clamp(hysteresis,0.0f,0.9f);
+}
+
+void mesh::set_lod_bias(float bias) { lod_bias_scale=powf(2.0f,-bias); }
+
+void mesh::set_keep_geometry(bool keep) { keep_geometry=keep; }
+
 }
@@ -10,6 +10,7 @@
 #include "render/skeleton.h"
 #include "math/vector.h"
 #include "math/frustum.h"
+#include "math/triangle_tree.h"
 #include "transform.h"
 
 namespace nya_scene
@@ -20,10 +21,22 @@ struct shared_mesh
     nya_math::aabb aabb;
     nya_render::vbo vbo;
 
+    //bind pose bounds of vertices weighted to the bone, animated bounds are their union transformed by the pose
+    struct bone_aabb
+    {
+        int bone_idx;
+        nya_math::aabb aabb;
+
+        bone_aabb(): bone_idx(-1) {}
+    };
+
+    std::vector<bone_aabb> bones_aabb; //empty if not skinned
+
     struct group
     {
         std::string name;
         nya_math::aabb aabb;
+        std::vector<bone_aabb> bones_aabb;
         unsigned int material_idx;
         unsigned int offset;
         unsigned int count;
@@ -33,16 +46,54 @@ struct shared_mesh
     };
 
     std::vector<group> groups;
+
+    struct lod
+    {
+        std::vector<group> groups;
+        std::vector<int> lod0_groups; //groups idx sharing the material slot, -1 if none
+
+        unsigned int get_poly_count() const;
+    };
+
+    std::vector<lod> lods; //lower detail lods, lods[i] is lod i+1, groups is lod 0
+
     std::vector<material> materials;
     nya_render::skeleton skeleton;
 
+    //cpu copy of vertex positions for picking, kept from load unless disabled with mesh::set_keep_geometry
+    struct cpu_geometry
+    {
+        std::vector<nya_math::vec3> verts;
+        std::vector<unsigned int> indices; //same as vbo indices, empty if not indexed
+
+        //optional, for picking with skinned pose: up to 4 bones per vertex, unused weights are zero
+        std::vector<nya_math::vec4> bone_idx;
+        std::vector<nya_math::vec4> bone_weight;
+
+        //built on first query from lod 0 triangle groups, shared by mesh instances
+        mutable nya_math::triangle_tree tree;
+        mutable std::vector<unsigned int> triangles; //3 vertex indices per triangle
+        mutable std::vector<int> group_first_triangle;
+
+        void clear() { *this=cpu_geometry(); }
+    };
+
+    cpu_geometry geometry;
+
+    //rebuilds bones_aabb and groups bones_aabb from vertices with bone weights, call after groups are set
+    //loaders which don't keep geometry may pass a temporary one
+    void update_bones_aabb(const cpu_geometry &g);
+
     bool release()
     {
         aabb=nya_math::aabb();
+        bones_aabb.clear();
         vbo.release();
         groups.clear();
+        lods.clear();
         materials.clear();
         skeleton=nya_render::skeleton();
+        geometry.clear();
 
         if(add_data)
         {
@@ -66,6 +117,8 @@ struct shared_mesh
 
 typedef proxy<animation> animation_proxy;
 
+class camera;
+
 class mesh_internal: public scene_shared<shared_mesh>
 {
     friend class mesh;
@@ -75,9 +128,11 @@ public:
     const nya_render::skeleton &get_skeleton() const { return m_skeleton; }
 
 private:
-    mesh_internal(): m_recalc_aabb(true), m_has_aabb(false) {}
+    mesh_internal(): m_recalc_aabb(true), m_has_aabb(false), m_last_visibility(0), m_lod(0), m_last_lod_state(0), m_forced_lod(-1), m_skinned_verts_valid(false) {}
 
     void draw_group(int idx, const char *pass_name) const;
+    void draw_group(const shared_mesh::group &g,int mat_idx,const char *pass_name) const;
+    int select_lod() const;
     bool init_from_shared();
 
     int get_materials_count() const;
@@ -90,6 +145,7 @@ private:
         float time;
         std::vector<int> bones_map;
         animation_proxy anim;
+        nya_render::animation::cursor cursor;
         unsigned int version;
         bool full_weight;
 
@@ -104,6 +160,25 @@ private:
 
     void update_aabb_transform() const;
 
+    struct visibility
+    {
+        unsigned int frustum_version;
+        bool visible;
+        std::vector<unsigned int> groups;
+        std::vector<unsigned char> plane_hints;
+
+        visibility(): frustum_version(0),visible(true) {}
+    };
+
+    const visibility &get_visibility() const; //for the active camera
+    bool is_group_visible(int idx) const;
+
+    //local space geometry in the current pose, 0 if none
+    const nya_math::triangle_tree *get_geometry(const nya_math::vec3 *&verts) const;
+    int get_skinning_verts_count() const; //kept geometry with bone weights, 0 if none
+    bool skin(nya_math::vec3 *result,int from,int count,bool dual_quat) const;
+    int get_triangle_group(int triangle_idx) const;
+
 private:
     enum bone_control_mode
     {
@@ -126,6 +201,8 @@ private:
 
     nya_render::skeleton m_skeleton;
     std::vector<applied_anim> m_anims;
+    std::vector<nya_math::vec3> m_pose_pos,m_layer_pos; //update buffers, by skeleton bone idx
+    std::vector<nya_math::quat> m_pose_rot,m_layer_rot;
     typedef std::map<int,bone_control> bone_control_map;
     bone_control_map m_bone_controls;
 
@@ -145,6 +222,30 @@ private:
     };
 
     std::vector<group> m_groups;
+    mutable std::vector<float> m_groups_aabb; //soa: origin x,y,z, delta x,y,z
+
+    //culling results are reused by passes with the same camera, two cameras are typical for shadows
+    mutable visibility m_visibility[2];
+    mutable int m_last_visibility;
+
+    mutable int m_lod;
+
+    //lod hysteresis is kept per camera, so shadow and main passes don't flip each other's lod
+    struct lod_state
+    {
+        const camera *cam;
+        int lod;
+
+        lod_state(): cam(0),lod(0) {}
+    };
+
+    mutable lod_state m_lod_state[2];
+    mutable int m_last_lod_state;
+    int m_forced_lod;
+
+    mutable std::vector<nya_math::vec3> m_skinned_verts;
+    mutable nya_math::triangle_tree m_skinned_tree;
+    mutable bool m_skinned_verts_valid;
 };
 
 class mesh
@@ -161,7 +262,20 @@ public:
     void draw(const char *pass_name=material::default_pass) const;
     void draw_group(int group_idx,const char *pass_name=material::default_pass) const;
 
-    const nya_math::aabb &get_aabb() const;
+    const nya_math::aabb &get_aabb() const; //animated if the mesh has bone weights, see bones_aabb
+
+    // picking against lod 0 triangles in world space, with current skinned pose if geometry has bone weights
+    //dir length is the unit of distances, closest_point distances are exact for uniform scale only
+    bool raycast(const nya_math::vec3 &origin,const nya_math::vec3 &dir,float max_dist,float *hit_dist=0,int *group_idx=0) const;
+    bool closest_point(const nya_math::vec3 &p,float max_dist,nya_math::vec3 &result,int *group_idx=0) const;
+
+    // cpu skinning of kept geometry with current pose, local space positions by vbo vertex idx
+    //false if geometry isn't kept or has no bone weights, dual_quat blends dual quaternions instead of matrices
+    //ranges of the same pose may be skinned from several threads after prepare_skinning on the updating thread
+    int get_skinning_verts_count() const { return internal().get_skinning_verts_count(); }
+    bool prepare_skinning(bool dual_quat=false) const;
+    bool skin(nya_math::vec3 *result,int from,int count,bool dual_quat=false) const { return internal().skin(result,from,count,dual_quat); }
+    bool skin(nya_render::vbo &vbo,bool dual_quat=false) const; //all vertices, positions only, dynamic usage
 
     // transform
     const nya_math::vec3 &get_pos() const { return internal().m_transform.get_pos(); }
@@ -182,6 +296,11 @@ public:
     material &modify_material(int group_idx);
     bool set_material(int group_idx,const material &mat);
 
+    // lods
+    int get_lods_count() const;
+    int get_lod() const { return internal().m_lod; } //last drawn lod
+    void set_lod(int lod) { m_internal.m_forced_lod=lod; } //-1 for screen size selection
+
     // skeleton
     const nya_render::skeleton &get_skeleton() const { return internal().m_skeleton; }
     int get_bones_count() const { return get_skeleton().get_bones_count(); }
@@ -214,8 +333,19 @@ public:
 public:
     static void set_frustum_cull(bool enable);
 
+    //lod 1 is selected when bounds cover less than lod1_screen_size of the screen height, each next lod at half size
+    //hysteresis is relative band around switch points, bias is in lod levels, positive bias selects coarser lods
+    static void set_lod_screen_size(float lod1_screen_size,float hysteresis=0.1f);
+    static void set_lod_bias(float bias);
+
+    //keep cpu copy of nms vertex positions for picking, enabled by default
+    //bone indices and weights are taken from tc with semantics containing "bone" and "weight"
+    static void set_keep_geometry(bool keep);
+
 public:
     static bool load_nms(shared_mesh &res,resource_data &data,const char* name);
+    //data may point to a mapped file, nms v3 vertex and index data is passed to vbo without intermediate copy
+    static bool load_nms(shared_mesh &res,const void *data,size_t size,const char* name);
     static bool load_nms_mesh_section(shared_mesh &res,const void *data,size_t size,int version);
     static bool load_nms_skeleton_section(shared_mesh &res,const void *data,size_t size,int version);
     static bool load_nms_material_section(shared_mesh &res,const void *data,size_t size,int version);
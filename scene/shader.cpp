@@ -151,6 +151,7 @@ bool load_nya_shader_internal(shared_shader &res,shader_description &desc,resour
             const char *predefined_semantics[]={"nya camera pos","nya camera rot","nya camera dir",
                                                 "nya bones pos","nya bones pos transform","nya bones rot",
                                                 "nya bones pos texture","nya bones pos transform texture","nya bones rot texture",
+                                                "nya bones matrix","nya bones matrix texture",
                                                 "nya viewport","nya model pos","nya model rot","nya model scale"};
 
             char predefined_count_static_assert[sizeof(predefined_semantics)/sizeof(predefined_semantics[0])
@@ -173,6 +174,11 @@ bool load_nya_shader_internal(shared_shader &res,shader_description &desc,resour
                         res.texture_buffers.allocate();
                         res.texture_buffers->skeleton_rot_max_count=int(parser.get_section_value_vector(section_idx).x);
                     }
+                    else if(i==shared_shader::bones_mat_tex)
+                    {
+                        res.texture_buffers.allocate();
+                        res.texture_buffers->skeleton_mat_max_count=int(parser.get_section_value_vector(section_idx).x);
+                    }
 
                     break;
                 }
@@ -230,7 +236,7 @@ bool load_nya_shader_internal(shared_shader &res,shader_description &desc,resour
 
         res.predefines.resize(res.predefines.size()+1);
         res.predefines.back().type=(shared_shader::predefined_values)i;
-        if(i==shared_shader::bones_pos_tex || i==shared_shader::bones_pos_tr_tex || i==shared_shader::bones_rot_tex)
+        if(i==shared_shader::bones_pos_tex || i==shared_shader::bones_pos_tr_tex || i==shared_shader::bones_rot_tex || i==shared_shader::bones_mat_tex)
         {
             res.predefines.back().location=res.shdr.get_sampler_layer(p.name.c_str());
             continue;
@@ -353,35 +359,40 @@ void shader_internal::set() const
 
             case shared_shader::bones_pos:
             {
-                if(m_skeleton && m_shared->last_skeleton_pos!=m_skeleton)
+                if(m_skeleton && p.skeleton_version!=m_skeleton->get_version())
                 {
                     m_shared->shdr.set_uniform3_array(p.location,m_skeleton->get_pos_buffer(),m_skeleton->get_bones_count());
-                    m_shared->last_skeleton_pos=m_skeleton;
+                    p.skeleton_version=m_skeleton->get_version();
                 }
             }
             break;
 
             case shared_shader::bones_pos_tr:
             {
-                if(m_skeleton && m_shared->last_skeleton_pos!=m_skeleton)
+                if(m_skeleton && p.skeleton_version!=m_skeleton->get_version())
                 {
-                    nya_memory::tmp_buffer_scoped tmp(m_skeleton->get_bones_count()*3*4);
-                    nya_math::vec3 *pos=(nya_math::vec3 *)tmp.get_data();
-                    for(int i=0;i<m_skeleton->get_bones_count();++i)
-                        pos[i]=m_skeleton->get_bone_pos(i)+m_skeleton->get_bone_rot(i).rotate(-m_skeleton->get_bone_original_pos(i));
-
-                    m_shared->shdr.set_uniform3_array(p.location,(float *)tmp.get_data(),m_skeleton->get_bones_count());
-                    m_shared->last_skeleton_pos=m_skeleton;
+                    m_shared->shdr.set_uniform3_array(p.location,m_skeleton->get_pos_tr_buffer(),m_skeleton->get_bones_count());
+                    p.skeleton_version=m_skeleton->get_version();
                 }
             }
             break;
 
             case shared_shader::bones_rot:
             {
-                if(m_skeleton && m_shared->last_skeleton_rot!=m_skeleton)
+                if(m_skeleton && p.skeleton_version!=m_skeleton->get_version())
                 {
                     m_shared->shdr.set_uniform4_array(p.location,m_skeleton->get_rot_buffer(),m_skeleton->get_bones_count());
-                    m_shared->last_skeleton_rot=m_skeleton;
+                    p.skeleton_version=m_skeleton->get_version();
+                }
+            }
+            break;
+
+            case shared_shader::bones_mat:
+            {
+                if(m_skeleton && p.skeleton_version!=m_skeleton->get_version())
+                {
+                    m_shared->shdr.set_uniform4_array(p.location,m_skeleton->get_matrix_buffer(),m_skeleton->get_bones_count()*3);
+                    p.skeleton_version=m_skeleton->get_version();
                 }
             }
             break;
@@ -391,11 +402,11 @@ void shader_internal::set() const
                 if(!m_shared->texture_buffers.is_valid())
                     m_shared->texture_buffers.allocate();
 
-                if(m_skeleton && m_shared->texture_buffers->last_skeleton_pos_texture!=m_skeleton && m_skeleton->get_bones_count()>0)
+                if(m_skeleton && p.skeleton_version!=m_skeleton->get_version() && m_skeleton->get_bones_count()>0)
                 {
                     build_bones_texture(m_shared->texture_buffers->skeleton_pos_texture,m_skeleton->get_pos_buffer(),
                                         m_skeleton->get_bones_count(),m_shared->texture_buffers->skeleton_pos_max_count,nya_render::texture::color_rgb32f);
-                    m_shared->texture_buffers->last_skeleton_pos_texture=m_skeleton;
+                    p.skeleton_version=m_skeleton->get_version();
                 }
 
                 m_shared->texture_buffers->skeleton_pos_texture.bind(p.location);
@@ -407,16 +418,11 @@ void shader_internal::set() const
                 if(!m_shared->texture_buffers.is_valid())
                     m_shared->texture_buffers.allocate();
 
-                if(m_skeleton && m_shared->texture_buffers->last_skeleton_pos_texture!=m_skeleton && m_skeleton->get_bones_count()>0)
+                if(m_skeleton && p.skeleton_version!=m_skeleton->get_version() && m_skeleton->get_bones_count()>0)
                 {
-                    nya_memory::tmp_buffer_scoped tmp(m_skeleton->get_bones_count()*3*4);
-                    nya_math::vec3 *pos=(nya_math::vec3 *)tmp.get_data();
-                    for(int i=0;i<m_skeleton->get_bones_count();++i)
-                        pos[i]=m_skeleton->get_bone_pos(i)+m_skeleton->get_bone_rot(i).rotate(-m_skeleton->get_bone_original_pos(i));
-
-                    build_bones_texture(m_shared->texture_buffers->skeleton_pos_texture,tmp.get_data(),
+                    build_bones_texture(m_shared->texture_buffers->skeleton_pos_texture,m_skeleton->get_pos_tr_buffer(),
                                         m_skeleton->get_bones_count(),m_shared->texture_buffers->skeleton_pos_max_count,nya_render::texture::color_rgb32f);
-                    m_shared->texture_buffers->last_skeleton_pos_texture=m_skeleton;
+                    p.skeleton_version=m_skeleton->get_version();
                 }
 
                 m_shared->texture_buffers->skeleton_pos_texture.bind(p.location);
@@ -428,17 +434,33 @@ void shader_internal::set() const
                 if(!m_shared->texture_buffers.is_valid())
                     m_shared->texture_buffers.allocate();
 
-                if(m_skeleton && m_shared->texture_buffers->last_skeleton_rot_texture!=m_skeleton && m_skeleton->get_bones_count()>0)
+                if(m_skeleton && p.skeleton_version!=m_skeleton->get_version() && m_skeleton->get_bones_count()>0)
                 {
                     build_bones_texture(m_shared->texture_buffers->skeleton_rot_texture,m_skeleton->get_rot_buffer(),
                                         m_skeleton->get_bones_count(),m_shared->texture_buffers->skeleton_rot_max_count,nya_render::texture::color_rgba32f);
-                    m_shared->texture_buffers->last_skeleton_rot_texture=m_skeleton;
+                    p.skeleton_version=m_skeleton->get_version();
                 }
 
                 m_shared->texture_buffers->skeleton_rot_texture.bind(p.location);
             }
             break;
 
+            case shared_shader::bones_mat_tex:
+            {
+                if(!m_shared->texture_buffers.is_valid())
+                    m_shared->texture_buffers.allocate();
+
+                if(m_skeleton && p.skeleton_version!=m_skeleton->get_version() && m_skeleton->get_bones_count()>0)
+                {
+                    build_bones_texture(m_shared->texture_buffers->skeleton_mat_texture,m_skeleton->get_matrix_buffer(),
+                                        m_skeleton->get_bones_count()*3,m_shared->texture_buffers->skeleton_mat_max_count*3,nya_render::texture::color_rgba32f);
+                    p.skeleton_version=m_skeleton->get_version();
+                }
+
+                m_shared->texture_buffers->skeleton_mat_texture.bind(p.location);
+            }
+            break;
+
             case shared_shader::viewport:
             {
                 nya_render::rect r=nya_render::get_viewport();
@@ -550,25 +572,13 @@ int shader_internal::get_uniforms_count() const
 
 const nya_render::skeleton *shader_internal::m_skeleton=0;
 
-void shader_internal::skeleton_changed(const nya_render::skeleton *skeleton) const
+void shader_internal::reset_skeleton()
 {
     if(!m_shared.is_valid())
         return;
 
-    //if(skeleton==m_shared->last_skeleton_pos)
-        m_shared->last_skeleton_pos=0;
-
-    if(skeleton==m_shared->last_skeleton_rot)
-        m_shared->last_skeleton_rot=0;
-
-    if(m_shared->texture_buffers.is_valid())
-    {
-        if(skeleton==m_shared->texture_buffers->last_skeleton_pos_texture)
-            m_shared->texture_buffers->last_skeleton_pos_texture=0;
-
-        if(skeleton==m_shared->texture_buffers->last_skeleton_rot_texture)
-            m_shared->texture_buffers->last_skeleton_rot_texture=0;
-    }
+    for(size_t i=0;i<m_shared->predefines.size();++i)
+        m_shared->predefines[i].skeleton_version=0;
 }
 
 }
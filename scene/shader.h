@@ -29,6 +29,8 @@ struct shared_shader
         bones_pos_tex,
         bones_pos_tr_tex,
         bones_rot_tex,
+        bones_mat,
+        bones_mat_tex,
         viewport,
         model_pos,
         model_rot,
@@ -49,8 +51,9 @@ struct shared_shader
         predefined_values type;
         int location;
         transform_type transform;
+        mutable unsigned int skeleton_version; //uploaded bones, skeleton versions are unique
 
-        predefined(): location(-1), transform(none) {}
+        predefined(): location(-1), transform(none), skeleton_version(0) {}
     };
 
     std::vector<predefined> predefines;
@@ -67,8 +70,6 @@ struct shared_shader
 
     std::vector<uniform> uniforms;
 
-	shared_shader():last_skeleton_pos(0),last_skeleton_rot(0){}
-
     bool release()
     {
         shdr.release();
@@ -79,9 +80,9 @@ struct shared_shader
         {
             texture_buffers->skeleton_pos_texture.release();
             texture_buffers->skeleton_rot_texture.release();
+            texture_buffers->skeleton_mat_texture.release();
             texture_buffers.free();
         }
-        last_skeleton_pos=last_skeleton_rot=0;
         return true;
     }
 
@@ -89,20 +90,15 @@ struct shared_shader
     {
         unsigned int skeleton_pos_max_count;
         unsigned int skeleton_rot_max_count;
+        unsigned int skeleton_mat_max_count;
         nya_render::texture skeleton_pos_texture;
         nya_render::texture skeleton_rot_texture;
-        const nya_render::skeleton *last_skeleton_pos_texture;
-        const nya_render::skeleton *last_skeleton_rot_texture;
+        nya_render::texture skeleton_mat_texture; //3 texels per bone
 
-        texture_buffers():skeleton_pos_max_count(0),skeleton_rot_max_count(0),
-                          last_skeleton_pos_texture(0),last_skeleton_rot_texture(0) {}
+        texture_buffers():skeleton_pos_max_count(0),skeleton_rot_max_count(0),skeleton_mat_max_count(0) {}
     };
 
     mutable nya_memory::optional<texture_buffers> texture_buffers;
-
-    //cache
-    const mutable nya_render::skeleton *last_skeleton_pos;
-    const mutable nya_render::skeleton *last_skeleton_rot;
 };
 
 class shader_internal: public scene_shared<shared_shader>
@@ -112,8 +108,7 @@ public:
     static void unset() { nya_render::shader::unbind(); }
 
     static void set_skeleton(const nya_render::skeleton *skeleton) { m_skeleton=skeleton; }
-    void reset_skeleton() { if(!m_shared.is_valid()) return; m_shared->last_skeleton_pos=0; m_shared->last_skeleton_rot=0; }
-    void skeleton_changed(const nya_render::skeleton *skeleton) const;
+    void reset_skeleton();
 
 public:
     int get_texture_slot(const char *semantic) const;
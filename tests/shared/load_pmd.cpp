@@ -66,7 +66,8 @@ bool pmd_loader::load(nya_scene::shared_mesh &res,nya_scene::resource_data &data
     if(!reader.check_remained(inds_size))
         return false;
 
-    res.vbo.set_index_data(data.get_data(reader.get_offset()),nya_render::vbo::index2b,ind_count);
+    const ushort *indices=(const ushort *)data.get_data(reader.get_offset());
+    res.vbo.set_index_data(indices,nya_render::vbo::index2b,ind_count);
     reader.skip(inds_size);
 
     const uint mat_count=reader.read<uint>();
@@ -335,6 +336,21 @@ bool pmd_loader::load(nya_scene::shared_mesh &res,nya_scene::resource_data &data
         }
     }
 
+    nya_scene::shared_mesh::cpu_geometry geometry; //for bone bounds only
+    geometry.verts.resize(vert_count);
+    geometry.bone_idx.resize(vert_count);
+    geometry.bone_weight.resize(vert_count);
+    for(uint i=0;i<vert_count;++i)
+    {
+        const vert &v=vertices[i];
+        geometry.verts[i]=v.pos;
+        geometry.bone_idx[i]=nya_math::vec4(v.bone_idx[0],v.bone_idx[1],0.0f,0.0f);
+        geometry.bone_weight[i]=nya_math::vec4(v.bone_weight,1.0f-v.bone_weight,0.0f,0.0f);
+    }
+
+    geometry.indices.assign(indices,indices+ind_count);
+    res.update_bones_aabb(geometry);
+
     res.vbo.set_vertex_data(&vertices[0],sizeof(vertices[0]),vert_count);
     res.vbo.set_normals(3*sizeof(float));
     res.vbo.set_tc(0,6*sizeof(float),2);
@@ -147,10 +147,11 @@ bool pmx_loader::load(nya_scene::shared_mesh &res,nya_scene::resource_data &data
     }
 
     const int indices_count=reader.read<int>();
+    const void *indices=reader.get_data();
     if(header.index_size==2)
-        res.vbo.set_index_data(reader.get_data(),nya_render::vbo::index2b,indices_count);
+        res.vbo.set_index_data(indices,nya_render::vbo::index2b,indices_count);
     else if(header.index_size==4)
-        res.vbo.set_index_data(reader.get_data(),nya_render::vbo::index4b,indices_count);
+        res.vbo.set_index_data(indices,nya_render::vbo::index4b,indices_count);
     else
     {
         nya_log::log()<<"pmx load error: invalid index size\n";
@@ -623,6 +624,24 @@ bool pmx_loader::load(nya_scene::shared_mesh &res,nya_scene::resource_data &data
         }
     }
 
+    nya_scene::shared_mesh::cpu_geometry geometry; //for bone bounds only
+    geometry.verts.resize(vert_count);
+    geometry.bone_idx.resize(vert_count);
+    geometry.bone_weight.resize(vert_count);
+    for(int i=0;i<vert_count;++i)
+    {
+        const vert &v=verts[i];
+        geometry.verts[i]=v.pos;
+        geometry.bone_idx[i]=nya_math::vec4(v.bone_idx[0],v.bone_idx[1],v.bone_idx[2],v.bone_idx[3]);
+        geometry.bone_weight[i]=nya_math::vec4(v.bone_weight[0],v.bone_weight[1],v.bone_weight[2],v.bone_weight[3]);
+    }
+
+    geometry.indices.resize(indices_count);
+    for(int i=0;i<indices_count;++i)
+        geometry.indices[i]=header.index_size==2?((const unsigned short *)indices)[i]:((const unsigned int *)indices)[i];
+
+    res.update_bones_aabb(geometry);
+
     res.vbo.set_vertex_data(&verts[0],sizeof(vert),vert_count);
     int offset=0;
     res.vbo.set_vertices(offset,3); offset+=sizeof(verts[0].pos);
@@ -0,0 +1,947 @@
+//https://code.google.com/p/nya-engine/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "math/vector.h"
+#include "math/matrix.h"
+#include "math/quaternion.h"
+#include "math/bezier.h"
+#include "math/frustum.h"
+#include "math/batch.h"
+#include "math/constants.h"
+#include "math/quadtree.h"
+#include "math/aabb_tree.h"
+#include "math/triangle_tree.h"
+#include "formats/string_convert.h"
+#include "render/animation.h"
+#include "render/skeleton.h"
+
+const char *help="Usage: bench_math [options]\n"
+                 "times nya_math kernels and animation sampling at several data sizes, prints ns per op and ops per second\n"
+                 "results are meaningful for optimized builds only, e.g. -DCMAKE_BUILD_TYPE=Release\n"
+                 "options:\n"
+                 "-filter %%str%% - run only benchmarks which name contains str\n"
+                 "-min_time %%ms%% - minimum measured time per benchmark and size, 100 by default\n"
+                 "-json %%file%% - write results as json\n"
+                 "-baseline %%file%% - compare with json results of a previous run,\n"
+                 "                   returns 1 if any benchmark is slower than the threshold\n"
+                 "-threshold %%percent%% - regression threshold for baseline comparison, 10 by default\n"
+                 "\n";
+
+namespace
+{
+
+float rnd() { return rand()/float(RAND_MAX); }
+float rnd(float from,float to) { return from+rnd()*(to-from); }
+nya_math::vec3 rnd_vec3(float r) { return nya_math::vec3(rnd(-r,r),rnd(-r,r),rnd(-r,r)); }
+nya_math::quat rnd_quat() { return nya_math::quat(rnd(-1.0f,1.0f),rnd(-1.0f,1.0f),rnd(-1.0f,1.0f),rnd(-1.0f,1.0f)).normalize(); }
+
+nya_math::mat4 rnd_mat4()
+{
+    nya_math::mat4 m;
+    m.translate(rnd_vec3(10.0f)).rotate(rnd_quat()).scale(rnd(0.5f,2.0f));
+    return m;
+}
+
+nya_math::frustum camera_frustum()
+{
+    nya_math::mat4 m;
+    m.perspective(60.0f,1.5f,1.0f,500.0f);
+    m.rotate(30.0f,0.0f,1.0f,0.0f);
+    m.translate(0.0f,-10.0f,0.0f);
+    return nya_math::frustum(m);
+}
+
+volatile float sink=0.0f;
+
+//run() performs get_ops_count() operations on data prepared for size
+struct benchmark
+{
+    virtual const char *name() const=0;
+    virtual void prepare(int size)=0;
+    virtual void run()=0;
+    virtual int get_ops_count() const=0;
+    virtual ~benchmark() {}
+};
+
+struct array_benchmark: public benchmark
+{
+    int count;
+    int get_ops_count() const { return count; }
+
+    array_benchmark(): count(0) {}
+};
+
+struct mat4_multiply: public array_benchmark
+{
+    std::vector<nya_math::mat4> a,b,r;
+
+    const char *name() const { return "mat4_multiply"; }
+    void prepare(int size) { count=size,a.resize(size),b.resize(size),r.resize(size); for(int i=0;i<size;++i) a[i]=rnd_mat4(),b[i]=rnd_mat4(); }
+    void run() { for(int i=0;i<count;++i) r[i]=a[i]*b[i]; sink+=r[count/2].m[3][0]; }
+};
+
+struct mat4_multiply_batch: public mat4_multiply
+{
+    const char *name() const { return "mat4_multiply_batch"; }
+    void run() { nya_math::multiply(&a[0],&b[0],&r[0],count); sink+=r[count/2].m[3][0]; }
+};
+
+struct mat4_invert: public mat4_multiply
+{
+    const char *name() const { return "mat4_invert"; }
+    void run() { for(int i=0;i<count;++i) r[i]=a[i],r[i].invert(); sink+=r[count/2].m[3][0]; }
+};
+
+struct quat_interpolation: public array_benchmark
+{
+    std::vector<nya_math::quat> a,b,r;
+    std::vector<float> k;
+
+    void prepare(int size)
+    {
+        count=size,a.resize(size),b.resize(size),r.resize(size),k.resize(size);
+        for(int i=0;i<size;++i)
+            a[i]=rnd_quat(),b[i]=rnd_quat(),k[i]=rnd();
+    }
+};
+
+struct quat_slerp: public quat_interpolation
+{
+    const char *name() const { return "quat_slerp"; }
+    void run() { for(int i=0;i<count;++i) r[i]=nya_math::quat::slerp(a[i],b[i],k[i]); sink+=r[count/2].w; }
+};
+
+struct quat_slerp_fast: public quat_interpolation
+{
+    const char *name() const { return "quat_slerp_fast"; }
+    void run() { for(int i=0;i<count;++i) r[i]=nya_math::quat::slerp_fast(a[i],b[i],k[i]); sink+=r[count/2].w; }
+};
+
+struct quat_nlerp: public quat_interpolation
+{
+    const char *name() const { return "quat_nlerp"; }
+    void run() { for(int i=0;i<count;++i) r[i]=nya_math::quat::nlerp(a[i],b[i],k[i]); sink+=r[count/2].w; }
+};
+
+struct quat_slerp_n: public quat_interpolation
+{
+    const char *name() const { return "quat_slerp_n"; }
+    void run() { nya_math::slerp_n(&a[0],&b[0],&k[0],&r[0],count); sink+=r[count/2].w; }
+};
+
+struct quat_rotate: public array_benchmark
+{
+    std::vector<nya_math::quat> q;
+    std::vector<nya_math::vec3> v,r;
+
+    const char *name() const { return "quat_rotate"; }
+    void prepare(int size) { count=size,q.resize(size),v.resize(size),r.resize(size); for(int i=0;i<size;++i) q[i]=rnd_quat(),v[i]=rnd_vec3(1.0f); }
+    void run() { for(int i=0;i<count;++i) r[i]=q[i].rotate(v[i]); sink+=r[count/2].x; }
+};
+
+struct quat_rotate_batch: public quat_rotate
+{
+    const char *name() const { return "quat_rotate_batch"; }
+    void run() { nya_math::rotate(&q[0],&v[0],&r[0],count); sink+=r[count/2].x; }
+};
+
+struct bezier_get: public array_benchmark
+{
+    std::vector<nya_math::bezier> curves;
+    std::vector<const nya_math::bezier *> curves_ptr;
+    std::vector<float> x,r;
+
+    const char *name() const { return "bezier_get"; }
+
+    void prepare(int size)
+    {
+        count=size,curves.resize(size),curves_ptr.resize(size),x.resize(size),r.resize(size);
+        for(int i=0;i<size;++i)
+        {
+            //vmd-like control points, 0-127 range
+            curves[i]=nya_math::bezier(rand()%128/127.0f,rand()%128/127.0f,rand()%128/127.0f,rand()%128/127.0f);
+            curves_ptr[i]=&curves[i];
+            x[i]=rnd();
+        }
+    }
+
+    void run() { for(int i=0;i<count;++i) r[i]=curves[i].get(x[i]); sink+=r[count/2]; }
+};
+
+struct bezier_get_batch: public bezier_get
+{
+    const char *name() const { return "bezier_get_batch"; }
+    void run() { nya_math::bezier::get(&curves_ptr[0],&x[0],&r[0],count); sink+=r[count/2]; }
+};
+
+struct frustum_aabb: public array_benchmark
+{
+    nya_math::frustum f;
+    std::vector<nya_math::aabb> boxes;
+    std::vector<float> soa;
+    std::vector<unsigned int> visibility;
+    std::vector<unsigned char> hints;
+
+    const char *name() const { return "frustum_aabb"; }
+
+    void prepare(int size)
+    {
+        count=size,f=camera_frustum(),boxes.resize(size),soa.resize(size*6);
+        visibility.resize(nya_math::frustum::get_visibility_size(size));
+        hints.resize(nya_math::frustum::get_plane_hints_size(size));
+        for(int i=0;i<size;++i)
+        {
+            boxes[i].origin=rnd_vec3(300.0f);
+            boxes[i].delta=nya_math::vec3(rnd(0.5f,5.0f),rnd(0.5f,5.0f),rnd(0.5f,5.0f));
+            for(int j=0;j<3;++j)
+                soa[j*size+i]=(&boxes[i].origin.x)[j],soa[(j+3)*size+i]=(&boxes[i].delta.x)[j];
+        }
+    }
+
+    void run() { int c=0; for(int i=0;i<count;++i) c+=f.test_intersect(boxes[i]); sink+=float(c); }
+};
+
+struct frustum_aabb_batch: public frustum_aabb
+{
+    const char *name() const { return "frustum_aabb_batch"; }
+
+    void run()
+    {
+        const float *s=&soa[0];
+        f.test_intersect(s,s+count,s+count*2,s+count*3,s+count*4,s+count*5,count,&visibility[0],&hints[0]);
+        sink+=float(visibility[0]&1);
+    }
+};
+
+struct aabb_transform: public array_benchmark
+{
+    std::vector<nya_math::aabb> boxes,r;
+    std::vector<nya_math::vec3> pos;
+    std::vector<nya_math::quat> rot;
+
+    const char *name() const { return "aabb_transform"; }
+
+    void prepare(int size)
+    {
+        count=size,boxes.resize(size),r.resize(size),pos.resize(size),rot.resize(size);
+        for(int i=0;i<size;++i)
+        {
+            boxes[i].origin=rnd_vec3(1.0f),boxes[i].delta=nya_math::vec3(rnd(),rnd(),rnd());
+            pos[i]=rnd_vec3(10.0f),rot[i]=rnd_quat();
+        }
+    }
+
+    void run()
+    {
+        const nya_math::vec3 scale(1.0f,2.0f,1.0f);
+        for(int i=0;i<count;++i)
+            r[i]=nya_math::aabb(boxes[i],pos[i],rot[i],scale);
+        sink+=r[count/2].origin.x;
+    }
+};
+
+//size is objects count, one op is one query
+struct tree_benchmark: public benchmark
+{
+    static const int queries_count=64;
+    std::vector<int> result;
+
+    int get_ops_count() const { return queries_count; }
+
+    static nya_math::aabb rnd_box(float world_size)
+    {
+        nya_math::aabb b;
+        b.origin=nya_math::vec3(rnd(-world_size,world_size),rnd(0.0f,20.0f),rnd(-world_size,world_size));
+        b.delta=nya_math::vec3(rnd(0.5f,3.0f),rnd(0.5f,3.0f),rnd(0.5f,3.0f));
+        return b;
+    }
+
+    static float world_size(int size) { return size>1000?size*0.5f:500.0f; }
+};
+
+struct quadtree_frustum: public tree_benchmark
+{
+    nya_math::quadtree tree;
+    nya_math::frustum f[queries_count];
+
+    const char *name() const { return "quadtree_frustum"; }
+
+    void prepare(int size)
+    {
+        const float ws=world_size(size);
+        int levels=0;
+        while((2<<levels)*16<ws*2) //about 16 units leaves
+            ++levels;
+
+        tree=nya_math::quadtree(-int(ws),-int(ws),int(ws)*2,int(ws)*2,levels);
+        for(int i=0;i<size;++i)
+            tree.add_object(rnd_box(ws),i);
+
+        for(int i=0;i<queries_count;++i)
+        {
+            nya_math::mat4 m;
+            m.perspective(60.0f,1.5f,1.0f,300.0f).rotate(rnd(0.0f,360.0f),0.0f,1.0f,0.0f);
+            m.translate(-rnd(-ws,ws),-10.0f,-rnd(-ws,ws));
+            f[i]=nya_math::frustum(m);
+        }
+
+        result.resize(size);
+    }
+
+    void run() { int c=0; for(int i=0;i<queries_count;++i) c+=tree.get_objects(f[i],&result[0],int(result.size())); sink+=float(c); }
+};
+
+struct quadtree_aabb: public quadtree_frustum
+{
+    nya_math::aabb boxes[queries_count];
+
+    const char *name() const { return "quadtree_aabb"; }
+
+    void prepare(int size)
+    {
+        quadtree_frustum::prepare(size);
+        for(int i=0;i<queries_count;++i)
+            boxes[i]=rnd_box(world_size(size)),boxes[i].delta*=10.0f;
+    }
+
+    void run() { int c=0; for(int i=0;i<queries_count;++i) c+=tree.get_objects(boxes[i],&result[0],int(result.size())); sink+=float(c); }
+};
+
+struct aabb_tree_frustum: public quadtree_frustum
+{
+    nya_math::aabb_tree atree;
+
+    const char *name() const { return "aabb_tree_frustum"; }
+
+    void prepare(int size)
+    {
+        quadtree_frustum::prepare(size);
+        atree=nya_math::aabb_tree();
+        for(int i=0;i<size;++i)
+            atree.add_object(tree.get_object_aabb(i),i);
+    }
+
+    void run() { int c=0; for(int i=0;i<queries_count;++i) c+=atree.get_objects(f[i],&result[0],int(result.size())); sink+=float(c); }
+};
+
+struct aabb_tree_raycast: public aabb_tree_frustum
+{
+    nya_math::vec3 origin[queries_count],dir[queries_count];
+
+    const char *name() const { return "aabb_tree_raycast"; }
+
+    void prepare(int size)
+    {
+        aabb_tree_frustum::prepare(size);
+        const float ws=world_size(size);
+        for(int i=0;i<queries_count;++i)
+        {
+            origin[i]=nya_math::vec3(rnd(-ws,ws),10.0f,rnd(-ws,ws));
+            dir[i]=nya_math::vec3(rnd(-1.0f,1.0f),rnd(-0.1f,0.1f),rnd(-1.0f,1.0f)).normalize();
+        }
+    }
+
+    void run() { int c=0; for(int i=0;i<queries_count;++i) c+=atree.raycast(origin[i],dir[i],1000.0f); sink+=float(c); }
+};
+
+struct triangle_tree_raycast: public tree_benchmark
+{
+    nya_math::triangle_tree tree;
+    std::vector<nya_math::vec3> verts;
+    std::vector<unsigned int> indices;
+    nya_math::vec3 origin[queries_count],dir[queries_count];
+
+    const char *name() const { return "triangle_tree_raycast"; }
+
+    void prepare(int size)
+    {
+        //size is triangles count, random small triangles on a sphere
+        verts.resize(size*3),indices.resize(size*3);
+        for(int i=0;i<size;++i)
+        {
+            const nya_math::vec3 c=nya_math::vec3::normalize(rnd_vec3(1.0f))*10.0f;
+            for(int j=0;j<3;++j)
+                verts[i*3+j]=c+rnd_vec3(0.5f),indices[i*3+j]=i*3+j;
+        }
+
+        tree.build(&verts[0],int(verts.size()),&indices[0],int(indices.size()));
+        for(int i=0;i<queries_count;++i)
+            origin[i]=rnd_vec3(20.0f),dir[i]=nya_math::vec3::normalize(rnd_vec3(1.0f)-origin[i]*0.05f);
+    }
+
+    void run() { int c=0; for(int i=0;i<queries_count;++i) c+=tree.raycast(&verts[0],origin[i],dir[i],100.0f); sink+=float(c); }
+};
+
+struct float_from_string: public array_benchmark
+{
+    std::vector<char> text;
+    std::vector<int> offsets;
+
+    const char *name() const { return "float_from_string"; }
+
+    void prepare(int size)
+    {
+        count=size,text.clear(),offsets.resize(size);
+        for(int i=0;i<size;++i)
+        {
+            char buf[64];
+            const int len=sprintf(buf,"%g",rnd(-1000.0f,1000.0f)*(rand()%2?0.001f:1.0f));
+            offsets[i]=int(text.size());
+            text.insert(text.end(),buf,buf+len+1);
+        }
+    }
+
+    void run()
+    {
+        float r=0.0f,f;
+        for(int i=0;i<count;++i)
+            nya_formats::float_from_string(&text[offsets[i]],64,f),r+=f;
+        sink+=r;
+    }
+};
+
+//300 bones rig sampled sequentially at 60 fps, size is keys per bone
+struct animation_sample: public benchmark
+{
+    enum { bones_count=300, frames_count=60, key_interval=33, frame_time=16 };
+
+    nya_render::animation anim;
+    unsigned int time;
+
+    const char *name() const { return "animation_sample"; }
+    int get_ops_count() const { return bones_count*frames_count; }
+
+    void prepare(int size)
+    {
+        anim.release(),time=0;
+        for(int i=0;i<bones_count;++i)
+        {
+            char name[32];
+            sprintf(name,"bone%d",i);
+            const int idx=anim.add_bone(name);
+            for(int j=0;j<size;++j)
+            {
+                anim.add_bone_pos_frame(idx,j*key_interval,rnd_vec3(1.0f));
+                anim.add_bone_rot_frame(idx,j*key_interval,rnd_quat());
+            }
+        }
+    }
+
+    virtual void sample(int bone,unsigned int t,nya_math::vec3 &pos,nya_math::quat &rot)
+    {
+        pos=anim.get_bone_pos(bone,t,true),rot=anim.get_bone_rot(bone,t,true);
+    }
+
+    void run()
+    {
+        nya_math::vec3 pos;
+        nya_math::quat rot;
+        float r=0.0f;
+        for(int i=0;i<frames_count;++i,time+=frame_time)
+        {
+            for(int j=0;j<bones_count;++j)
+                sample(j,time,pos,rot),r+=pos.x+rot.w;
+        }
+        sink+=r;
+    }
+};
+
+struct animation_sample_cursor: public animation_sample
+{
+    nya_render::animation::cursor cursor;
+
+    const char *name() const { return "animation_sample_cursor"; }
+
+    void sample(int bone,unsigned int t,nya_math::vec3 &pos,nya_math::quat &rot)
+    {
+        pos=anim.get_bone_pos(bone,t,true,cursor),rot=anim.get_bone_rot(bone,t,true,cursor);
+    }
+};
+
+struct animation_sample_pose: public animation_sample_cursor
+{
+    int bones_map[bones_count];
+    nya_math::vec3 pos[bones_count];
+    nya_math::quat rot[bones_count];
+
+    const char *name() const { return "animation_sample_pose"; }
+
+    void prepare(int size)
+    {
+        animation_sample::prepare(size);
+        for(int i=0;i<bones_count;++i)
+            bones_map[i]=i;
+    }
+
+    void run()
+    {
+        float r=0.0f;
+        for(int i=0;i<frames_count;++i,time+=frame_time)
+        {
+            anim.sample_pose(time,true,bones_map,bones_count,pos,rot,cursor);
+            r+=pos[i].x+rot[i].w;
+        }
+        sink+=r;
+    }
+};
+
+struct animation_sample_pose_fast: public animation_sample_pose
+{
+    const char *name() const { return "animation_sample_pose_fast"; }
+
+    void prepare(int size)
+    {
+        animation_sample_pose::prepare(size);
+        anim.set_rot_interpolation(nya_render::animation::rot_interpolation_slerp_fast);
+    }
+};
+
+struct animation_sample_pose_baked: public animation_sample_pose
+{
+    const char *name() const { return "animation_sample_pose_baked"; }
+
+    void prepare(int size)
+    {
+        animation_sample_pose::prepare(size);
+        anim.bake(key_interval);
+    }
+};
+
+//pmx-like 300 bones rig with iks, size is bound bones count
+struct skeleton_update: public benchmark
+{
+    enum { bones_count=300 };
+
+    nya_render::skeleton sk;
+    int frame;
+
+    const char *name() const { return "skeleton_update"; }
+    int get_ops_count() const { return bones_count; }
+
+    void prepare(int size)
+    {
+        sk=nya_render::skeleton(),frame=0;
+        for(int i=0;i<bones_count;++i)
+        {
+            char name[32];
+            sprintf(name,"bone%d",i);
+            sk.add_bone(name,rnd_vec3(1.0f),nya_math::quat(),i==0?-1:(i%10==0?rand()%i:i-1));
+        }
+
+        for(int i=0;i<4;++i)
+        {
+            const int ik=sk.add_ik(i*60+55,i*60+53,5,0.5f);
+            for(int j=2;j>=0;--j)
+                sk.add_ik_link(ik,i*60+50+j);
+        }
+
+        //grant bones are usually leaves or short chains
+        for(int i=0;i<size;++i)
+            sk.add_bound(rand()%bones_count,(i*7919)%bones_count/10*10+9,0.5f,i%2==0,true);
+    }
+
+    virtual int get_changed_count() const { return bones_count; }
+
+    void run()
+    {
+        const int count=get_changed_count();
+        ++frame;
+        for(int i=0;i<count;++i)
+            sk.set_bone_transform(count==bones_count?i:(i*31+frame)%bones_count,nya_math::vec3(0.0f,0.01f*(frame%7),0.0f),nya_math::quat());
+        sk.update();
+        sink+=sk.get_bone_pos(bones_count-1).x;
+    }
+};
+
+struct skeleton_update_partial: public skeleton_update
+{
+    const char *name() const { return "skeleton_update_partial"; }
+    int get_changed_count() const { return 5; }
+};
+
+//pmd-like leg iks: hip, pitch limited knee, ankle and a target moving in and out of reach, size is legs count
+struct skeleton_ik: public benchmark
+{
+    nya_render::skeleton sk;
+    std::vector<int> targets;
+    int frame;
+
+    const char *name() const { return "skeleton_ik"; }
+    int get_ops_count() const { return (int)targets.size(); }
+
+    void prepare(int size)
+    {
+        sk=nya_render::skeleton(),targets.clear(),frame=0;
+        const int root=sk.add_bone("root",nya_math::vec3());
+        for(int i=0;i<size;++i)
+        {
+            char name[32];
+            const float x=float(i)*2.0f;
+            sprintf(name,"hip%d",i);
+            const int hip=sk.add_bone(name,nya_math::vec3(x,8.0f,0.0f),nya_math::quat(),root);
+            sprintf(name,"knee%d",i);
+            const int knee=sk.add_bone(name,nya_math::vec3(x,4.2f,0.1f),nya_math::quat(),hip);
+            sprintf(name,"ankle%d",i);
+            const int ankle=sk.add_bone(name,nya_math::vec3(x,0.5f,-0.1f),nya_math::quat(),knee);
+            sprintf(name,"ik%d",i);
+            targets.push_back(sk.add_bone(name,nya_math::vec3(x,0.5f,-0.1f),nya_math::quat(),root));
+
+            const int ik=sk.add_ik(targets.back(),ankle,40,nya_math::constants::pi*0.5f);
+            sk.add_ik_link(ik,knee,0.001f,nya_math::constants::pi);
+            sk.add_ik_link(ik,hip);
+        }
+    }
+
+    void run()
+    {
+        ++frame;
+        for(int i=0;i<(int)targets.size();++i)
+        {
+            const float t=float(frame+i*7)*0.05f;
+            sk.set_bone_transform(targets[i]-2,nya_math::vec3(),nya_math::quat());
+            sk.set_bone_transform(targets[i],nya_math::vec3(0.5f*sinf(t),2.0f*sinf(t*1.3f),1.5f*cosf(t)),nya_math::quat());
+        }
+
+        sk.update();
+        sink+=sk.get_bone_pos(targets.back()-1).x;
+    }
+};
+
+struct skeleton_ik_ccd: public skeleton_ik
+{
+    const char *name() const { return "skeleton_ik_ccd"; }
+
+    void run()
+    {
+        nya_render::skeleton::set_analytic_ik(false);
+        skeleton_ik::run();
+        nya_render::skeleton::set_analytic_ik(true);
+    }
+};
+
+//hierarchy composition only, no iks and bounds, size is bones count
+struct skeleton_compose: public benchmark
+{
+    nya_render::skeleton sk;
+    int count,frame;
+
+    const char *name() const { return "skeleton_compose"; }
+    int get_ops_count() const { return count; }
+
+    void prepare(int size)
+    {
+        sk=nya_render::skeleton(),count=size,frame=0;
+        for(int i=0;i<count;++i)
+        {
+            char name[32];
+            sprintf(name,"bone%d",i);
+            sk.add_bone(name,rnd_vec3(1.0f),nya_math::quat(),i<8?i-1:i-1-rand()%8);
+        }
+    }
+
+    void run()
+    {
+        ++frame;
+        for(int i=0;i<count;++i)
+            sk.set_bone_transform(i,nya_math::vec3(0.0f,0.01f*(frame%7),0.0f),nya_math::quat());
+        sk.update();
+        sink+=sk.get_bone_pos(count-1).x;
+    }
+};
+
+//crowd spawn, copies share the skeleton definition
+struct skeleton_copy: public skeleton_update
+{
+    const char *name() const { return "skeleton_copy"; }
+
+    void run()
+    {
+        nya_render::skeleton copy=sk;
+        sink+=copy.get_bone_pos(bones_count-1).x;
+    }
+};
+
+//4 bones per vertex from a 100 bones pose, size is vertices count, ops/s is vertices per second
+struct skin_linear: public array_benchmark
+{
+    nya_render::skeleton sk;
+    std::vector<nya_math::vec3> verts,result;
+    std::vector<nya_math::vec4> bone_idx,bone_weight;
+
+    const char *name() const { return "skin_linear"; }
+
+    void prepare(int size)
+    {
+        const int bones_count=100;
+        sk=nya_render::skeleton(),count=size;
+        for(int i=0;i<bones_count;++i)
+        {
+            char name[32];
+            sprintf(name,"bone%d",i);
+            sk.add_bone(name,rnd_vec3(1.0f),nya_math::quat(),i-1);
+            sk.set_bone_transform(i,rnd_vec3(0.1f),rnd_quat());
+        }
+        sk.update();
+
+        verts.resize(size),result.resize(size),bone_idx.resize(size),bone_weight.resize(size);
+        for(int i=0;i<size;++i)
+        {
+            verts[i]=rnd_vec3(10.0f);
+            const int b=rand()%(bones_count-3);
+            bone_idx[i]=nya_math::vec4(float(b),float(b+1),float(b+2),float(b+3));
+            const nya_math::vec4 w(rnd(),rnd(),rnd(),rnd());
+            bone_weight[i]=w/(w.x+w.y+w.z+w.w);
+        }
+    }
+
+    void run()
+    {
+        nya_math::skin(sk.get_matrix_buffer(),sk.get_bones_count(),&verts[0],&bone_idx[0],&bone_weight[0],&result[0],count);
+        sink+=result[count-1].x;
+    }
+};
+
+struct skin_dq: public skin_linear
+{
+    const char *name() const { return "skin_dq"; }
+
+    void run()
+    {
+        nya_math::skin_dq(sk.get_dual_quat_buffer(),sk.get_bones_count(),&verts[0],&bone_idx[0],&bone_weight[0],&result[0],count);
+        sink+=result[count-1].x;
+    }
+};
+
+//per vertex quat rotations, as picking skinned before the palette
+struct skin_rotate: public skin_linear
+{
+    const char *name() const { return "skin_rotate"; }
+
+    void run()
+    {
+        const nya_math::vec3 *pos_tr=(const nya_math::vec3 *)sk.get_pos_tr_buffer();
+        for(int i=0;i<count;++i)
+        {
+            const float *idx=&bone_idx[i].x,*w=&bone_weight[i].x;
+            nya_math::vec3 r;
+            for(int j=0;j<4;++j)
+            {
+                const int b=int(idx[j]+0.5f);
+                r+=(pos_tr[b]+sk.get_bone_rot(b).rotate(verts[i]))*w[j];
+            }
+            result[i]=r;
+        }
+        sink+=result[count-1].x;
+    }
+};
+
+struct result
+{
+    std::string name;
+    int size;
+    double ns_per_op;
+};
+
+double measure(benchmark &b,double min_time)
+{
+    b.run(); //warm up
+
+    double best=0.0;
+    for(int attempt=0;attempt<3;++attempt)
+    {
+        int reps=1;
+        for(;;)
+        {
+            const clock_t start=clock();
+            for(int i=0;i<reps;++i)
+                b.run();
+
+            const double time=double(clock()-start)/CLOCKS_PER_SEC;
+            if(time>=min_time/3 || reps>=(1<<30))
+            {
+                const double ns=time*1.0e+9/(double(reps)*b.get_ops_count());
+                if(!attempt || ns<best)
+                    best=ns;
+                break;
+            }
+
+            reps*=2;
+        }
+    }
+
+    return best;
+}
+
+bool write_json(const char *filename,const std::vector<result> &results)
+{
+    FILE *f=fopen(filename,"wb");
+    if(!f)
+        return false;
+
+    fprintf(f,"{\n\"benchmarks\":\n[\n");
+    for(size_t i=0;i<results.size();++i)
+    {
+        const result &r=results[i];
+        fprintf(f,"{\"name\":\"%s\",\"size\":%d,\"ns_per_op\":%.4f,\"ops_per_sec\":%.0f}%s\n",
+                r.name.c_str(),r.size,r.ns_per_op,1.0e+9/r.ns_per_op,i+1<results.size()?",":"");
+    }
+    fprintf(f,"]\n}\n");
+    fclose(f);
+    return true;
+}
+
+//reads files written by write_json, one result per line
+bool read_json(const char *filename,std::vector<result> &results)
+{
+    FILE *f=fopen(filename,"rb");
+    if(!f)
+        return false;
+
+    char line[512];
+    while(fgets(line,sizeof(line),f))
+    {
+        char name[256];
+        result r;
+        if(sscanf(line," {\"name\":\"%255[^\"]\",\"size\":%d,\"ns_per_op\":%lf",name,&r.size,&r.ns_per_op)!=3)
+            continue;
+
+        r.name=name;
+        results.push_back(r);
+    }
+
+    fclose(f);
+    return true;
+}
+
+const result *find(const std::vector<result> &results,const std::string &name,int size)
+{
+    for(size_t i=0;i<results.size();++i)
+    {
+        if(results[i].name==name && results[i].size==size)
+            return &results[i];
+    }
+
+    return 0;
+}
+
+}
+
+int main(int argc,const char *argv[])
+{
+    const char *filter=0,*json=0,*baseline=0;
+    double min_time=0.1,threshold=0.1;
+
+    for(int i=1;i<argc;++i)
+    {
+        const bool has_value=i+1<argc;
+        if(strcmp(argv[i],"-filter")==0 && has_value)
+            filter=argv[++i];
+        else if(strcmp(argv[i],"-min_time")==0 && has_value)
+            min_time=atof(argv[++i])/1000.0;
+        else if(strcmp(argv[i],"-json")==0 && has_value)
+            json=argv[++i];
+        else if(strcmp(argv[i],"-baseline")==0 && has_value)
+            baseline=argv[++i];
+        else if(strcmp(argv[i],"-threshold")==0 && has_value)
+            threshold=atof(argv[++i])/100.0;
+        else
+        {
+            printf(help);
+            return strcmp(argv[i],"-help")==0?0:-1;
+        }
+    }
+
+    std::vector<result> base;
+    if(baseline && !read_json(baseline,base))
+    {
+        printf("unable to read baseline %s\n",baseline);
+        return -1;
+    }
+
+    const int array_sizes[]={64,4096,262144,0};
+    const int tree_sizes[]={1000,10000,100000,0};
+    const int anim_sizes[]={30,300,3000,0};
+    const int bound_sizes[]={1,50,200,0};
+    const int bones_sizes[]={50,300,1000,0};
+    const int ik_sizes[]={2,8,32,0};
+
+    struct entry { benchmark *b; const int *sizes; };
+    const entry benchmarks[]=
+    {
+        {new mat4_multiply,array_sizes},{new mat4_multiply_batch,array_sizes},{new mat4_invert,array_sizes},
+        {new quat_slerp,array_sizes},{new quat_slerp_fast,array_sizes},{new quat_nlerp,array_sizes},{new quat_slerp_n,array_sizes},
+        {new quat_rotate,array_sizes},{new quat_rotate_batch,array_sizes},
+        {new bezier_get,array_sizes},{new bezier_get_batch,array_sizes},
+        {new frustum_aabb,array_sizes},{new frustum_aabb_batch,array_sizes},
+        {new aabb_transform,array_sizes},
+        {new quadtree_frustum,tree_sizes},{new quadtree_aabb,tree_sizes},
+        {new aabb_tree_frustum,tree_sizes},{new aabb_tree_raycast,tree_sizes},
+        {new triangle_tree_raycast,tree_sizes},
+        {new animation_sample,anim_sizes},{new animation_sample_cursor,anim_sizes},{new animation_sample_pose,anim_sizes},
+        {new animation_sample_pose_fast,anim_sizes},{new animation_sample_pose_baked,anim_sizes},
+        {new skeleton_update,bound_sizes},{new skeleton_update_partial,bound_sizes},{new skeleton_ik,ik_sizes},{new skeleton_ik_ccd,ik_sizes},{new skeleton_compose,bones_sizes},{new skeleton_copy,bound_sizes},
+        {new skin_linear,array_sizes},{new skin_dq,array_sizes},{new skin_rotate,array_sizes},
+        {new float_from_string,array_sizes}
+    };
+
+    std::vector<result> results;
+    int regressions=0;
+
+    printf("%-24s %8s %12s %14s%s\n","name","size","ns/op","ops/s",base.empty()?"":"     baseline");
+    for(size_t i=0;i<sizeof(benchmarks)/sizeof(benchmarks[0]);++i)
+    {
+        benchmark &b=*benchmarks[i].b;
+        if(filter && !strstr(b.name(),filter))
+        {
+            delete &b;
+            continue;
+        }
+
+        for(const int *size=benchmarks[i].sizes;*size;++size)
+        {
+            srand(1);
+            b.prepare(*size);
+
+            result r;
+            r.name=b.name();
+            r.size=*size;
+            r.ns_per_op=measure(b,min_time);
+            results.push_back(r);
+
+            printf("%-24s %8d %12.3f %14.0f",r.name.c_str(),r.size,r.ns_per_op,1.0e+9/r.ns_per_op);
+
+            const result *br=find(base,r.name,r.size);
+            if(br && br->ns_per_op>0.0)
+            {
+                const double change=r.ns_per_op/br->ns_per_op-1.0;
+                const bool regressed=change>threshold;
+                printf("  %+7.1f%%%s",change*100.0,regressed?" REGRESSION":"");
+                regressions+=regressed?1:0;
+            }
+
+            printf("\n");
+            fflush(stdout);
+        }
+
+        delete &b;
+    }
+
+    if(json && !write_json(json,results))
+    {
+        printf("unable to write %s\n",json);
+        return -1;
+    }
+
+    if(regressions)
+    {
+        printf("%d regressions over %.0f%% threshold\n",regressions,threshold*100.0);
+        return 1;
+    }
+
+    return 0;
+}
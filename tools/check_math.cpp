@@ -0,0 +1,307 @@
+//https://code.google.com/p/nya-engine/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <locale.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include "math/bezier.h"
+#include "formats/string_convert.h"
+
+const char *help="Usage: check_math [options]\n"
+                 "compares nya_math and nya_formats results with reference implementations\n"
+                 "returns count of failed checks\n"
+                 "options:\n"
+                 "-filter %%str%% - run only checks which name contains str\n"
+                 "-count %%n%% - random values per check, 100000 by default\n"
+                 "\n";
+
+namespace
+{
+
+int random_count=100000;
+
+unsigned int rnd_bits() { return (unsigned int)(rand()&0xffff)<<16 | (unsigned int)(rand()&0xffff); }
+
+float rnd() { return rand()/float(RAND_MAX); }
+
+float rnd_float() //any finite float, all exponents are equally likely
+{
+    for(;;)
+    {
+        const unsigned int bits=rnd_bits();
+        float f;
+        memcpy(&f,&bits,sizeof(f));
+        if(f==f && fabsf(f)<=3.4028235e38f)
+            return f;
+    }
+}
+
+bool same(float a,float b) { return memcmp(&a,&b,sizeof(a))==0; }
+
+class check
+{
+public:
+    virtual const char *name() const=0;
+    virtual void run()=0;
+
+    int get_failed() const { return m_failed; }
+    int get_checked() const { return m_checked; }
+
+protected:
+    void expect(bool ok,const char *what)
+    {
+        ++m_checked;
+        if(ok)
+            return;
+
+        if(m_failed<10)
+            printf("  %s: %s\n",name(),what);
+        ++m_failed;
+    }
+
+public:
+    check(): m_failed(0),m_checked(0) {}
+    virtual ~check() {}
+
+private:
+    int m_failed;
+    int m_checked;
+};
+
+//reference is strtof in the C locale, text is parsed again in a comma decimal point locale if one is installed
+class float_parse_check: public check
+{
+protected:
+    void expect_parse(const char *text)
+    {
+        setlocale(LC_NUMERIC,"C");
+        char *end;
+        const float ref=strtof(text,&end);
+        const size_t ref_len=end-text;
+
+        for(int i=0;i<2;++i)
+        {
+            if(i==1 && !set_comma_locale())
+                break;
+
+            float f=0.0f;
+            const size_t len=nya_formats::float_from_string(text,strlen(text),f);
+
+            char buf[256];
+            snprintf(buf,sizeof(buf),"'%s' parsed as %.9g (%d chars), expected %.9g (%d chars)%s",
+                     text,f,int(len),ref,int(ref_len),i?" in comma locale":"");
+            expect(len==ref_len && (!len || same(f,ref)),buf);
+        }
+
+        setlocale(LC_NUMERIC,"C");
+    }
+
+    void expect_vec4(const std::string &text)
+    {
+        setlocale(LC_NUMERIC,"C");
+        float ref[4]={0.0f};
+        const char *s=text.c_str();
+        for(int i=0;i<4 && *s;++i)
+        {
+            char *end;
+            ref[i]=strtof(s,&end);
+            s=*end==','?end+1:end;
+        }
+
+        for(int i=0;i<2;++i)
+        {
+            if(i==1 && !set_comma_locale())
+                break;
+
+            const nya_math::vec4 v=nya_formats::vec4_from_string(text);
+
+            char buf[256];
+            snprintf(buf,sizeof(buf),"'%s' parsed as %.9g,%.9g,%.9g,%.9g%s",text.c_str(),v.x,v.y,v.z,v.w,i?" in comma locale":"");
+            expect(same(v.x,ref[0]) && same(v.y,ref[1]) && same(v.z,ref[2]) && same(v.w,ref[3]),buf);
+        }
+
+        setlocale(LC_NUMERIC,"C");
+    }
+
+public:
+    static bool set_comma_locale()
+    {
+        const char *locales[]={"de_DE.UTF-8","de_DE.utf8","de_DE","ru_RU.UTF-8","fr_FR.UTF-8","German",0};
+        for(const char **l=locales;*l;++l)
+        {
+            if(setlocale(LC_NUMERIC,*l) && *localeconv()->decimal_point==',')
+                return true;
+        }
+
+        setlocale(LC_NUMERIC,"C");
+        return false;
+    }
+};
+
+struct float_from_string_cases: public float_parse_check
+{
+    const char *name() const { return "float_from_string_cases"; }
+
+    void run()
+    {
+        const char *cases[]=
+        {
+            "0","-0","+7","1",".5","5.","0.1","-2.5e+3","1e10","1E-10","3.14159265358979",
+            "16777216","16777217","16777219", //ties to even above 2^24
+            "1.00000005960464477539062500","1.000000059604644775390625001", //exact midpoint, just above it
+            "0.000000059604644775390625","1e22","1e23","9007199254740993",
+            "3.4028235e38","3.40282356e38","3.4028236e38","1e39","1e400",
+            "1.17549435e-38","1.4e-45","7e-46","7.1e-46","1e-50","1e-400",
+            "123456789012345678901234567890","0.000000000000000000000000000001234567890123456789",
+            "12abc","1e","1e+","1.5e-3,2","-.25"
+        };
+
+        for(size_t i=0;i<sizeof(cases)/sizeof(cases[0]);++i)
+            expect_parse(cases[i]);
+    }
+};
+
+struct float_from_string_round_trip: public float_parse_check
+{
+    const char *name() const { return "float_from_string_round_trip"; }
+
+    void run()
+    {
+        const bool has_comma_locale=set_comma_locale();
+        setlocale(LC_NUMERIC,"C");
+        if(!has_comma_locale)
+            printf("  %s: no comma decimal point locale installed, checked in the C locale only\n",name());
+
+        for(int i=0;i<random_count;++i)
+        {
+            const float f=rnd_float();
+            char buf[64];
+            snprintf(buf,sizeof(buf),"%.9g",f); //enough digits to be exact
+            expect_parse(buf);
+        }
+    }
+};
+
+struct vec4_from_string_round_trip: public float_parse_check
+{
+    const char *name() const { return "vec4_from_string_round_trip"; }
+
+    void run()
+    {
+        const int precisions[]={-1,0,3,9};
+        for(int i=0;i<random_count/4;++i)
+        {
+            nya_math::vec4 v(rnd_float(),rnd_float(),rnd_float(),rnd_float());
+            if(i%2)
+                v*=1.0e-30f; //moderate magnitudes, fixed precision output keeps digits
+
+            expect_vec4(nya_formats::string_from_vec4(v,precisions[i%4]));
+        }
+    }
+};
+
+//y at x by bisection on the cubic in double precision
+double bezier_reference(double x1,double y1,double x2,double y2,double x)
+{
+    double lo=0.0,hi=1.0;
+    for(int i=0;i<64;++i)
+    {
+        const double t=(lo+hi)*0.5;
+        if(3.0*(1.0-t)*(1.0-t)*t*x1+3.0*(1.0-t)*t*t*x2+t*t*t<x)
+            lo=t;
+        else
+            hi=t;
+    }
+
+    const double t=(lo+hi)*0.5;
+    return 3.0*(1.0-t)*(1.0-t)*t*y1+3.0*(1.0-t)*t*t*y2+t*t*t;
+}
+
+struct bezier_get: public check
+{
+    const char *name() const { return "bezier_get"; }
+
+    void run()
+    {
+        //control points on the end points have 0/0 slope there
+        const float cases[][4]={{0.0f,0.0f,0.5f,0.9f},{0.2f,0.7f,1.0f,1.0f},{0.0f,0.0f,0.0f,1.0f},{0.0f,0.0f,1.0f,0.3f},
+                                {0.0f,1.0f,1.0f,0.0f},{1.0f,0.0f,0.0f,1.0f},{0.0f,0.0f,1.0f,1.0f},{0.5f,0.5f,0.5f,0.5f}};
+        const int cases_count=int(sizeof(cases)/sizeof(cases[0]));
+        const int curves_count=cases_count+random_count/100;
+        const int samples_count=100;
+
+        std::vector<float> p(curves_count*4);
+        for(int i=0;i<curves_count;++i)
+        {
+            for(int j=0;j<4;++j)
+                p[i*4+j]=i<cases_count?cases[i][j]:rand()%128/127.0f; //vmd-like quantization hits end points often
+        }
+
+        std::vector<float> x(samples_count),r(samples_count);
+        for(int i=0;i<curves_count;++i)
+        {
+            const float *c=&p[i*4];
+            const nya_math::bezier b(c[0],c[1],c[2],c[3]);
+            for(int j=0;j<samples_count;++j)
+                x[j]=j<2?float(j):rnd();
+
+            b.get(&x[0],&r[0],samples_count);
+            for(int j=0;j<samples_count;++j)
+            {
+                const float y=b.get(x[j]);
+                const bool linear=fabsf(c[0]-c[1])<0.001f && fabsf(c[2]-c[3])<0.001f;
+                const double ref=linear?x[j]:bezier_reference(c[0],c[1],c[2],c[3],x[j]);
+
+                char buf[256];
+                snprintf(buf,sizeof(buf),"curve %g,%g,%g,%g at %.9g is %.9g, batch %.9g, expected %.9g",c[0],c[1],c[2],c[3],x[j],y,r[j],ref);
+                expect(fabs(y-ref)<0.0001 && same(y,r[j]),buf);
+            }
+        }
+    }
+};
+
+}
+
+int main(int argc,const char *argv[])
+{
+    const char *filter=0;
+    for(int i=1;i<argc;++i)
+    {
+        const bool has_value=i+1<argc;
+        if(strcmp(argv[i],"-filter")==0 && has_value)
+            filter=argv[++i];
+        else if(strcmp(argv[i],"-count")==0 && has_value)
+            random_count=atoi(argv[++i]);
+        else
+        {
+            printf(help);
+            return strcmp(argv[i],"-help")==0?0:-1;
+        }
+    }
+
+    check *checks[]=
+    {
+        new float_from_string_cases,new float_from_string_round_trip,new vec4_from_string_round_trip,
+        new bezier_get
+    };
+
+    int failed=0;
+    for(size_t i=0;i<sizeof(checks)/sizeof(checks[0]);++i)
+    {
+        check &c=*checks[i];
+        if(!filter || strstr(c.name(),filter))
+        {
+            srand(1);
+            c.run();
+            printf("%-32s %8d checked %8d failed\n",c.name(),c.get_checked(),c.get_failed());
+            failed+=c.get_failed();
+        }
+
+        delete &c;
+    }
+
+    return failed;
+}
@@ -0,0 +1,182 @@
+//https://code.google.com/p/nya-engine/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <vector>
+#include "formats/nms.h"
+#include "formats/nms_quantizer.h"
+
+const char *help="Usage: nms_quantizer %%src.nms%% %%dst.nms%% [options]\n"
+                 "rewrites nms mesh with quantized vertex attributes, outputs nms version 3\n"
+                 "options:\n"
+                 "-no_pos - keep float positions\n"
+                 "-no_normals - keep float normals\n"
+                 "-no_tc - keep float32 texture coordinates\n"
+                 "-weights_tc %%idx%% - texture coordinates layer with bone weights,\n"
+                 "                      by default found by semantics\n"
+                 "-page_align - align vertex and index data to memory pages\n"
+                 "\n";
+
+const char *atrib_type_name(nya_formats::nms_mesh_chunk::vertex_atrib_type type)
+{
+    switch(type)
+    {
+        case nya_formats::nms_mesh_chunk::float16: return "float16";
+        case nya_formats::nms_mesh_chunk::float32: return "float32";
+        case nya_formats::nms_mesh_chunk::uint8: return "uint8";
+        case nya_formats::nms_mesh_chunk::uint16: return "uint16";
+    }
+
+    return "unknown";
+}
+
+bool read_file(const char *name,std::vector<char> &data)
+{
+    FILE *f=fopen(name,"rb");
+    if(!f)
+        return false;
+
+    fseek(f,0,SEEK_END);
+    data.resize(ftell(f));
+    fseek(f,0,SEEK_SET);
+    const bool result=data.empty() || fread(&data[0],1,data.size(),f)==data.size();
+    fclose(f);
+    return result;
+}
+
+int main(int argc,char **argv)
+{
+    if(argc<3)
+    {
+        printf("%s",help);
+        return -1;
+    }
+
+    nya_formats::nms_quantizer::options opt;
+    bool page_align=false;
+    for(int i=3;i<argc;++i)
+    {
+        if(strcmp(argv[i],"-no_pos")==0)
+            opt.positions=false;
+        else if(strcmp(argv[i],"-no_normals")==0)
+            opt.normals=false;
+        else if(strcmp(argv[i],"-no_tc")==0)
+            opt.tcs=false;
+        else if(strcmp(argv[i],"-weights_tc")==0 && i+1<argc)
+            opt.weights_tc=atoi(argv[++i]);
+        else if(strcmp(argv[i],"-page_align")==0)
+            page_align=true;
+        else
+        {
+            printf("%s",help);
+            return -1;
+        }
+    }
+
+    std::vector<char> src;
+    if(!read_file(argv[1],src))
+    {
+        fprintf(stderr,"Error: unable to read %s\n",argv[1]);
+        return -1;
+    }
+
+    nya_formats::nms nms;
+    if(src.empty() || !nms.read_chunks_info(&src[0],src.size()))
+    {
+        fprintf(stderr,"Error: invalid nms file %s\n",argv[1]);
+        return -1;
+    }
+
+    const unsigned int src_version=nms.version;
+    nms.version=nya_formats::nms::latest_version;
+
+    std::vector<nya_formats::nms_quantizer> quantizers;
+    std::vector<std::vector<char> > buffers(nms.chunks.size());
+    bool has_materials=false;
+    int dequant_idx= -1;
+
+    for(size_t i=0;i<nms.chunks.size();++i)
+    {
+        nya_formats::nms::chunk_info &c=nms.chunks[i];
+        if(c.type!=nya_formats::nms::mesh_data)
+            continue;
+
+        nya_formats::nms_mesh_chunk from;
+        if(!from.read_header(c.data,c.size,src_version))
+        {
+            fprintf(stderr,"Error: invalid mesh chunk\n");
+            return -1;
+        }
+
+        quantizers.resize(quantizers.size()+1);
+        nya_formats::nms_quantizer &q=quantizers.back();
+        nya_formats::nms_mesh_chunk to;
+        if(!q.quantize(from,to,opt))
+        {
+            fprintf(stderr,"Error: unable to quantize mesh chunk\n");
+            return -1;
+        }
+
+        to.data_align=page_align?nya_formats::nms_mesh_chunk::page_data_align:nya_formats::nms_mesh_chunk::default_data_align;
+
+        std::vector<char> &buf=buffers[i];
+        buf.resize(c.size+size_t(to.vertex_stride)*to.verts_count+to.data_align*2+64);
+        c.size=(unsigned int)to.write_to_buf(&buf[0],buf.size(),nms.version);
+        c.data=&buf[0];
+        c.align=to.data_align;
+
+        printf("mesh %d: %d verts, stride %d -> %d\n",int(quantizers.size()-1),from.verts_count,from.vertex_stride,to.vertex_stride);
+        for(size_t j=0;j<q.report.size();++j)
+        {
+            const nya_formats::nms_quantizer::attribute_report &r=q.report[j];
+            if(r.type==nya_formats::nms_mesh_chunk::pos && r.from_type!=r.to_type && dequant_idx<0)
+                dequant_idx=int(quantizers.size()-1);
+
+            printf("  %-12s %s[%d] -> %s[%d] max error %f avg error %f\n",r.semantics.empty()?"-":r.semantics.c_str(),
+                   atrib_type_name(r.from_type),r.from_size,atrib_type_name(r.to_type),r.to_size,r.max_error,r.avg_error);
+        }
+    }
+
+    for(size_t i=0;i<nms.chunks.size();++i)
+    {
+        nya_formats::nms::chunk_info &c=nms.chunks[i];
+        if(c.type!=nya_formats::nms::materials || dequant_idx<0)
+            continue;
+
+        nya_formats::nms_material_chunk m;
+        if(!m.read(c.data,c.size,src_version))
+            continue;
+
+        nya_formats::nms_quantizer::add_dequant_params(m,quantizers[dequant_idx].pos_scale,quantizers[dequant_idx].pos_offset);
+        has_materials=true;
+
+        std::vector<char> &buf=buffers[i];
+        buf.resize(c.size+m.materials.size()*128+64);
+        c.size=(unsigned int)m.write_to_buf(&buf[0],buf.size());
+        c.data=&buf[0];
+    }
+
+    if(dequant_idx>=0 && !has_materials)
+        printf("warning: no materials chunk, position dequant params are not stored\n");
+
+    std::vector<char> dst(nms.get_nms_size());
+    if(dst.empty() || !nms.write_to_buf(&dst[0],dst.size()))
+    {
+        fprintf(stderr,"Error: unable to write nms\n");
+        return -1;
+    }
+
+    FILE *f=fopen(argv[2],"wb");
+    if(!f || fwrite(&dst[0],1,dst.size(),f)!=dst.size())
+    {
+        fprintf(stderr,"Error: unable to write %s\n",argv[2]);
+        if(f)
+            fclose(f);
+        return -1;
+    }
+
+    fclose(f);
+    printf("saved %s: %d kb -> %d kb\n",argv[2],int(src.size()/1024),int(dst.size()/1024));
+    return 0;
+}
@@ -1,29 +1,127 @@
 #https://code.google.com/p/nya-engine/
 
+import math
 from bin_data import *
 from nya_math import *
 
+#bezier interpolation is (x1,y1,x2,y2) tuple, None is linear
+
+def lerp_vec3(a,b,k):
+    return a+(b-a)*k
+
+def slerp_quat(a,b,k):
+    d = a.v.x*b.v.x + a.v.y*b.v.y + a.v.z*b.v.z + a.w*b.w
+    s = 1.0
+    if d < 0.0:
+        d = -d
+        s = -1.0
+    if d > 0.9999:
+        k0 = 1.0 - k
+        k1 = k*s
+    else:
+        angle = math.acos(d)
+        k0 = math.sin((1.0 - k)*angle)/math.sin(angle)
+        k1 = math.sin(k*angle)/math.sin(angle)*s
+    q = nya_quat()
+    q.v = a.v*k0 + b.v*k1
+    q.w = a.w*k0 + b.w*k1
+    return q
+
+def quat_angle(a,b):
+    l = math.sqrt((a.v.x*a.v.x + a.v.y*a.v.y + a.v.z*a.v.z + a.w*a.w)*(b.v.x*b.v.x + b.v.y*b.v.y + b.v.z*b.v.z + b.w*b.w))
+    if l == 0.0:
+        return 0.0
+    d = abs(a.v.x*b.v.x + a.v.y*b.v.y + a.v.z*b.v.z + a.w*b.w)/l
+    return 2.0*math.acos(min(d,1.0))
+
+def vec3_dist(a,b):
+    d = a-b
+    return math.sqrt(d.x*d.x + d.y*d.y + d.z*d.z)
+
+#smallest three, 15 bits per component, largest component idx in the lowest bits of the first two
+def pack_quat(q):
+    c = [q.v.x,q.v.y,q.v.z,q.w]
+    l = math.sqrt(sum(x*x for x in c))
+    if l > 0.0:
+        c = [x/l for x in c]
+    largest = max(range(4),key=lambda i: abs(c[i]))
+    if c[largest] < 0.0:
+        c = [-x for x in c]
+    s = math.sqrt(2.0)
+    p = []
+    for i in range(4):
+        if i == largest:
+            continue
+        u = int(round((c[i]*s + 1.0)*0.5*32767))
+        p.append(max(0,min(32767,u)) << 1)
+    p[0] |= largest & 1
+    p[1] |= largest >> 1
+    return p
+
 class nan_animation:
     class pos_frame:
         def __init__( self ):
             self.time = 0
             self.pos = nya_vec3()
+            self.inter = None #linear or (x,y,z) beziers
 
     class rot_frame:
         def __init__( self ):
             self.time = 0
             self.rot = nya_quat()
+            self.inter = None #linear or bezier
 
     class bone_frames:
         def __init__( self ):
             self.name = ""
-            self.type = 0 #10 pos_vec3_linear, 20 rot_quat_linear
+            self.type = 0 #10 pos_vec3_linear, 20 rot_quat_linear, inter of frames is written in version 2
             self.frames = []
 
     def __init__( self ):
         self.bones = []
 
-    def write(self,file_name):
+    #removes linear frames which could be interpolated from neighbours within tolerance
+    #pos tolerance is distance, rot tolerance is angle in radians
+    def reduce(self,pos_tolerance,rot_tolerance):
+        for b in self.bones:
+            if b.type == 10:
+                self.reduce_frames(b,pos_tolerance,lambda f: f.pos,lerp_vec3,vec3_dist)
+            elif b.type == 20:
+                self.reduce_frames(b,rot_tolerance,lambda f: f.rot,slerp_quat,quat_angle)
+
+    @staticmethod
+    def reduce_frames(b,tolerance,value,interpolate,dist):
+        frames = sorted(b.frames,key=lambda f: f.time)
+        if len(frames) < 3 or tolerance <= 0.0:
+            return
+
+        def reducible(a,e):
+            fa = frames[a]
+            fe = frames[e]
+            for f in frames[a+1:e+1]:
+                if f.inter is not None:
+                    return False
+            for f in frames[a+1:e]:
+                k = float(f.time-fa.time)/(fe.time-fa.time)
+                if dist(interpolate(value(fa),value(fe),k),value(f)) > tolerance:
+                    return False
+            return True
+
+        keep = [frames[0]]
+        a = 0
+        for e in range(2,len(frames)):
+            if e-a <= 256 and reducible(a,e):
+                continue
+            a = e-1
+            keep.append(frames[a])
+        keep.append(frames[-1])
+
+        if len(keep) == 2 and reducible(0,len(frames)-1) and dist(value(keep[0]),value(keep[1])) <= tolerance:
+            keep = keep[1:]
+
+        b.frames = keep
+
+    def write(self,file_name,version=2):
         fo = open(file_name,"wb")
         if fo == 0:
             print "unable to open file ", file_name
@@ -31,13 +129,51 @@ class nan_animation:
 
         out = bin_data()
         out.add_data("nya anim")
-        out.add_uint(1) #version
+        out.add_uint(version)
+
+        #shared interpolation curves, 1-based idx, 0 is linear
+        inters = []
+        inters_idx = {}
+        def inter_idx(i):
+            if i is None or (abs(i[0]-i[1]) < 0.001 and abs(i[2]-i[3]) < 0.001):
+                return 0
+            i = tuple(i)
+            if i not in inters_idx:
+                inters.append(i)
+                inters_idx[i] = len(inters)
+            return inters_idx[i]
+
+        if version >= 2:
+            for b in self.bones:
+                for f in b.frames:
+                    if b.type == 10 and f.inter is not None:
+                        for i in f.inter:
+                            inter_idx(i)
+                    elif b.type == 20:
+                        inter_idx(f.inter)
+
+            if len(inters) > 65535:
+                print "too many interpolation curves: ", len(inters)
+                return
+
+            out.add_uint(len(inters))
+            for i in inters:
+                out.add_floats(i)
 
         out.add_uint(len(self.bones))
 
         for b in self.bones:
+            has_inter = version >= 2 and any(inter_idx(f.inter) != 0 if b.type == 20 else f.inter is not None for f in b.frames)
+
             out.add_string(b.name)
-            out.add_uchar(b.type)
+            if version < 2:
+                out.add_uchar(b.type)
+            elif b.type == 10:
+                out.add_uchar(11 if has_inter else 10)
+            elif b.type == 20:
+                out.add_uchar(23 if has_inter else 22) #packed
+            else:
+                out.add_uchar(b.type)
             out.add_uint(len(b.frames))
 
             if b.type == 10:
@@ -46,13 +182,21 @@ class nan_animation:
                     out.add_float(f.pos.x)
                     out.add_float(f.pos.y)
                     out.add_float(f.pos.z)
+                    if has_inter:
+                        i = f.inter if f.inter is not None else (None,None,None)
+                        out.add_ushorts([inter_idx(c) for c in i])
             elif b.type == 20:
                 for f in b.frames:
                     out.add_uint(f.time)
-                    out.add_float(f.rot.v.x)
-                    out.add_float(f.rot.v.y)
-                    out.add_float(f.rot.v.z)
-                    out.add_float(f.rot.w)
+                    if version < 2:
+                        out.add_float(f.rot.v.x)
+                        out.add_float(f.rot.v.y)
+                        out.add_float(f.rot.v.z)
+                        out.add_float(f.rot.w)
+                        continue
+                    out.add_ushorts(pack_quat(f.rot))
+                    if has_inter:
+                        out.add_ushort(inter_idx(f.inter))
 
         fo.write(out.data)
 
@@ -1,6 +1,7 @@
 #https://code.google.com/p/nya-engine/
 
 from bin_data import *
+import struct
 
 class nms_mesh:
     class nms_vertex_attribute:
@@ -53,6 +54,58 @@ class nms_mesh:
         self.materials = []
         self.joints = []
 
+    data_align = 16 #vertex and index data alignment, 4096 for page aligned meshes
+
+    @staticmethod
+    def align_padding(offset,align):
+        return (align - offset % align) % align
+
+    def add_chunk(self,out,type,data,align=16):
+        out.add_uint(type)
+        out.add_uint(len(data))
+        padding = self.align_padding(len(out.data) + 4,align)
+        out.add_uint(padding)
+        out.data += '\0' * padding
+        out.data += data
+
+    def calc_aabb(self,offset,count):
+        stride = 0
+        pos_offset = -1
+        pos_dim = 0
+        for a in self.vert_attr:
+            if a.type == 0:
+                pos_offset = stride
+                pos_dim = min(a.dimension,3)
+            stride += a.dimension
+
+        if pos_offset < 0 or pos_dim == 0 or self.vcount == 0:
+            return [0.0] * 6
+
+        if count > 0 and len(self.indices) > 0:
+            idxs = self.indices[offset:offset + count]
+        elif count > 0:
+            idxs = range(offset,offset + count)
+        else:
+            idxs = range(self.vcount)
+
+        mn = [ 1e38] * 3
+        mx = [-1e38] * 3
+        for i in idxs:
+            for j in range(pos_dim):
+                v = self.verts_data[i * stride + pos_offset + j]
+                mn[j] = min(mn[j],v)
+                mx[j] = max(mx[j],v)
+        for j in range(pos_dim,3):
+            mn[j] = mx[j] = 0.0
+        return mn + mx
+
+    @staticmethod
+    def fnv1a(hash,data):
+        for c in data:
+            hash ^= ord(c)
+            hash = (hash * 1099511628211) & 0xffffffffffffffff
+        return hash
+
     def write(self,file_name):
         f = open(file_name,"wb")
         if f == 0:
@@ -61,7 +114,7 @@ class nms_mesh:
 
         out = bin_data()
         out.add_data("nya mesh")
-        out.add_uint(1) #version ToDo: version 2
+        out.add_uint(3) #version
         chunks_count = 1
 
         mat_count = len(self.materials)
@@ -78,28 +131,32 @@ class nms_mesh:
 
         buf = bin_data()
 
-        for i in range(6): #ToDo: aabb
-            buf.add_float(0)
+        for v in self.calc_aabb(0,0):
+            buf.add_float(v)
 
         atr_count = len(self.vert_attr)
         buf.add_uchar(atr_count)
         for a in self.vert_attr:
             buf.add_uchar(a.type)
             buf.add_uchar(a.dimension)
+            buf.add_uchar(1) #float32
             buf.add_string(a.semantics)
 
         buf.add_uint(self.vcount)
-        buf.add_floats(self.verts_data)
+
+        verts = bin_data()
+        verts.add_floats(self.verts_data)
 
         icount = len(self.indices)
+        inds = bin_data()
         if icount>65535:
             buf.add_uchar(4) #uint indices
             buf.add_uint(icount)
-            buf.add_uints(self.indices)
+            inds.add_uints(self.indices)
         elif icount>0:
             buf.add_uchar(2) #ushort indices
             buf.add_uint(icount)
-            buf.add_ushorts(self.indices)
+            inds.add_ushorts(self.indices)
         else:
             buf.add_uchar(0) #no indices
 
@@ -108,15 +165,33 @@ class nms_mesh:
         buf.add_ushort(groups_count)
         for g in self.groups:
             buf.add_string(g.name)
-            for j in range(6):
-                buf.add_float(0)
+            for v in self.calc_aabb(g.offset,g.count):
+                buf.add_float(v)
             buf.add_ushort(g.mat_idx)
             buf.add_uint(g.offset)
             buf.add_uint(g.count)
+            buf.add_uchar(0) #triangles
+
+        align = self.data_align
+        verts_offset = len(buf.data) + 8 + 4 * 3
+        verts_offset += self.align_padding(verts_offset,align)
+        inds_offset = 0
+        if icount > 0:
+            inds_offset = verts_offset + len(verts.data)
+            inds_offset += self.align_padding(inds_offset,align)
+
+        buf.data += struct.pack('<Q',self.fnv1a(self.fnv1a(14695981039346656037,verts.data),inds.data))
+        buf.add_uint(align)
+        buf.add_uint(verts_offset)
+        buf.add_uint(inds_offset)
+
+        buf.data += '\0' * (verts_offset - len(buf.data))
+        buf.data += verts.data
+        if icount > 0:
+            buf.data += '\0' * (inds_offset - len(buf.data))
+            buf.data += inds.data
 
-        out.add_uint(0) #mesh
-        out.add_uint(len(buf.data))
-        out.data += buf.data
+        self.add_chunk(out,0,buf.data,max(align,16)) #mesh
 
         #-------------- materials data ---------------
 
@@ -147,9 +222,7 @@ class nms_mesh:
 
                 buf.add_ushort(0) #ToDo: integer params
 
-            out.add_uint(2) #materials
-            out.add_uint(len(buf.data))
-            out.data += buf.data
+            self.add_chunk(out,2,buf.data) #materials
 
         #-------------- skeleton data ---------------
 
@@ -170,8 +243,6 @@ class nms_mesh:
 
                 buf.add_int(self.joints[i].parent)
 
-            out.add_uint(1) #skeleton
-            out.add_uint(len(buf.data))
-            out.data += buf.data
+            self.add_chunk(out,1,buf.data) #skeleton
 
         f.write(out.data)